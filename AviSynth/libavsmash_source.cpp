@@ -30,7 +30,27 @@
 static const char func_name_video_source[] = "LSMASHVideoSource";
 static const char func_name_audio_source[] = "LSMASHAudioSource";
 
-uint32_t LSMASHVideoSource::open_file(const char* source, IScriptEnvironment* env)
+/* Hold the shared root while in scope, including when an error is thrown.
+ * Samples are read under the same lock by get_sample(), so the lock is only held here while a track is set up. */
+class shared_file_lock {
+private:
+    lsmash_root_t* root;
+
+public:
+    explicit shared_file_lock(lsmash_root_t* root)
+        : root { root }
+    {
+        libavsmash_lock_shared_file(root);
+    }
+    ~shared_file_lock()
+    {
+        libavsmash_unlock_shared_file(root);
+    }
+    shared_file_lock(const shared_file_lock&) = delete;
+    shared_file_lock& operator=(const shared_file_lock&) = delete;
+};
+
+uint32_t LSMASHVideoSource::open_file(const char* source, uint32_t track_number, IScriptEnvironment* env)
 {
     libavsmash_video_decode_handler_t* vdhp = this->vdhp.get();
     lw_log_handler_t* lhp = libavsmash_video_get_log_handler(vdhp);
@@ -39,17 +59,14 @@ uint32_t LSMASHVideoSource::open_file(const char* source, IScriptEnvironment* en
     lhp->priv = env;
     lhp->show_log = throw_error;
     lsmash_movie_parameters_t movie_param;
-    AVFormatContext* format_ctx = nullptr;
-    lsmash_root_t* root = libavsmash_open_file(&format_ctx, source, &file_param, &movie_param, lhp);
-    this->format_ctx.reset(format_ctx);
+    root = libavsmash_open_shared_file(&format_ctx, source, ISOM_MEDIA_HANDLER_TYPE_VIDEO_TRACK, track_number, &movie_param, lhp);
     libavsmash_video_set_root(vdhp, root);
     return movie_param.number_of_tracks;
 }
 
-void LSMASHVideoSource::get_video_track(const char* source, uint32_t track_number, IScriptEnvironment* env)
+void LSMASHVideoSource::get_video_track(uint32_t number_of_tracks, uint32_t track_number, IScriptEnvironment* env)
 {
     libavsmash_video_decode_handler_t* vdhp = this->vdhp.get();
-    uint32_t number_of_tracks = open_file(source, env);
     if (track_number && track_number > number_of_tracks)
         env->ThrowError("LSMASHVideoSource: the number of tracks equals %u.", number_of_tracks);
     (void)libavsmash_video_get_track(vdhp, track_number);
@@ -163,9 +180,13 @@ LSMASHVideoSource::LSMASHVideoSource(const char* source, uint32_t track_number,
     as_vohp->env = env;
     vohp->private_handler = as_vohp;
     vohp->free_private_handler = as_free_video_output_handler;
-    get_video_track(source, track_number, env);
-    prepare_video_decoding(vdhp, vohp, format_ctx.get(), threads, direct_rendering, pixel_format, vi, env);
-    lsmash_discard_boxes(libavsmash_video_get_root(vdhp));
+    uint32_t number_of_tracks = open_file(source, track_number, env);
+    {
+        shared_file_lock lock { root };
+        get_video_track(number_of_tracks, track_number, env);
+    }
+    prepare_video_decoding(vdhp, vohp, format_ctx, threads, direct_rendering, pixel_format, vi, env);
+    release_boxes();
     has_at_least_v8 = env->FunctionExists("propShow");
     av_frame = libavsmash_video_get_frame_buffer(vdhp);
     if (!av_frame->data[0] && prefer_hw)
@@ -194,10 +215,7 @@ LSMASHVideoSource::LSMASHVideoSource(const char* source, uint32_t track_number,
 LSMASHVideoSource::~LSMASHVideoSource()
 {
     libavsmash_video_decode_handler_t* vdhp = this->vdhp.get();
-    lsmash_root_t* root = libavsmash_video_get_root(vdhp);
     lw_free(libavsmash_video_get_preferred_decoder_names(vdhp));
-    lsmash_close_file(&file_param);
-    lsmash_destroy_root(root);
 }
 
 PVideoFrame __stdcall LSMASHVideoSource::GetFrame(int n, IScriptEnvironment* env)
@@ -236,7 +254,7 @@ PVideoFrame __stdcall LSMASHVideoSource::GetFrame(int n, IScriptEnvironment* env
     return as_frame;
 }
 
-uint32_t LSMASHAudioSource::open_file(const char* source, IScriptEnvironment* env)
+uint32_t LSMASHAudioSource::open_file(const char* source, uint32_t track_number, IScriptEnvironment* env)
 {
     libavsmash_audio_decode_handler_t* adhp = this->adhp.get();
     lw_log_handler_t* lhp = libavsmash_audio_get_log_handler(adhp);
@@ -245,9 +263,7 @@ uint32_t LSMASHAudioSource::open_file(const char* source, IScriptEnvironment* en
     lhp->priv = env;
     lhp->show_log = throw_error;
     lsmash_movie_parameters_t movie_param;
-    AVFormatContext* format_ctx = nullptr;
-    lsmash_root_t* root = libavsmash_open_file(&format_ctx, source, &file_param, &movie_param, lhp);
-    this->format_ctx.reset(format_ctx);
+    root = libavsmash_open_shared_file(&format_ctx, source, ISOM_MEDIA_HANDLER_TYPE_AUDIO_TRACK, track_number, &movie_param, lhp);
     libavsmash_audio_set_root(adhp, root);
     return movie_param.number_of_tracks;
 }
@@ -278,10 +294,9 @@ static char* duplicate_as_string(void* src, size_t length)
     return dst;
 }
 
-void LSMASHAudioSource::get_audio_track(const char* source, uint32_t track_number, IScriptEnvironment* env)
+void LSMASHAudioSource::get_audio_track(uint32_t number_of_tracks, uint32_t track_number, IScriptEnvironment* env)
 {
     libavsmash_audio_decode_handler_t* adhp = this->adhp.get();
-    uint32_t number_of_tracks = open_file(source, env);
     if (track_number && track_number > number_of_tracks)
         env->ThrowError("LSMASHAudioSource: the number of tracks equals %u.", number_of_tracks);
     /* L-SMASH */
@@ -379,18 +394,19 @@ LSMASHAudioSource::LSMASHAudioSource(const char* source, uint32_t track_number,
     libavsmash_audio_set_preferred_decoder_names(adhp, tokenize_preferred_decoder_names());
     libavsmash_audio_set_drc(adhp, drc);
     libavsmash_audio_set_decoder_options(adhp, ff_options);
-    get_audio_track(source, track_number, env);
-    prepare_audio_decoding(adhp, aohp, format_ctx.get(), channel_layout, sample_rate, skip_priming, vi, env);
-    lsmash_discard_boxes(libavsmash_audio_get_root(adhp));
+    uint32_t number_of_tracks = open_file(source, track_number, env);
+    {
+        shared_file_lock lock { root };
+        get_audio_track(number_of_tracks, track_number, env);
+    }
+    prepare_audio_decoding(adhp, aohp, format_ctx, channel_layout, sample_rate, skip_priming, vi, env);
+    release_boxes();
 }
 
 LSMASHAudioSource::~LSMASHAudioSource()
 {
     libavsmash_audio_decode_handler_t* adhp = this->adhp.get();
-    lsmash_root_t* root = libavsmash_audio_get_root(adhp);
     lw_free(libavsmash_audio_get_preferred_decoder_names(adhp));
-    lsmash_close_file(&file_param);
-    lsmash_destroy_root(root);
 }
 
 void __stdcall LSMASHAudioSource::GetAudio(void* buf, int64_t start, int64_t wanted_length, IScriptEnvironment* env)
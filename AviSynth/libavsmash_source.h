@@ -30,17 +30,28 @@
 #include "lsmashsource.h"
 
 class LibavSMASHSource : public LSMASHSource {
-private:
-    void (*free_format_ctx)(AVFormatContext* p) = [](AVFormatContext* p) { avformat_close_input(&p); };
-
 protected:
-    lsmash_file_parameters_t file_param;
-    std::unique_ptr<AVFormatContext, decltype(free_format_ctx)> format_ctx;
+    /* Shared with the other sources opening the same file */
+    lsmash_root_t* root;
+    AVFormatContext* format_ctx;
+    bool boxes_released;
     LibavSMASHSource()
-        : file_param {}, format_ctx { nullptr, free_format_ctx }
+        : root { nullptr }, format_ctx { nullptr }, boxes_released { false }
+    {
+    }
+    ~LibavSMASHSource()
+    {
+        if (!root)
+            return;
+        if (!boxes_released)
+            libavsmash_release_shared_boxes(root);
+        libavsmash_close_shared_file(root);
+    }
+    inline void release_boxes(void)
     {
+        libavsmash_release_shared_boxes(root);
+        boxes_released = true;
     }
-    ~LibavSMASHSource() = default;
     LibavSMASHSource(const LibavSMASHSource&) = delete;
     LibavSMASHSource& operator=(const LibavSMASHSource&) = delete;
 };
@@ -55,8 +66,8 @@ private:
           vohp { libavsmash_video_alloc_output_handler(), libavsmash_video_free_output_handler }
     {
     }
-    uint32_t open_file(const char* source, IScriptEnvironment* env);
-    void get_video_track(const char* source, uint32_t track_number, IScriptEnvironment* env);
+    uint32_t open_file(const char* source, uint32_t track_number, IScriptEnvironment* env);
+    void get_video_track(uint32_t number_of_tracks, uint32_t track_number, IScriptEnvironment* env);
     bool has_at_least_v8;
     AVFrame* av_frame;
 
@@ -85,8 +96,8 @@ private:
           aohp { libavsmash_audio_alloc_output_handler(), libavsmash_audio_free_output_handler }
     {
     }
-    uint32_t open_file(const char* source, IScriptEnvironment* env);
-    void get_audio_track(const char* source, uint32_t track_number, IScriptEnvironment* env);
+    uint32_t open_file(const char* source, uint32_t track_number, IScriptEnvironment* env);
+    void get_audio_track(uint32_t number_of_tracks, uint32_t track_number, IScriptEnvironment* env);
 
 public:
     LSMASHAudioSource(const char* source, uint32_t track_number, bool skip_priming, const char* channel_layout, int sample_rate,
@@ -61,12 +61,12 @@ extern "C" AVS_EXPORT const char* __stdcall AvisynthPluginInit3(IScriptEnvironme
     /* LWLibavVideoSource */
     env->AddFunction("LWLibavVideoSource",
         "[source]s[stream_index]i[threads]i[cache]b[cachefile]s[seek_mode]i[seek_threshold]i[dr]b[fpsnum]i[fpsden]i[repeat]b[dominance]i["
-        "format]s[decoder]s[prefer_hw]i[ff_loglevel]i[cachedir]s[indexingpr]b[ff_options]s[rap_verification]b",
+        "format]s[decoder]s[prefer_hw]i[ff_loglevel]i[cachedir]s[indexingpr]b[ff_options]s[rap_verification]b[warm_decoder]b[keyframes_only]b[compress_cache]b[cache_verify]i",
         CreateLWLibavVideoSource, 0);
     /* LWLibavAudioSource */
     env->AddFunction("LWLibavAudioSource",
         "[source]s[stream_index]i[cache]b[cachefile]s[av_sync]b[layout]s[rate]i[decoder]s[ff_loglevel]i[cachedir]s[indexingpr]b[drc_scale]"
-        "f[ff_options]s[fill_agaps]i",
+        "f[ff_options]s[fill_agaps]i[compress_cache]b[cache_verify]i",
         CreateLWLibavAudioSource, 0);
     return "LSMASHSource";
 }
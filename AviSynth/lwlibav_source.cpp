@@ -80,7 +80,7 @@ static void prepare_video_decoding(lwlibav_video_decode_handler_t* vdhp, lwlibav
 
 LWLibavVideoSource::LWLibavVideoSource(lwlibav_option_t* opt, int seek_mode, uint32_t forward_seek_threshold, int direct_rendering,
     enum AVPixelFormat pixel_format, const char* preferred_decoder_names, int prefer_hw_decoder, bool progress, const char* ff_options,
-    IScriptEnvironment* env)
+    int warm_decoder, bool keyframes_only, IScriptEnvironment* env)
     : LWLibavVideoSource {}
 {
     memset(&vi, 0, sizeof(VideoInfo));
@@ -94,6 +94,7 @@ LWLibavVideoSource::LWLibavVideoSource(lwlibav_option_t* opt, int seek_mode, uin
     set_prefer_hw(prefer_hw_decoder);
     lwlibav_video_set_prefer_hw_decoder(vdhp, &prefer_hw);
     lwlibav_video_set_decoder_options(vdhp, ff_options);
+    lwlibav_video_set_warm_decoder(vdhp, warm_decoder);
     as_video_output_handler_t* as_vohp = (as_video_output_handler_t*)lw_malloc_zero(sizeof(as_video_output_handler_t));
     if (!as_vohp)
         env->ThrowError("LWLibavVideoSource: failed to allocate the AviSynth video output handler.");
@@ -136,6 +137,12 @@ LWLibavVideoSource::LWLibavVideoSource(lwlibav_option_t* opt, int seek_mode, uin
     vi.num_frames = vohp->frame_count;
     /* */
     prepare_video_decoding(vdhp, vohp, direct_rendering, pixel_format, env);
+    this->keyframes_only = keyframes_only;
+    if (keyframes_only) {
+        vi.num_frames = lwlibav_video_get_keyframe_count(vdhp);
+        if (vi.num_frames == 0)
+            env->ThrowError("LWLibavVideoSource: no keyframe is found.");
+    }
     has_at_least_v8 = env->FunctionExists("propShow");
     av_frame = lwlibav_video_get_frame_buffer(vdhp);
     const char* used_decoder = [&]() {
@@ -175,7 +182,8 @@ PVideoFrame __stdcall LWLibavVideoSource::GetFrame(int n, IScriptEnvironment* en
     lwlibav_video_output_handler_t* vohp = this->vohp.get();
     lw_log_handler_t* lhp = lwlibav_video_get_log_handler(vdhp);
     lhp->priv = env;
-    if (lwlibav_video_get_error(vdhp) || lwlibav_video_get_frame(vdhp, vohp, frame_number) < 0)
+    if (lwlibav_video_get_error(vdhp)
+        || (keyframes_only ? lwlibav_video_get_keyframe(vdhp, vohp, frame_number) : lwlibav_video_get_frame(vdhp, vohp, frame_number)) < 0)
         return env->NewVideoFrame(vi);
     PVideoFrame as_frame;
     if (make_frame(vohp, av_frame, as_frame, env) < 0)
@@ -221,6 +229,8 @@ bool __stdcall LWLibavVideoSource::GetParity(int n)
     uint32_t frame_number = n + 1; /* frame_number is 1-origin. */
     lwlibav_video_decode_handler_t* vdhp = this->vdhp.get();
     lwlibav_video_output_handler_t* vohp = this->vohp.get();
+    if (keyframes_only)
+        return lwlibav_video_get_field_info(vdhp, lwlibav_video_get_keyframe_position(vdhp, frame_number)) == LW_FIELD_INFO_TOP;
     if (!vohp->repeat_control)
         return lwlibav_video_get_field_info(vdhp, frame_number) == LW_FIELD_INFO_TOP ? true : false;
     uint32_t t = vohp->frame_order_list[frame_number].top;
@@ -444,6 +454,10 @@ AVSValue __cdecl CreateLWLibavVideoSource(AVSValue args, void* user_data, IScrip
     const bool progress = args[17].AsBool(true);
     const char* ff_options = args[18].AsString(nullptr);
     const bool rap_verification = args[19].AsBool(false);
+    const int warm_decoder = args[20].AsBool(false) ? 1 : 0;
+    const bool keyframes_only = args[21].AsBool(false);
+    const int compress_index = args[22].AsBool(false) ? 1 : 0;
+    const int verify_policy = args[23].AsInt(0);
     /* Set LW-Libav options. */
     lwlibav_option_t opt;
     opt.file_path = source;
@@ -456,19 +470,21 @@ AVSValue __cdecl CreateLWLibavVideoSource(AVSValue args, void* user_data, IScrip
     opt.force_video_index = stream_index >= 0 ? stream_index : -1;
     opt.force_audio = 0;
     opt.force_audio_index = -2;
-    opt.apply_repeat_flag = apply_repeat_flag;
+    opt.apply_repeat_flag = keyframes_only ? 0 : apply_repeat_flag;
     opt.field_dominance = CLIP_VALUE(field_dominance, 0, 2); /* 0: Obey source flags, 1: TFF, 2: BFF */
-    opt.vfr2cfr.active = fps_num > 0 && fps_den > 0 ? 1 : 0;
+    opt.vfr2cfr.active = fps_num > 0 && fps_den > 0 && !keyframes_only ? 1 : 0;
     opt.vfr2cfr.fps_num = fps_num;
     opt.vfr2cfr.fps_den = fps_den;
     opt.rap_verification = rap_verification;
+    opt.compress_index = compress_index;
+    opt.verify_policy = CLIP_VALUE(verify_policy, 0, 2);
     seek_mode = CLIP_VALUE(seek_mode, 0, 2);
     forward_seek_threshold = CLIP_VALUE(forward_seek_threshold, 1, 999);
     direct_rendering &= (pixel_format == AV_PIX_FMT_NONE);
     prefer_hw_decoder = CLIP_VALUE(prefer_hw_decoder, 0, 7);
     set_av_log_level(ff_loglevel);
     return new LWLibavVideoSource(&opt, seek_mode, forward_seek_threshold, direct_rendering, pixel_format, preferred_decoder_names,
-        prefer_hw_decoder, progress, ff_options, env);
+        prefer_hw_decoder, progress, ff_options, warm_decoder, keyframes_only, env);
 }
 
 AVSValue __cdecl CreateLWLibavAudioSource(AVSValue args, void* user_data, IScriptEnvironment* env)
@@ -487,6 +503,8 @@ AVSValue __cdecl CreateLWLibavAudioSource(AVSValue args, void* user_data, IScrip
     const double drc = args[11].AsFloat(-1.0);
     const char* ff_options = args[12].AsString(nullptr);
     const int fill_audio_gaps = args[13].AsInt(0);
+    const int compress_index = args[14].AsBool(false) ? 1 : 0;
+    const int verify_policy = args[15].AsInt(0);
     /* Set LW-Libav options. */
     lwlibav_option_t opt;
     opt.file_path = source;
@@ -505,6 +523,8 @@ AVSValue __cdecl CreateLWLibavAudioSource(AVSValue args, void* user_data, IScrip
     opt.vfr2cfr.fps_num = 0;
     opt.vfr2cfr.fps_den = 0;
     opt.rap_verification = 0;
+    opt.compress_index = compress_index;
+    opt.verify_policy = CLIP_VALUE(verify_policy, 0, 2);
     set_av_log_level(ff_loglevel);
     return new LWLibavAudioSource(
         &opt, layout_string, sample_rate, preferred_decoder_names, progress, drc, ff_options, fill_audio_gaps, env);
@@ -70,12 +70,13 @@ class LWLibavVideoSource : public LWLibavSource {
 private:
     LWLibavVideoSource() = default;
     bool has_at_least_v8;
+    bool keyframes_only;
     AVFrame* av_frame;
 
 public:
     LWLibavVideoSource(lwlibav_option_t* opt, int seek_mode, uint32_t forward_seek_threshold, int direct_rendering,
         enum AVPixelFormat pixel_format, const char* preferred_decoder_names, int prefer_hw_decoder, bool progress, const char* ff_options,
-        IScriptEnvironment* env);
+        int warm_decoder, bool keyframes_only, IScriptEnvironment* env);
     ~LWLibavVideoSource();
     PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
     bool __stdcall GetParity(int n);
@@ -420,7 +420,7 @@ static void close_file(void* private_stuff)
     if (!hp)
         return;
     avformat_close_input(&hp->format_ctx);
-    lsmash_close_file(&hp->file_param);
+    libavsmash_close_file(&hp->file_param);
     lsmash_destroy_root(hp->root);
     lw_free(hp);
 }
@@ -29,6 +29,7 @@ enum class OutputColorspace {
 struct VideoOptions {
     int seek_mode = 0;
     int forward_seek_threshold = 10;
+    int warm_decoder = 0;
     int scaler = 0;
     int apply_repeat_flag = 1;
     int field_dominance = 0;
@@ -424,7 +424,7 @@ void close_file(void* private_stuff)
     libavsmash_audio_free_decode_handler_ptr(&hp->adhp);
     libavsmash_audio_free_output_handler_ptr(&hp->aohp);
     avformat_close_input(&hp->format_ctx);
-    lsmash_close_file(&hp->file_param);
+    libavsmash_close_file(&hp->file_param);
     lsmash_destroy_root(hp->root);
     delete hp;
 }
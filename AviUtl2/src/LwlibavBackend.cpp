@@ -171,6 +171,7 @@ void* open_file(char* file_path, ReaderOptions* opt)
 int get_video_track(SessionCore* session, VideoOptions* opt)
 {
     auto* hp = static_cast<LwlibavHandler*>(session->video_private);
+    lwlibav_video_set_warm_decoder(hp->vdhp, opt->warm_decoder);
     if (lwlibav_video_get_desired_track(hp->lwh.file_path, hp->vdhp, hp->lwh.threads) < 0) {
         return -1;
     }
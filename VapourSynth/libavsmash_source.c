@@ -57,7 +57,7 @@ static void free_handler(lsmas_handler_t** hpp)
     libavsmash_video_free_decode_handler(hp->vdhp);
     libavsmash_video_free_output_handler(hp->vohp);
     avformat_close_input(&hp->format_ctx);
-    lsmash_close_file(&hp->file_param);
+    libavsmash_close_file(&hp->file_param);
     lsmash_destroy_root(root);
     lw_free(hp);
 }
@@ -385,3 +385,111 @@ void VS_CC vs_libavsmashsource_create(const VSMap* in, VSMap* out, void* user_da
         vsapi->mapConsumeNode(out, "clip", node, maAppend);
     }
 }
+
+void VS_CC vs_libavsmashpackets_create(const VSMap* in, VSMap* out, void* user_data, VSCore* core, const VSAPI* vsapi)
+{
+    const char* file_name = vsapi->mapGetData(in, "source", 0, NULL);
+    /* Allocate the handler of this plugin. */
+    lsmas_handler_t* hp = alloc_handler();
+    if (!hp) {
+        vsapi->mapSetError(out, "lsmas: failed to allocate the handler.");
+        return;
+    }
+    libavsmash_video_decode_handler_t* vdhp = hp->vdhp;
+    /* Set up VapourSynth error handler. */
+    vs_basic_handler_t vsbh = { 0 };
+    vsbh.out = out;
+    vsbh.frame_ctx = NULL;
+    vsbh.vsapi = vsapi;
+    /* Set up log handler. */
+    lw_log_handler_t lh = { 0 };
+    lh.level = LW_LOG_FATAL;
+    lh.priv = &vsbh;
+    lh.show_log = set_error;
+    /* Open source file. */
+    uint32_t number_of_tracks = open_file(hp, file_name, &lh);
+    if (number_of_tracks == 0) {
+        free_handler(&hp);
+        vsapi->mapSetError(out, "lsmas: failed to open file.");
+        return;
+    }
+    /* Get options. */
+    int64_t first;
+    int64_t last;
+    int64_t track_number;
+    set_option_int64(&first, 0, "first", in, vsapi);
+    set_option_int64(&last, 0, "last", in, vsapi);
+    set_option_int64(&track_number, 0, "track", in, vsapi);
+    av_log_set_level(AV_LOG_QUIET);
+    if (track_number && track_number > number_of_tracks) {
+        free_handler(&hp);
+        set_error_on_init(out, vsapi, "lsmas: the number of tracks equals %" PRIu32 ".", number_of_tracks);
+        return;
+    }
+    libavsmash_video_set_log_handler(vdhp, &lh);
+    /* Get video track. No decoder is opened since the packets are returned as they are. */
+    if (libavsmash_video_get_track(vdhp, track_number) < 0 || libavsmash_video_get_summaries(vdhp) < 0) {
+        free_handler(&hp);
+        vsapi->mapSetError(out, "lsmas: failed to get video track.");
+        return;
+    }
+    /* Get the composition order of the samples. */
+    int64_t fps_num;
+    int64_t fps_den;
+    if (libavsmash_video_setup_timestamp_info(vdhp, hp->vohp, &fps_num, &fps_den) < 0) {
+        free_handler(&hp);
+        vsapi->mapSetError(out, "lsmas: failed to get the timestamps of video track.");
+        return;
+    }
+    libavsmash_video_clear_error(vdhp);
+    /* Read the samples required for the requested frames.
+     * Frame numbers given by the user are 0-origin. */
+    uint32_t first_sample_number;
+    uint32_t last_sample_number;
+    if (first < 0 || last < first
+        || libavsmash_video_get_packet_range(vdhp, (uint32_t)first + 1, (uint32_t)last + 1, &first_sample_number, &last_sample_number)
+            < 0) {
+        free_handler(&hp);
+        vsapi->mapSetError(out, "lsmas: invalid frame range.");
+        return;
+    }
+    AVPacket pkt = { 0 };
+    uint32_t last_sample_description_index = 0;
+    int extradata_count = 0;
+    for (uint32_t i = first_sample_number; i <= last_sample_number; i++) {
+        uint32_t sample_description_index;
+        if (libavsmash_video_get_packet(vdhp, i, &pkt, &sample_description_index) < 0) {
+            av_packet_unref(&pkt);
+            free_handler(&hp);
+            set_error_on_init(out, vsapi, "lsmas: failed to read the sample %u.", i - 1);
+            return;
+        }
+        if (sample_description_index != last_sample_description_index) {
+            /* Add the decoder configuration every time it changes. */
+            uint8_t* extradata;
+            int extradata_size;
+            if (libavsmash_video_get_extradata(vdhp, sample_description_index, &extradata, &extradata_size) < 0) {
+                av_packet_unref(&pkt);
+                free_handler(&hp);
+                set_error_on_init(out, vsapi, "lsmas: failed to get the decoder configuration of the sample %u.", i - 1);
+                return;
+            }
+            if (extradata)
+                vsapi->mapSetData(out, "extradata", (const char*)extradata, extradata_size, dtBinary, maAppend);
+            else
+                vsapi->mapSetData(out, "extradata", "", 0, dtBinary, maAppend);
+            av_free(extradata);
+            last_sample_description_index = sample_description_index;
+            ++extradata_count;
+        }
+        vsapi->mapSetData(out, "packets", (const char*)pkt.data, pkt.size, dtBinary, maAppend);
+        vsapi->mapSetInt(out, "pts", pkt.pts, maAppend);
+        vsapi->mapSetInt(out, "dts", pkt.dts, maAppend);
+        vsapi->mapSetInt(out, "key", !!(pkt.flags & AV_PKT_FLAG_KEY), maAppend);
+        vsapi->mapSetInt(out, "extradata_index", extradata_count - 1, maAppend);
+    }
+    av_packet_unref(&pkt);
+    vsapi->mapSetInt(out, "time_base", 1, maAppend);
+    vsapi->mapSetInt(out, "time_base", libavsmash_video_get_media_timescale(vdhp), maAppend);
+    free_handler(&hp);
+}
@@ -51,6 +51,8 @@ void set_error_on_init(VSMap* out, const VSAPI* vsapi, const char* format, ...)
 
 extern void VS_CC vs_libavsmashsource_create(const VSMap* in, VSMap* out, void* user_data, VSCore* core, const VSAPI* vsapi);
 extern void VS_CC vs_lwlibavsource_create(const VSMap* in, VSMap* out, void* user_data, VSCore* core, const VSAPI* vsapi);
+extern void VS_CC vs_lwlibavpackets_create(const VSMap* in, VSMap* out, void* user_data, VSCore* core, const VSAPI* vsapi);
+extern void VS_CC vs_libavsmashpackets_create(const VSMap* in, VSMap* out, void* user_data, VSCore* core, const VSAPI* vsapi);
 
 /*void VS_CC vs_version_create( const VSMap *in, VSMap *out, void *user_data, VSCore *core, const VSAPI *vsapi )
 {
@@ -74,7 +76,15 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit2(VSPlugin* plugin, const VSPLUGINAPI
         "clip:vnode;", vs_libavsmashsource_create, NULL, plugin);
     vspapi->registerFunction("LWLibavSource",
         "source:data;stream_index:int:opt;cache:int:opt;cachefile:data:opt;" COMMON_OPTS
-        "repeat:int:opt;dominance:int:opt;ff_loglevel:int:opt;cachedir:data:opt;ff_options:data:opt;rap_verification:int:opt;",
+        "repeat:int:opt;dominance:int:opt;ff_loglevel:int:opt;cachedir:data:opt;ff_options:data:opt;rap_verification:int:opt;"
+        "warm_decoder:int:opt;keyframes_only:int:opt;compress_cache:int:opt;cache_verify:int:opt;",
         "clip:vnode;", vs_lwlibavsource_create, NULL, plugin);
+    vspapi->registerFunction("LWLibavPackets",
+        "source:data;first:int;last:int;stream_index:int:opt;cache:int:opt;cachefile:data:opt;cachedir:data:opt;",
+        "packets:data[];pts:int[];dts:int[];key:int[];extradata_index:int[];extradata:data[];time_base:int[];", vs_lwlibavpackets_create,
+        NULL, plugin);
+    vspapi->registerFunction("LibavSMASHPackets", "source:data;first:int;last:int;track:int:opt;",
+        "packets:data[];pts:int[];dts:int[];key:int[];extradata_index:int[];extradata:data[];time_base:int[];",
+        vs_libavsmashpackets_create, NULL, plugin);
 #undef COMMON_OPTS
 }
@@ -88,6 +88,7 @@ typedef struct {
     lwlibav_audio_output_handler_t* aohp;
     char preferred_decoder_names_buf[PREFERRED_DECODER_NAMES_BUFSIZE];
     int prefer_hw;
+    int keyframes_only;
 } lwlibav_handler_t;
 
 /* Deallocate the handler of this plugin. */
@@ -210,7 +211,7 @@ static const VSFrame* VS_CC vs_filter_get_frame(
     vs_vohp->frame_ctx = frame_ctx;
     vs_vohp->core = core;
     vs_vohp->vsapi = vsapi;
-    if (lwlibav_video_get_frame(vdhp, vohp, frame_number) < 0) {
+    if ((hp->keyframes_only ? lwlibav_video_get_keyframe(vdhp, vohp, frame_number) : lwlibav_video_get_frame(vdhp, vohp, frame_number)) < 0) {
         vsapi->setFilterError("lsmas: failed to output a video frame.", frame_ctx);
         return NULL;
     }
@@ -309,6 +310,10 @@ void VS_CC vs_lwlibavsource_create(const VSMap* in, VSMap* out, void* user_data,
     int64_t field_dominance;
     int64_t ff_loglevel;
     int64_t rap_verification;
+    int64_t warm_decoder;
+    int64_t keyframes_only;
+    int64_t compress_index;
+    int64_t verify_policy;
     const char* index_file_path;
     const char* format;
     const char* preferred_decoder_names;
@@ -333,6 +338,15 @@ void VS_CC vs_lwlibavsource_create(const VSMap* in, VSMap* out, void* user_data,
     set_option_string(&cache_dir, NULL, "cachedir", in, vsapi);
     set_option_string(&ff_options, NULL, "ff_options", in, vsapi);
     set_option_int64(&rap_verification, 0, "rap_verification", in, vsapi);
+    set_option_int64(&warm_decoder, 0, "warm_decoder", in, vsapi);
+    set_option_int64(&keyframes_only, 0, "keyframes_only", in, vsapi);
+    set_option_int64(&compress_index, 0, "compress_cache", in, vsapi);
+    set_option_int64(&verify_policy, 0, "cache_verify", in, vsapi);
+    hp->keyframes_only = CLIP_VALUE(keyframes_only, 0, 1);
+    if (hp->keyframes_only) {
+        apply_repeat_flag = 0;
+        fps_num = 0;
+    }
     set_preferred_decoder_names_on_buf(hp->preferred_decoder_names_buf, preferred_decoder_names);
     /* Set options. */
     lwlibav_option_t opt;
@@ -352,12 +366,15 @@ void VS_CC vs_lwlibavsource_create(const VSMap* in, VSMap* out, void* user_data,
     opt.vfr2cfr.fps_num = fps_num;
     opt.vfr2cfr.fps_den = fps_den;
     opt.rap_verification = rap_verification;
+    opt.compress_index = CLIP_VALUE(compress_index, 0, 1);
+    opt.verify_policy = CLIP_VALUE(verify_policy, 0, 2);
     lwlibav_video_set_seek_mode(vdhp, CLIP_VALUE(seek_mode, 0, 2));
     lwlibav_video_set_forward_seek_threshold(vdhp, CLIP_VALUE(seek_threshold, 1, 999));
     lwlibav_video_set_preferred_decoder_names(vdhp, tokenize_preferred_decoder_names(hp->preferred_decoder_names_buf));
     set_prefer_hw(&hp->prefer_hw, CLIP_VALUE(prefer_hw_decoder, 0, 7));
     lwlibav_video_set_prefer_hw_decoder(vdhp, &hp->prefer_hw);
     lwlibav_video_set_decoder_options(vdhp, ff_options);
+    lwlibav_video_set_warm_decoder(vdhp, CLIP_VALUE(warm_decoder, 0, 1));
     vs_vohp->variable_info = CLIP_VALUE(variable_info, 0, 1);
     vs_vohp->direct_rendering = CLIP_VALUE(direct_rendering, 0, 1) && !format;
     vs_vohp->vs_output_pixel_format = vs_vohp->variable_info ? pfNone : get_vs_output_pixel_format(format);
@@ -419,6 +436,14 @@ void VS_CC vs_lwlibavsource_create(const VSMap* in, VSMap* out, void* user_data,
         free_handler(&hp);
         return;
     }
+    if (hp->keyframes_only) {
+        hp->vi.numFrames = lwlibav_video_get_keyframe_count(vdhp);
+        if (hp->vi.numFrames == 0) {
+            free_handler(&hp);
+            vsapi->mapSetError(out, "lsmas: no keyframe is found.");
+            return;
+        }
+    }
     AVFrame* av_frame = lwlibav_video_get_frame_buffer(vdhp);
     if (!av_frame->data[0] && hp->prefer_hw) {
         free_handler(&hp);
@@ -432,3 +457,121 @@ void VS_CC vs_lwlibavsource_create(const VSMap* in, VSMap* out, void* user_data,
         vsapi->mapConsumeNode(out, "clip", node, maAppend);
     }
 }
+
+void VS_CC vs_lwlibavpackets_create(const VSMap* in, VSMap* out, void* user_data, VSCore* core, const VSAPI* vsapi)
+{
+    const char* file_path = vsapi->mapGetData(in, "source", 0, NULL);
+    /* Allocate the handler of this function. */
+    lwlibav_handler_t* hp = alloc_handler();
+    if (!hp) {
+        vsapi->mapSetError(out, "lsmas: failed to allocate the LW-Libav handler.");
+        return;
+    }
+    lwlibav_file_handler_t* lwhp = &hp->lwh;
+    lwlibav_video_decode_handler_t* vdhp = hp->vdhp;
+    /* Set up VapourSynth error handler. */
+    vs_basic_handler_t vsbh = { 0 };
+    vsbh.out = out;
+    vsbh.frame_ctx = NULL;
+    vsbh.vsapi = vsapi;
+    /* Set up log handler. */
+    lw_log_handler_t lh = { 0 };
+    lh.level = LW_LOG_FATAL;
+    lh.priv = &vsbh;
+    lh.show_log = set_error;
+    /* Get options. */
+    int64_t first;
+    int64_t last;
+    int64_t stream_index;
+    int64_t cache_index;
+    const char* index_file_path;
+    const char* cache_dir;
+    set_option_int64(&first, 0, "first", in, vsapi);
+    set_option_int64(&last, 0, "last", in, vsapi);
+    set_option_int64(&stream_index, -1, "stream_index", in, vsapi);
+    set_option_int64(&cache_index, 1, "cache", in, vsapi);
+    set_option_string(&index_file_path, NULL, "cachefile", in, vsapi);
+    set_option_string(&cache_dir, NULL, "cachedir", in, vsapi);
+    /* Set options. */
+    lwlibav_option_t opt;
+    opt.file_path = file_path;
+    opt.cache_dir = cache_dir;
+    opt.threads = 1;
+    opt.av_sync = 0;
+    opt.no_create_index = !cache_index;
+    opt.index_file_path = index_file_path;
+    opt.force_video = (stream_index >= 0);
+    opt.force_video_index = stream_index >= 0 ? stream_index : -1;
+    opt.force_audio = 0;
+    opt.force_audio_index = -2;
+    opt.apply_repeat_flag = 0;
+    opt.field_dominance = 0;
+    opt.vfr2cfr.active = 0;
+    opt.vfr2cfr.fps_num = 0;
+    opt.vfr2cfr.fps_den = 0;
+    opt.rap_verification = 0;
+    opt.compress_index = 0;
+    opt.verify_policy = LWINDEX_VERIFY_MTIME;
+    av_log_set_level(AV_LOG_QUIET);
+    /* No progress indicator. */
+    progress_indicator_t indicator = { 0 };
+    /* Construct index. */
+    int ret = lwlibav_construct_index(lwhp, vdhp, hp->vohp, hp->adhp, hp->aohp, &lh, &opt, &indicator, NULL);
+    lwlibav_audio_free_decode_handler_ptr(&hp->adhp);
+    lwlibav_audio_free_output_handler_ptr(&hp->aohp);
+    if (ret < 0) {
+        free_handler(&hp);
+        set_error_on_init(out, vsapi, "lsmas: failed to construct index for %s.", opt.file_path);
+        return;
+    }
+    /* Get the desired video track. */
+    lwlibav_video_set_log_handler(vdhp, &lh);
+    if (lwlibav_video_get_desired_track_packets(lwhp->file_path, vdhp) < 0
+        || lwlibav_import_av_index_entry((lwlibav_decode_handler_t*)vdhp) < 0) {
+        free_handler(&hp);
+        vsapi->mapSetError(out, "lsmas: failed to get video track.");
+        return;
+    }
+    /* Read the packets required for the requested frames.
+     * Frame numbers given by the user are 0-origin. */
+    uint32_t first_sample_number;
+    uint32_t last_sample_number;
+    if (first < 0 || last < first
+        || lwlibav_video_get_packet_range(vdhp, (uint32_t)first + 1, (uint32_t)last + 1, &first_sample_number, &last_sample_number) < 0) {
+        free_handler(&hp);
+        vsapi->mapSetError(out, "lsmas: invalid frame range.");
+        return;
+    }
+    AVPacket pkt = { 0 };
+    int last_extradata_index = -1;
+    int extradata_count = 0;
+    for (uint32_t i = first_sample_number; i <= last_sample_number; i++) {
+        int extradata_index;
+        if (lwlibav_video_get_packet(vdhp, i, &pkt, &extradata_index) < 0) {
+            av_packet_unref(&pkt);
+            free_handler(&hp);
+            set_error_on_init(out, vsapi, "lsmas: failed to read the packet %u.", i - 1);
+            return;
+        }
+        if (extradata_index != last_extradata_index) {
+            /* Add the decoder configuration every time it changes. */
+            const lwlibav_extradata_t* entry = lwlibav_video_get_extradata(vdhp, extradata_index);
+            if (entry && entry->extradata_size > 0)
+                vsapi->mapSetData(out, "extradata", (const char*)entry->extradata, entry->extradata_size, dtBinary, maAppend);
+            else
+                vsapi->mapSetData(out, "extradata", "", 0, dtBinary, maAppend);
+            last_extradata_index = extradata_index;
+            ++extradata_count;
+        }
+        vsapi->mapSetData(out, "packets", (const char*)pkt.data, pkt.size, dtBinary, maAppend);
+        vsapi->mapSetInt(out, "pts", pkt.pts, maAppend);
+        vsapi->mapSetInt(out, "dts", pkt.dts, maAppend);
+        vsapi->mapSetInt(out, "key", !!(pkt.flags & AV_PKT_FLAG_KEY), maAppend);
+        vsapi->mapSetInt(out, "extradata_index", extradata_count - 1, maAppend);
+    }
+    av_packet_unref(&pkt);
+    AVRational time_base = lwlibav_video_get_time_base(vdhp);
+    vsapi->mapSetInt(out, "time_base", time_base.num, maAppend);
+    vsapi->mapSetInt(out, "time_base", time_base.den, maAppend);
+    free_handler(&hp);
+}
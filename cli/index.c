@@ -22,11 +22,16 @@
 /* This file is available under an ISC license.
  * However, when distributing its binary file, it will be under LGPL or GPL. */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <libavutil/rational.h>
+
 #include "lwindex.h"
+#include "lwindex_parser.h"
+#include "lwindex_utils.h"
 #include "lwlibav_audio.h"
 #include "lwlibav_dec.h"
 #include "lwlibav_video.h"
@@ -89,15 +94,162 @@ static void close_indicator(progress_handler_t* php)
     fprintf(stderr, "\n");
 }
 
+static void print_json_string(FILE* out, const char* str)
+{
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(out, "\\u%04x", *p);
+        else
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+static double get_duration_seconds(const stream_info_entry_t* stream_info, const lwindex_stream_summary_t* stream)
+{
+    if (stream->codec_type == AV_STREAM_TYPE_AUDIO && stream_info->data.type1.sample_rate > 0)
+        return (double)stream->sample_count / stream_info->data.type1.sample_rate;
+    if (stream_info->time_base.den <= 0)
+        return 0.0;
+    return (double)stream->duration * stream_info->time_base.num / stream_info->time_base.den;
+}
+
+/* Get the average packet rate over the duration of the stream.
+ * This is not the frame rate when a frame is coded in several packets or a packet holds no visible frame. */
+static AVRational get_packet_rate(const stream_info_entry_t* stream_info, const lwindex_stream_summary_t* stream)
+{
+    AVRational packet_rate = { 0, 1 };
+    if (stream->duration > 0 && stream_info->time_base.num > 0 && stream_info->time_base.den > 0)
+        av_reduce(&packet_rate.num, &packet_rate.den, (int64_t)stream->packet_count * stream_info->time_base.den,
+            stream->duration * stream_info->time_base.num, INT_MAX);
+    return packet_rate;
+}
+
+static void print_info_json(FILE* out, const char* index_path, const lwindex_info_t* info)
+{
+    const lwindex_data_t* data = info->data;
+    fprintf(out, "{\n  \"index_file\": ");
+    print_json_string(out, index_path);
+    fprintf(out, ",\n  \"input_file\": ");
+    print_json_string(out, data->input_file_path);
+    fprintf(out, ",\n  \"file_size\": %" PRIu64 ",\n  \"format\": ", data->file_size);
+    print_json_string(out, data->format_name);
+    fprintf(out, ",\n  \"active_video_stream\": %d,\n  \"active_audio_stream\": %d,\n  \"streams\": [", data->active_video_stream_index,
+        data->active_audio_stream_index);
+    for (int i = 0; i < data->num_streams; i++) {
+        const stream_info_entry_t* stream_info = &data->stream_info[i];
+        const lwindex_stream_summary_t* stream = &info->streams[i];
+        const int is_video = stream->codec_type == AV_STREAM_TYPE_VIDEO;
+        fprintf(out, "%s\n    {\n      \"index\": %d,\n      \"type\": \"%s\",\n      \"codec_id\": %" PRIu32 ",\n", i ? "," : "",
+            stream->stream_index, is_video ? "video" : "audio", stream_info->codec);
+        fprintf(out, "      \"time_base\": [%d, %d],\n      \"format\": ", stream_info->time_base.num, stream_info->time_base.den);
+        print_json_string(out, stream_info->format);
+        fprintf(out, ",\n      \"packets\": %" PRIu32 ",\n      \"duration\": %.6f,\n", stream->packet_count,
+            get_duration_seconds(stream_info, stream));
+        if (is_video) {
+            AVRational packet_rate = get_packet_rate(stream_info, stream);
+            fprintf(out, "      \"width\": %d,\n      \"height\": %d,\n      \"packet_rate\": [%d, %d],\n      \"keyframe_packets\": [",
+                stream_info->data.type0.width, stream_info->data.type0.height, packet_rate.num, packet_rate.den);
+            for (uint32_t j = 0; j < stream->num_keyframe_packets; j++)
+                fprintf(out, j ? ", %" PRIu32 : "%" PRIu32, stream->keyframe_packets[j]);
+            fprintf(out, "]\n    }");
+        } else
+            fprintf(out, "      \"channels\": %d,\n      \"sample_rate\": %d,\n      \"samples\": %" PRIu64 "\n    }",
+                stream_info->data.type1.channels, stream_info->data.type1.sample_rate, stream->sample_count);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static void print_info_text(FILE* out, const char* index_path, const lwindex_info_t* info)
+{
+    const lwindex_data_t* data = info->data;
+    fprintf(out, "Index file: %s\nInput file: %s\nFile size: %" PRIu64 "\nFormat: %s\n", index_path, data->input_file_path,
+        data->file_size, data->format_name);
+    for (int i = 0; i < data->num_streams; i++) {
+        const stream_info_entry_t* stream_info = &data->stream_info[i];
+        const lwindex_stream_summary_t* stream = &info->streams[i];
+        const double duration = get_duration_seconds(stream_info, stream);
+        if (stream->codec_type == AV_STREAM_TYPE_VIDEO) {
+            AVRational packet_rate = get_packet_rate(stream_info, stream);
+            fprintf(out, "Stream %d: video, %s, %dx%d, %" PRIu32 " packets, %d/%d packets/s, %.3f s, %" PRIu32 " keyframe packets%s\n",
+                stream->stream_index, stream_info->format, stream_info->data.type0.width, stream_info->data.type0.height,
+                stream->packet_count, packet_rate.num, packet_rate.den, duration, stream->num_keyframe_packets,
+                stream->stream_index == data->active_video_stream_index ? " (active)" : "");
+        } else
+            fprintf(out, "Stream %d: audio, %s, %d channels, %d Hz, %" PRIu64 " samples, %.3f s%s\n", stream->stream_index,
+                stream_info->format, stream_info->data.type1.channels, stream_info->data.type1.sample_rate, stream->sample_count, duration,
+                stream->stream_index == data->active_audio_stream_index ? " (active)" : "");
+    }
+}
+
+/* Print the metadata stored in an existing index without opening the source file. */
+static int print_index_info(const char* file_path, const char* index_file_path, bool json)
+{
+    char* index_path = NULL;
+    if (!index_file_path) {
+        size_t length = strlen(file_path);
+        if (length > 4 && !strcmp(file_path + length - 4, ".lwi"))
+            index_file_path = file_path;
+        else {
+            lwlibav_option_t opt = { 0 };
+            opt.file_path = file_path;
+            opt.cache_dir = "";
+            index_file_path = index_path = create_lwi_path(&opt, NULL);
+        }
+    }
+    FILE* index = index_file_path ? lw_fopen(index_file_path, "rb") : NULL;
+    if (!index) {
+        fprintf(stderr, "lsmas: failed to open index file %s.\n", index_file_path ? index_file_path : file_path);
+        lw_free(index_path);
+        return 1;
+    }
+    lwindex_info_t* info = lwindex_query_info(index);
+    fclose(index);
+    if (!info) {
+        fprintf(stderr, "lsmas: failed to read index file %s.\n", index_file_path);
+        lw_free(index_path);
+        return 1;
+    }
+    if (json)
+        print_info_json(stdout, index_file_path, info);
+    else
+        print_info_text(stdout, index_file_path, info);
+    lwindex_free_info(info);
+    lw_free(index_path);
+    return 0;
+}
+
 int main(const int argc, const char* argv[])
 {
-    bool has_index_path = false;
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s file.mkv [index.lwi]\n", argv[0]);
+    bool compress = false;
+    bool info = false;
+    bool json = false;
+    const char* paths[2] = { NULL, NULL };
+    int num_paths = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--compress"))
+            compress = true;
+        else if (!strcmp(argv[i], "--info"))
+            info = true;
+        else if (!strcmp(argv[i], "--json"))
+            json = true;
+        else if (num_paths < 2)
+            paths[num_paths++] = argv[i];
+        else
+            num_paths = 3;
+    }
+    if (num_paths < 1 || num_paths > 2 || (json && !info)) {
+        fprintf(stderr,
+            "Usage: %s [--compress] file.mkv [index.lwi]\n"
+            "       %s --info [--json] file.mkv|index.lwi [index.lwi]\n",
+            argv[0], argv[0]);
         return 1;
-    } else if (argc == 3) {
-        has_index_path = true;
     }
+    if (info)
+        return print_index_info(paths[0], paths[1], json);
 
     /* Allocate the handler of this filter function. */
     lwlibav_handler_t* hp = alloc_handler();
@@ -110,10 +262,12 @@ int main(const int argc, const char* argv[])
     lwlibav_video_output_handler_t* vohp = hp->vohp;
     /* Get options. */
     lwlibav_option_t opt;
-    opt.file_path = argv[1];
+    opt.file_path = paths[0];
     opt.cache_dir = "";
     opt.no_create_index = 0;
-    opt.index_file_path = has_index_path ? argv[2] : NULL;
+    opt.index_file_path = paths[1];
+    opt.compress_index = compress;
+    opt.verify_policy = LWINDEX_VERIFY_MTIME;
     opt.threads = 0;
     opt.force_video = 0;
     opt.force_video_index = -1;
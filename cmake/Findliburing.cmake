@@ -0,0 +1,51 @@
+# Findliburing.cmake - Finds the liburing library
+#
+# This module finds the liburing library and creates the imported target `liburing::liburing`.
+#
+# It first attempts to use pkg-config. If that fails, it falls back to manual
+# path searching, which respects CMAKE_PREFIX_PATH.
+
+include(FindPackageHandleStandardArgs)
+
+# Guard to prevent this from running multiple times
+if(TARGET liburing::liburing)
+    return()
+endif()
+
+# 1. Try to find via pkg-config
+find_package(PkgConfig QUIET)
+if(PKG_CONFIG_FOUND)
+    pkg_check_modules(PC_LIBURING QUIET liburing)
+endif()
+
+# 2. Find the header and library files
+find_path(liburing_INCLUDE_DIR
+    NAMES liburing.h
+    HINTS ${PC_LIBURING_INCLUDEDIR}
+    PATH_SUFFIXES include
+)
+
+find_library(liburing_LIBRARY
+    NAMES uring liburing
+    HINTS ${PC_LIBURING_LIBDIR}
+    PATH_SUFFIXES lib lib64
+)
+
+# 3. Use the standard tool to set liburing_FOUND and handle REQUIRED/QUIET
+find_package_handle_standard_args(liburing
+    FOUND_VAR liburing_FOUND
+    REQUIRED_VARS liburing_LIBRARY liburing_INCLUDE_DIR
+    VERSION_VAR PC_LIBURING_VERSION # Use version from pkg-config if available
+)
+
+# 4. If found, create the imported target
+if(liburing_FOUND AND NOT TARGET liburing::liburing)
+    add_library(liburing::liburing UNKNOWN IMPORTED)
+    set_target_properties(liburing::liburing PROPERTIES
+        IMPORTED_LOCATION "${liburing_LIBRARY}"
+        INTERFACE_INCLUDE_DIRECTORIES "${liburing_INCLUDE_DIR}"
+    )
+endif()
+
+# 5. Hide the internal variables from the user in the GUI
+mark_as_advanced(liburing_INCLUDE_DIR liburing_LIBRARY)
@@ -28,10 +28,165 @@
 #include "cpp_compat.h"
 #include "decode.h"
 #include "libavsmash.h"
+#include "osdep.h"
+
+/* Read-ahead of the L-SMASH file I/O
+ * Each miss fetches a whole window of the file with one contiguous read, so that the samples of the interleaved chunks
+ * that follow are served from memory. A few windows are kept so that tracks stored apart do not evict each other. */
+#define READAHEAD_WINDOW_COUNT 4
+#define READAHEAD_WINDOW_SIZE (1 << 22)
+#define READAHEAD_SCAN_WINDOW_SIZE (1 << 16) /* while the file structure is read */
+#define READAHEAD_ALIGNMENT 4096 /* Windows start at page boundaries of the file. */
+
+typedef struct {
+    uint8_t* data;
+    int64_t offset; /* file offset of data[0] */
+    int64_t size; /* valid bytes from offset */
+    uint64_t last_use;
+} readahead_window_t;
+
+typedef struct {
+    void* opaque;
+    int (*read)(void* opaque, uint8_t* buf, int size);
+    int64_t (*seek)(void* opaque, int64_t offset, int whence);
+    int64_t position;
+    int64_t window_size;
+    uint64_t clock;
+    readahead_window_t windows[READAHEAD_WINDOW_COUNT];
+} readahead_t;
 
 #define BYTE_SWAP_16(x) (((x) << 8 & 0xff00) | ((x) >> 8 & 0x00ff))
 #define BYTE_SWAP_32(x) (BYTE_SWAP_16(x) << 16 | BYTE_SWAP_16((x) >> 16))
 
+/* Read from the underlying file at offset until size bytes are read or the end of the file is reached. */
+static int64_t readahead_fill(readahead_t* ra, uint8_t* buf, int64_t offset, int64_t size)
+{
+    if (ra->seek(ra->opaque, offset, SEEK_SET) != offset)
+        return -1;
+    int64_t filled = 0;
+    while (filled < size) {
+        int ret = ra->read(ra->opaque, buf + filled, (int)MIN(size - filled, INT_MAX));
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            break;
+        filled += ret;
+    }
+    return filled;
+}
+
+static readahead_window_t* readahead_find_window(readahead_t* ra, int64_t position)
+{
+    for (int i = 0; i < READAHEAD_WINDOW_COUNT; i++) {
+        readahead_window_t* window = &ra->windows[i];
+        if (window->size > 0 && position >= window->offset && position < window->offset + window->size)
+            return window;
+    }
+    /* Refill the least recently used window. */
+    readahead_window_t* window = &ra->windows[0];
+    for (int i = 1; i < READAHEAD_WINDOW_COUNT; i++)
+        if (ra->windows[i].last_use < window->last_use)
+            window = &ra->windows[i];
+    window->offset = position - position % READAHEAD_ALIGNMENT;
+    window->size = readahead_fill(ra, window->data, window->offset, ra->window_size);
+    if (window->size <= position - window->offset) {
+        /* Error or the end of the file */
+        window->size = 0;
+        return NULL;
+    }
+    return window;
+}
+
+static int readahead_read(void* opaque, uint8_t* buf, int size)
+{
+    readahead_t* ra = (readahead_t*)opaque;
+    if (size >= READAHEAD_WINDOW_SIZE) {
+        /* Large reads gain nothing from the windows. */
+        int64_t ret = readahead_fill(ra, buf, ra->position, size);
+        if (ret > 0)
+            ra->position += ret;
+        return (int)ret;
+    }
+    int copied = 0;
+    while (copied < size) {
+        readahead_window_t* window = readahead_find_window(ra, ra->position);
+        if (!window)
+            break;
+        window->last_use = ++ra->clock;
+        int64_t available = window->offset + window->size - ra->position;
+        int length = (int)MIN(available, size - copied);
+        memcpy(buf + copied, window->data + (ra->position - window->offset), length);
+        copied += length;
+        ra->position += length;
+    }
+    return copied;
+}
+
+static int64_t readahead_seek(void* opaque, int64_t offset, int whence)
+{
+    readahead_t* ra = (readahead_t*)opaque;
+    if (whence == SEEK_SET)
+        ra->position = offset;
+    else if (whence == SEEK_CUR)
+        ra->position += offset;
+    else {
+        int64_t ret = ra->seek(ra->opaque, offset, whence);
+        if (ret < 0)
+            return ret;
+        ra->position = ret;
+    }
+    return ra->position;
+}
+
+/* Put the read-ahead between L-SMASH and the opened file. The file is left as is if it cannot be set up. */
+static void setup_readahead(lsmash_file_parameters_t* file_param)
+{
+    if (!file_param->read || !file_param->seek)
+        return;
+    readahead_t* ra = (readahead_t*)lw_malloc_zero(sizeof(readahead_t));
+    if (!ra)
+        return;
+    for (int i = 0; i < READAHEAD_WINDOW_COUNT; i++)
+        if (!(ra->windows[i].data = (uint8_t*)av_malloc(READAHEAD_WINDOW_SIZE))) {
+            for (int j = 0; j < i; j++)
+                av_free(ra->windows[j].data);
+            lw_free(ra);
+            return;
+        }
+    int64_t position = file_param->seek(file_param->opaque, 0, SEEK_CUR);
+    ra->opaque = file_param->opaque;
+    ra->read = file_param->read;
+    ra->seek = file_param->seek;
+    ra->position = position > 0 ? position : 0;
+    /* Reading the file structure visits every box header, e.g. every moof of a fragmented file, and skips their payloads.
+     * Filling small windows there keeps its cost independent of the size of the payloads skipped. */
+    ra->window_size = READAHEAD_SCAN_WINDOW_SIZE;
+    file_param->opaque = ra;
+    file_param->read = readahead_read;
+    file_param->seek = readahead_seek;
+}
+
+/* Switch to the full window size for reading samples. */
+static void start_readahead(lsmash_file_parameters_t* file_param)
+{
+    if (file_param->read == readahead_read)
+        ((readahead_t*)file_param->opaque)->window_size = READAHEAD_WINDOW_SIZE;
+}
+
+void libavsmash_close_file(lsmash_file_parameters_t* file_param)
+{
+    if (file_param->read == readahead_read) {
+        readahead_t* ra = (readahead_t*)file_param->opaque;
+        file_param->opaque = ra->opaque;
+        file_param->read = ra->read;
+        file_param->seek = ra->seek;
+        for (int i = 0; i < READAHEAD_WINDOW_COUNT; i++)
+            av_free(ra->windows[i].data);
+        lw_free(ra);
+    }
+    lsmash_close_file(file_param);
+}
+
 lsmash_root_t* libavsmash_open_file(AVFormatContext** p_format_ctx, const char* file_name, lsmash_file_parameters_t* file_param,
     lsmash_movie_parameters_t* movie_param, lw_log_handler_t* lhp)
 {
@@ -44,6 +199,7 @@ lsmash_root_t* libavsmash_open_file(AVFormatContext** p_format_ctx, const char*
         strcpy(error_string, "Failed to open an input file.\n");
         goto open_fail;
     }
+    setup_readahead(file_param);
     lsmash_file_t* fh = lsmash_set_file(root, file_param);
     if (!fh) {
         strcpy(error_string, "Failed to add an input file into a ROOT.\n");
@@ -53,6 +209,7 @@ lsmash_root_t* libavsmash_open_file(AVFormatContext** p_format_ctx, const char*
         strcpy(error_string, "Failed to read an input file\n");
         goto open_fail;
     }
+    start_readahead(file_param);
     lsmash_initialize_movie_parameters(movie_param);
     lsmash_get_movie_parameters(root, movie_param);
     if (movie_param->number_of_tracks == 0) {
@@ -93,12 +250,215 @@ lsmash_root_t* libavsmash_open_file(AVFormatContext** p_format_ctx, const char*
 open_fail:
     if (*p_format_ctx)
         avformat_close_input(p_format_ctx);
-    lsmash_close_file(file_param);
+    libavsmash_close_file(file_param);
     lsmash_destroy_root(root);
     lw_log_show(lhp, LW_LOG_FATAL, "%s", error_string);
     return NULL;
 }
 
+/* Roots shared by the sources opening the same file
+ * Every track of a shared root keeps its own decoder, but reads its samples through the same file,
+ * so that the users of the root take turns under its lock while reading samples and setting up their tracks.
+ * The timeline of a track is not guarded, so no two users of a root may use the same track. */
+typedef struct {
+    uint32_t type;
+    uint32_t track_number; /* 0 stands for the first track of the type */
+} shared_track_t;
+
+typedef struct shared_file_tag shared_file_t;
+
+struct shared_file_tag {
+    shared_file_t* next;
+    char* file_name;
+    lsmash_root_t* root;
+    lsmash_file_parameters_t file_param;
+    AVFormatContext* format_ctx;
+    int reference_count;
+    int preparing_count; /* users still reading the boxes */
+    int boxes_discarded;
+    shared_track_t* tracks; /* tracks requested by the users */
+    int track_count;
+    lw_mutex_t* lock;
+};
+
+static shared_file_t* shared_files = NULL; /* guarded by the global mutex */
+
+static shared_file_t* find_shared_file(lsmash_root_t* root)
+{
+    for (shared_file_t* shared = shared_files; shared; shared = shared->next)
+        if (shared->root == root)
+            return shared;
+    return NULL;
+}
+
+/* Check if a track requested by another user of a root may be the same one.
+ * Track numbers are only resolved once the track is set up, so the first track of a type may be any of the given ones. */
+static int is_shared_track_taken(const shared_file_t* shared, uint32_t type, uint32_t track_number)
+{
+    for (int i = 0; i < shared->track_count; i++) {
+        const shared_track_t* track = &shared->tracks[i];
+        if (track->type == type && (!track->track_number || !track_number || track->track_number == track_number))
+            return 1;
+    }
+    return 0;
+}
+
+static int add_shared_track(shared_file_t* shared, uint32_t type, uint32_t track_number)
+{
+    shared_track_t* tracks = (shared_track_t*)realloc(shared->tracks, (shared->track_count + 1) * sizeof(shared_track_t));
+    if (!tracks)
+        return -1;
+    tracks[shared->track_count].type = type;
+    tracks[shared->track_count].track_number = track_number;
+    shared->tracks = tracks;
+    ++shared->track_count;
+    return 0;
+}
+
+/* The log handler of a host may not return from a fatal error.
+ * Fatal messages while opening a shared file are held back until nothing is left to be freed. */
+typedef struct {
+    lw_log_handler_t lh;
+    lw_log_handler_t* host;
+    char message[1024];
+} held_log_handler_t;
+
+static void hold_fatal_log(lw_log_handler_t* lhp, lw_log_level level, const char* message)
+{
+    held_log_handler_t* held = (held_log_handler_t*)lhp;
+    if (level < LW_LOG_FATAL)
+        held->host->show_log(held->host, level, message);
+    else if (held->message[0] == '\0') {
+        strncpy(held->message, message, sizeof(held->message) - 1);
+        held->message[sizeof(held->message) - 1] = '\0';
+    }
+}
+
+lsmash_root_t* libavsmash_open_shared_file(AVFormatContext** p_format_ctx, const char* file_name, uint32_t type, uint32_t track_number,
+    lsmash_movie_parameters_t* movie_param, lw_log_handler_t* lhp)
+{
+    lw_lock_global_mutex();
+    shared_file_t* shared = shared_files;
+    /* A root whose boxes are gone cannot set up another track. */
+    while (shared && (shared->boxes_discarded || strcmp(shared->file_name, file_name) || is_shared_track_taken(shared, type, track_number)))
+        shared = shared->next;
+    if (shared && add_shared_track(shared, type, track_number) == 0) {
+        ++shared->reference_count;
+        ++shared->preparing_count;
+        lsmash_initialize_movie_parameters(movie_param);
+        lsmash_get_movie_parameters(shared->root, movie_param);
+        *p_format_ctx = shared->format_ctx;
+        lw_unlock_global_mutex();
+        return shared->root;
+    }
+    lw_unlock_global_mutex();
+    shared = (shared_file_t*)lw_malloc_zero(sizeof(shared_file_t));
+    if (!shared || !(shared->file_name = (char*)lw_malloc_zero(strlen(file_name) + 1)) || !(shared->lock = lw_create_mutex())) {
+        if (shared)
+            lw_free(shared->file_name);
+        lw_free(shared);
+        lw_log_show(lhp, LW_LOG_FATAL, "Failed to allocate a shared file.\n");
+        return NULL;
+    }
+    strcpy(shared->file_name, file_name);
+    shared->reference_count = 1;
+    shared->preparing_count = 1;
+    held_log_handler_t held = { { 0 } };
+    if (lhp) {
+        held.lh = *lhp;
+        held.lh.show_log = lhp->show_log ? hold_fatal_log : NULL;
+        held.host = lhp;
+    }
+    shared->root = libavsmash_open_file(&shared->format_ctx, file_name, &shared->file_param, movie_param, lhp ? &held.lh : NULL);
+    if (!shared->root || held.message[0] != '\0' || add_shared_track(shared, type, track_number) < 0) {
+        int opened = !!shared->root;
+        if (opened) {
+            avformat_close_input(&shared->format_ctx);
+            libavsmash_close_file(&shared->file_param);
+            lsmash_destroy_root(shared->root);
+        }
+        lw_destroy_mutex(shared->lock);
+        lw_free(shared->tracks);
+        lw_free(shared->file_name);
+        lw_free(shared);
+        if (held.message[0] != '\0')
+            lhp->show_log(lhp, LW_LOG_FATAL, held.message);
+        else if (opened)
+            lw_log_show(lhp, LW_LOG_FATAL, "Failed to allocate a shared file.\n");
+        return NULL;
+    }
+    lw_lock_global_mutex();
+    shared->next = shared_files;
+    shared_files = shared;
+    lw_unlock_global_mutex();
+    *p_format_ctx = shared->format_ctx;
+    return shared->root;
+}
+
+void libavsmash_close_shared_file(lsmash_root_t* root)
+{
+    lw_lock_global_mutex();
+    shared_file_t** p = &shared_files;
+    while (*p && (*p)->root != root)
+        p = &(*p)->next;
+    shared_file_t* shared = *p;
+    if (!shared || --shared->reference_count > 0) {
+        lw_unlock_global_mutex();
+        return;
+    }
+    *p = shared->next;
+    lw_unlock_global_mutex();
+    avformat_close_input(&shared->format_ctx);
+    libavsmash_close_file(&shared->file_param);
+    lsmash_destroy_root(shared->root);
+    lw_destroy_mutex(shared->lock);
+    lw_free(shared->tracks);
+    lw_free(shared->file_name);
+    lw_free(shared);
+}
+
+void libavsmash_release_shared_boxes(lsmash_root_t* root)
+{
+    lw_lock_global_mutex();
+    shared_file_t* shared = find_shared_file(root);
+    if (shared && shared->preparing_count > 0)
+        --shared->preparing_count;
+    lw_unlock_global_mutex();
+}
+
+/* Return the shared file locked, or NULL if the root is not shared. */
+static shared_file_t* lock_shared_file(lsmash_root_t* root)
+{
+    lw_lock_global_mutex();
+    shared_file_t* shared = find_shared_file(root);
+    /* Sources for the same file are usually set up one after another before any of them decodes.
+     * So the boxes are kept until the first decoding, when no user is still setting up its track. */
+    int discard = shared && !shared->boxes_discarded && shared->preparing_count == 0;
+    if (discard)
+        shared->boxes_discarded = 1;
+    lw_unlock_global_mutex();
+    if (!shared)
+        return NULL;
+    lw_lock_mutex(shared->lock);
+    if (discard)
+        lsmash_discard_boxes(root);
+    return shared;
+}
+
+void libavsmash_lock_shared_file(lsmash_root_t* root)
+{
+    (void)lock_shared_file(root);
+}
+
+void libavsmash_unlock_shared_file(lsmash_root_t* root)
+{
+    lw_lock_global_mutex();
+    shared_file_t* shared = find_shared_file(root);
+    lw_unlock_global_mutex();
+    if (shared)
+        lw_unlock_mutex(shared->lock);
+}
+
 uint32_t libavsmash_get_track_by_media_type(lsmash_root_t* root, uint32_t type, uint32_t track_number, lw_log_handler_t* lhp)
 {
     char error_string[128] = { 0 };
@@ -471,7 +831,7 @@ static int queue_extradata(codec_configuration_t* config, uint8_t* extradata, in
     return 0;
 }
 
-static int prepare_new_decoder_configuration(codec_configuration_t* config, uint32_t new_index)
+static int prepare_new_decoder_configuration(codec_configuration_t* config, uint32_t new_index, const AVPacket* pkt)
 {
     if (new_index == 0)
         new_index = 1;
@@ -540,8 +900,8 @@ static int prepare_new_decoder_configuration(codec_configuration_t* config, uint
                     goto fail;
                 uint8_t* dummy_out;
                 int dummy_out_size;
-                av_parser_parse2(parser, config->ctx, &dummy_out, &dummy_out_size, config->queue.packet.data, config->queue.packet.size,
-                    AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
+                av_parser_parse2(
+                    parser, config->ctx, &dummy_out, &dummy_out_size, pkt->data, pkt->size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
                 av_parser_close(parser);
                 config->queue.codec_id = config->ctx->codec_id;
             } else {
@@ -597,14 +957,83 @@ fail:
     return -1;
 }
 
+int libavsmash_get_extradata(codec_configuration_t* config, uint32_t index, uint8_t** extradata, int* extradata_size)
+{
+    /* Borrow the queue of the decoder configuration and put it back as it was. */
+    codec_configuration_t saved = *config;
+    AVPacket dummy = { 0 };
+    config->queue.extradata = NULL;
+    config->queue.extradata_size = 0;
+    int ret = prepare_new_decoder_configuration(config, index, &dummy);
+    *extradata = config->queue.extradata;
+    *extradata_size = config->queue.extradata_size;
+    config->queue = saved.queue;
+    config->error = saved.error;
+    if (ret < 0)
+        av_freep(extradata);
+    return ret;
+}
+
+static void free_sample_buffer(void* opaque, uint8_t* data)
+{
+    lsmash_delete_sample((lsmash_sample_t*)opaque);
+}
+
+/* Let the packet own the sample so that its payload reaches the decoder without being copied.
+ * The sample data is only grown by the padding required by libavcodec, which rarely moves a large buffer. */
+static int wrap_sample(lsmash_sample_t* sample, AVPacket* pkt)
+{
+    uint32_t length = sample->length;
+    if (lsmash_sample_alloc(sample, length + AV_INPUT_BUFFER_PADDING_SIZE) < 0)
+        return -1;
+    /* Set 0 to the additional AV_INPUT_BUFFER_PADDING_SIZE bytes.
+     * Without this, some decoders could cause wrong results. */
+    memset(sample->data + length, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    pkt->buf = av_buffer_create(sample->data, length + AV_INPUT_BUFFER_PADDING_SIZE, free_sample_buffer, sample, 0);
+    if (!pkt->buf)
+        return -1;
+    pkt->data = sample->data;
+    pkt->size = length;
+    return 0;
+}
+
+int libavsmash_read_sample(lsmash_root_t* root, uint32_t track_ID, uint32_t sample_number, AVPacket* pkt, uint32_t* sample_index)
+{
+    av_packet_unref(pkt);
+    /* The sources sharing the root read through the same file. */
+    shared_file_t* shared = lock_shared_file(root);
+    lsmash_sample_t* sample = lsmash_get_sample_from_media_timeline(root, track_ID, sample_number);
+    if (shared)
+        lw_unlock_mutex(shared->lock);
+    if (!sample) {
+        /* Reached the end of this media timeline. */
+        pkt->data = NULL;
+        pkt->size = 0;
+        return 1;
+    }
+    *sample_index = sample->index;
+    pkt->flags = sample->prop.ra_flags; /* Set proper flags when feeding this packet into the decoder. */
+    pkt->pts = sample->cts; /* Set composition timestamp to presentation timestamp field. */
+    pkt->dts = sample->dts;
+    /* From here on, the sample is released together with the packet. */
+    if (wrap_sample(sample, pkt) < 0) {
+        lsmash_delete_sample(sample);
+        pkt->data = NULL;
+        pkt->size = 0;
+        return -1;
+    }
+    return 0;
+}
+
 int get_sample(lsmash_root_t* root, uint32_t track_ID, uint32_t sample_number, codec_configuration_t* config, AVPacket* pkt)
 {
     if (!config->update_pending && config->dequeue_packet) {
         /* Dequeue the queued packet after the corresponding decoder configuration is activated. */
         config->dequeue_packet = 0;
         if (sample_number == config->queue.sample_number) {
-            *pkt = config->queue.packet;
-            return 0;
+            /* The queued packet is kept since it may be dequeued again once the decoder configuration is set up. */
+            av_packet_unref(pkt);
+            return av_packet_ref(pkt, &config->queue.packet) < 0 ? -1 : 0;
         }
     }
     av_packet_unref(pkt);
@@ -618,52 +1047,57 @@ int get_sample(lsmash_root_t* root, uint32_t track_ID, uint32_t sample_number, c
         }
         return 0;
     }
-    lsmash_sample_t* sample = lsmash_get_sample_from_media_timeline(root, track_ID, sample_number);
-    if (!sample) {
-        /* Reached the end of this media timeline. */
-        pkt->data = NULL;
-        pkt->size = 0;
-        return 1;
-    }
-    pkt->flags = sample->prop.ra_flags; /* Set proper flags when feeding this packet into the decoder. */
-    pkt->size = sample->length;
-    pkt->data = config->input_buffer;
-    pkt->pts = sample->cts; /* Set composition timestamp to presentation timestamp field. */
-    pkt->dts = sample->dts;
-    /* Copy sample data from L-SMASH.
-     * Set 0 to the end of the additional AV_INPUT_BUFFER_PADDING_SIZE bytes.
-     * Without this, some decoders could cause wrong results. */
-    memcpy(pkt->data, sample->data, sample->length);
-    memset(pkt->data + sample->length, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    uint32_t sample_index;
+    int ret = libavsmash_read_sample(root, track_ID, sample_number, pkt, &sample_index);
+    if (ret)
+        return ret;
     /* TODO: add handling invalid indexes. */
-    if (sample->index != config->index) {
-        if (prepare_new_decoder_configuration(config, sample->index)) {
-            lsmash_delete_sample(sample);
+    if (sample_index != config->index) {
+        if (prepare_new_decoder_configuration(config, sample_index, pkt))
             return -1;
-        }
         /* Queue the current packet and, instead of this, return NULL packet.
          * The current packet will be dequeued and returned after the corresponding decoder configuration is activated. */
+        av_packet_unref(&config->queue.packet);
         config->queue.sample_number = sample_number;
         config->queue.packet = *pkt;
+        pkt->buf = NULL;
         pkt->data = NULL;
         pkt->size = 0;
         if (config->queue.delay_count == 0) {
             /* This NULL packet must not be sent to the decoder. */
             config->update_pending = 1;
             config->dequeue_packet = 1;
-            lsmash_delete_sample(sample);
             return 2;
         } else
             config->dequeue_packet = 0;
     }
-    lsmash_delete_sample(sample);
+    return 0;
+}
+
+/* Native decoders known to get back to a clean state by avcodec_flush_buffers() alone, which saves reopening them on every seek.
+ * Reopening takes a few milliseconds at most, which is small next to decoding from the random accessible point, so the gain is modest.
+ * HEVC is not listed since its frame-threaded decoder took longer to output the first frame after a flush than after a reopen.
+ * Wrappers of external libraries and hardware decoders such as cuvid and qsv decode the same codecs but are still reopened. */
+static const enum AVCodecID flushable_codec_ids[] = {
+    AV_CODEC_ID_H264,
+    AV_CODEC_ID_PRORES,
+    AV_CODEC_ID_NONE,
+};
+
+static int is_flushable_decoder(const AVCodecContext* ctx)
+{
+    if (!ctx->codec || ctx->codec->wrapper_name)
+        return 0;
+    for (int i = 0; flushable_codec_ids[i] != AV_CODEC_ID_NONE; i++)
+        if (ctx->codec_id == flushable_codec_ids[i])
+            return 1;
     return 0;
 }
 
 /* Close and open the new decoder to flush buffers in the decoder even if the decoder implements avcodec_flush_buffers().
  * It seems this brings about more stable composition when seeking.
  * Note that this function could reallocate AVCodecContext. */
-void libavsmash_flush_buffers(codec_configuration_t* config)
+static void reopen_decoder(codec_configuration_t* config)
 {
     AVCodecContext* ctx = NULL;
     const AVCodec* codec = config->ctx->codec;
@@ -686,12 +1120,25 @@ void libavsmash_flush_buffers(codec_configuration_t* config)
         config->ctx->opaque = app_specific;
     }
     avcodec_parameters_free(&codecpar);
+}
+
+static void flush_buffers(codec_configuration_t* config, int reopen)
+{
+    if (reopen)
+        reopen_decoder(config);
+    else
+        avcodec_flush_buffers(config->ctx);
     config->update_pending = 0;
     config->delay_count = 0;
     config->queue.delay_count = 0;
     config->queue.index = config->index;
 }
 
+void libavsmash_flush_buffers(codec_configuration_t* config)
+{
+    flush_buffers(config, !is_flushable_decoder(config->ctx));
+}
+
 void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configuration_t* config)
 {
     uint32_t new_index = config->queue.index ? config->queue.index : 1;
@@ -788,8 +1235,8 @@ void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configur
         extended->height = ctx->height;
         /* Actual decoding */
         uint32_t i = current_sample_number;
+        AVPacket pkt = { 0 };
         do {
-            AVPacket pkt = { 0 };
             int ret = get_sample(root, track_ID, i++, config, &pkt);
             if (ret > 0 || config->index != config->queue.index)
                 break;
@@ -798,16 +1245,18 @@ void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configur
                     strcpy(error_string, "Failed to set up pixel format.\n");
                 else
                     strcpy(error_string, "Failed to set up resolution.\n");
+                av_packet_unref(&pkt);
                 av_frame_free(&picture);
                 goto fail;
             }
             int dummy;
             decode_video_packet(ctx, picture, &dummy, &pkt);
         } while (ctx->width == 0 || ctx->height == 0 || ctx->pix_fmt == AV_PIX_FMT_NONE);
+        av_packet_unref(&pkt);
     } else {
         uint32_t i = current_sample_number;
+        AVPacket pkt = { 0 };
         do {
-            AVPacket pkt = { 0 };
             int ret = get_sample(root, track_ID, i++, config, &pkt);
             if (ret > 0 || config->index != config->queue.index)
                 break;
@@ -818,6 +1267,7 @@ void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configur
                     strcpy(error_string, "Failed to set up channels.\n");
                 else
                     strcpy(error_string, "Failed to set up sample format.\n");
+                av_packet_unref(&pkt);
                 av_frame_free(&picture);
                 goto fail;
             }
@@ -825,6 +1275,7 @@ void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configur
             decode_audio_packet(ctx, picture, &dummy, &pkt);
         } while (ctx->sample_rate == 0 || (ctx->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC && ctx->ch_layout.nb_channels == 0)
             || ctx->sample_fmt == AV_SAMPLE_FMT_NONE);
+        av_packet_unref(&pkt);
         if (ctx->ch_layout.u.mask)
             extended->channel_layout = ctx->ch_layout.u.mask;
         else {
@@ -837,9 +1288,9 @@ void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configur
         extended->frame_length = ctx->frame_size;
     }
     av_frame_free(&picture);
-    /* Reopen/flush with the requested number of threads. */
+    /* Reopen with the requested number of threads. */
     ctx->thread_count = thread_count;
-    libavsmash_flush_buffers(config); /* Note that config->ctx could change here. */
+    flush_buffers(config, 1); /* Note that config->ctx could change here. */
     ctx = config->ctx;
     if (current_sample_number == config->queue.sample_number)
         config->dequeue_packet = 1;
@@ -862,18 +1313,15 @@ fail:
 
 int initialize_decoder_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configuration_t* config)
 {
-    /* Note: the input buffer for libavcodec's decoders must be AV_INPUT_BUFFER_PADDING_SIZE larger than the actual read bytes. */
-    uint32_t input_buffer_size = lsmash_get_max_sample_size_in_media_timeline(root, track_ID);
-    if (input_buffer_size == 0)
-        return -1;
-    config->input_buffer = (uint8_t*)av_mallocz(input_buffer_size + AV_INPUT_BUFFER_PADDING_SIZE);
-    if (!config->input_buffer)
+    /* There is nothing to decode if every sample is empty. */
+    if (lsmash_get_max_sample_size_in_media_timeline(root, track_ID) == 0)
         return -1;
     config->get_buffer = avcodec_default_get_buffer2;
     /* Initialize decoder configuration at the first valid sample. */
     AVPacket dummy = { 0 };
     for (uint32_t i = 1; get_sample(root, track_ID, i, config, &dummy) < 0; i++)
         ;
+    av_packet_unref(&dummy);
     update_configuration(root, track_ID, config);
     /* Decide preferred settings. */
     config->prefer.width = config->ctx->width;
@@ -907,6 +1355,7 @@ int initialize_decoder_configuration(lsmash_root_t* root, uint32_t track_ID, cod
         if (sample.index <= config->count && !index_list[sample.index - 1]) {
             for (uint32_t j = i; get_sample(root, track_ID, j, config, &dummy) < 0; j++)
                 ;
+            av_packet_unref(&dummy);
             update_configuration(root, track_ID, config);
             index_list[sample.index - 1] = 1;
             if (config->ctx->width > config->prefer.width)
@@ -960,6 +1409,7 @@ int initialize_decoder_configuration(lsmash_root_t* root, uint32_t track_ID, cod
     /* Reinitialize decoder configuration at the first valid sample. */
     for (uint32_t i = 1; get_sample(root, track_ID, i, config, &dummy) < 0; i++)
         ;
+    av_packet_unref(&dummy);
     update_configuration(root, track_ID, config);
     return config->error ? -1 : 0;
 }
@@ -972,7 +1422,7 @@ void cleanup_configuration(codec_configuration_t* config)
         free(config->entries);
     }
     av_freep(&config->queue.extradata);
-    av_freep(&config->input_buffer);
+    av_packet_unref(&config->queue.packet);
     av_buffer_unref(&config->hw_device_ctx);
     avcodec_free_context(&config->ctx);
 }
@@ -58,7 +58,6 @@ typedef struct {
     uint32_t count;
     uint32_t index; /* index of the current decoder configuration */
     uint32_t delay_count;
-    uint8_t* input_buffer;
     AVCodecContext* ctx;
     const char** preferred_decoder_names;
     int* prefer_hw_decoder;
@@ -92,6 +91,24 @@ extern "C" {
 lsmash_root_t* libavsmash_open_file(AVFormatContext** p_format_ctx, const char* file_name, lsmash_file_parameters_t* file_param,
     lsmash_movie_parameters_t* movie_param, lw_log_handler_t* lhp);
 
+void libavsmash_close_file(lsmash_file_parameters_t* file_param);
+
+/* Open a file as a root shared by every source opening the same file name for a different track.
+ * type and track_number are those later given to libavsmash_get_track_by_media_type().
+ * The returned root and *p_format_ctx are owned by the shared root, which is closed when the last user calls
+ * libavsmash_close_shared_file(). Each user holds libavsmash_lock_shared_file() while it sets up its track,
+ * and calls libavsmash_release_shared_boxes() once the track is set up. get_sample() takes the lock by itself. */
+lsmash_root_t* libavsmash_open_shared_file(AVFormatContext** p_format_ctx, const char* file_name, uint32_t type, uint32_t track_number,
+    lsmash_movie_parameters_t* movie_param, lw_log_handler_t* lhp);
+
+void libavsmash_close_shared_file(lsmash_root_t* root);
+
+void libavsmash_release_shared_boxes(lsmash_root_t* root);
+
+void libavsmash_lock_shared_file(lsmash_root_t* root);
+
+void libavsmash_unlock_shared_file(lsmash_root_t* root);
+
 uint32_t libavsmash_get_track_by_media_type(lsmash_root_t* root, uint32_t type, uint32_t track_number, lw_log_handler_t* lhp);
 
 int get_summaries(lsmash_root_t* root, uint32_t track_ID, codec_configuration_t* config);
@@ -102,6 +119,16 @@ int initialize_decoder_configuration(lsmash_root_t* root, uint32_t track_ID, cod
 
 int get_sample(lsmash_root_t* root, uint32_t track_ID, uint32_t sample_number, codec_configuration_t* config, AVPacket* pkt);
 
+/* Read the sample as is, regardless of the decoder configuration, into pkt.
+ * The flags of pkt are the random access flags of the sample, and *sample_index is its sample description index.
+ * Return 0 if successful, 1 at the end of the media timeline and -1 on failure. */
+int libavsmash_read_sample(lsmash_root_t* root, uint32_t track_ID, uint32_t sample_number, AVPacket* pkt, uint32_t* sample_index);
+
+/* Get the extradata of the video decoder configuration of the given sample description index without activating it.
+ * *extradata is allocated by av_malloc() and NULL if the configuration has none.
+ * Return 0 if successful. Otherwise, return -1. */
+int libavsmash_get_extradata(codec_configuration_t* config, uint32_t index, uint8_t** extradata, int* extradata_size);
+
 void update_configuration(lsmash_root_t* root, uint32_t track_ID, codec_configuration_t* config);
 
 void libavsmash_flush_buffers(codec_configuration_t* config);
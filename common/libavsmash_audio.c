@@ -49,6 +49,7 @@ void libavsmash_audio_free_decode_handler(libavsmash_audio_decode_handler_t* adh
 {
     if (!adhp)
         return;
+    av_packet_unref(&adhp->packet);
     av_frame_free(&adhp->frame_buffer);
     cleanup_configuration(&adhp->config);
     lw_free(adhp);
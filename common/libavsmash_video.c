@@ -341,6 +341,38 @@ void libavsmash_video_close_codec_context(libavsmash_video_decode_handler_t* vdh
     avcodec_free_context(&vdhp->config.ctx);
 }
 
+/* Sort the timestamps into composition order and replace their DTSs with the decoding sample numbers.
+ * Samples are reordered only over short distances in decoding order, so sorting by insertion takes linear time,
+ * unlike finding the composition delay and sorting by L-SMASH, which copies and fully sorts the list twice.
+ * Insertion gives way to the full sort if the reordering turns out to be far from local.
+ * Return 1 if any sample is reordered, 0 otherwise. */
+static int sort_timestamps_composition_order(lsmash_media_ts_list_t* ts_list)
+{
+    lsmash_media_ts_t* timestamp = ts_list->timestamp;
+    const uint64_t max_moves = (uint64_t)ts_list->sample_count * 64;
+    uint64_t moves = 0;
+    int reordered = 0;
+    for (uint32_t i = 0; i < ts_list->sample_count; i++) {
+        lsmash_media_ts_t current = timestamp[i];
+        current.dts = i + 1;
+        uint32_t j = i;
+        for (; j > 0 && timestamp[j - 1].cts > current.cts; j--)
+            timestamp[j] = timestamp[j - 1];
+        timestamp[j] = current;
+        if (j == i)
+            continue;
+        reordered = 1;
+        moves += i - j;
+        if (moves > max_moves) {
+            for (uint32_t k = i + 1; k < ts_list->sample_count; k++)
+                timestamp[k].dts = k + 1;
+            lsmash_sort_timestamps_composition_order(ts_list);
+            break;
+        }
+    }
+    return reordered;
+}
+
 int libavsmash_video_setup_timestamp_info(
     libavsmash_video_decode_handler_t* vdhp, libavsmash_video_output_handler_t* vohp, int64_t* framerate_num, int64_t* framerate_den)
 {
@@ -367,13 +399,7 @@ int libavsmash_video_setup_timestamp_info(
         lw_log_show(lhp, LW_LOG_ERROR, "Failed to count number of video samples.");
         goto setup_finish;
     }
-    uint32_t composition_sample_delay;
-    if (lsmash_get_max_sample_delay(&ts_list, &composition_sample_delay) < 0) {
-        lsmash_delete_media_timestamps(&ts_list);
-        lw_log_show(lhp, LW_LOG_ERROR, "Failed to get composition delay.");
-        goto setup_finish;
-    }
-    if (composition_sample_delay) {
+    if (sort_timestamps_composition_order(&ts_list)) {
         /* Consider composition order for keyframe detection.
          * Note: sample number for L-SMASH is 1-origin. */
         vdhp->order_converter = (order_converter_t*)lw_malloc_zero((ts_list.sample_count + 1) * sizeof(order_converter_t));
@@ -382,9 +408,6 @@ int libavsmash_video_setup_timestamp_info(
             lw_log_show(lhp, LW_LOG_ERROR, "Failed to allocate memory.");
             goto setup_finish;
         }
-        for (uint32_t i = 0; i < ts_list.sample_count; i++)
-            ts_list.timestamp[i].dts = i + 1;
-        lsmash_sort_timestamps_composition_order(&ts_list);
         for (uint32_t i = 0; i < ts_list.sample_count; i++)
             vdhp->order_converter[i + 1].composition_to_decoding = (uint32_t)ts_list.timestamp[i].dts;
     }
@@ -730,8 +753,23 @@ video_fail:
 #undef MAX_ERROR_COUNT
 }
 
+static int get_composition_time(void* opaque, uint32_t composition_sample_number, double* time)
+{
+    libavsmash_video_decode_handler_t* vdhp = (libavsmash_video_decode_handler_t*)opaque;
+    uint32_t decoding_sample_number = get_decoding_sample_number(vdhp->order_converter, composition_sample_number);
+    uint64_t cts;
+    if (lsmash_get_cts_from_media_timeline(vdhp->root, vdhp->track_id, decoding_sample_number, &cts) < 0)
+        return -1;
+    *time = (double)(cts - vdhp->min_cts) / vdhp->media_timescale;
+    return 0;
+}
+
 static uint32_t libavsmash_vfr2cfr(libavsmash_video_decode_handler_t* vdhp, libavsmash_video_output_handler_t* vohp, uint32_t sample_number)
 {
+    if (!vohp->cfr_map && !vohp->cfr_map_unavailable)
+        lw_setup_cfr_map(vohp, vdhp->sample_count, get_composition_time, vdhp);
+    if (vohp->cfr_map && sample_number <= vohp->frame_count)
+        return vohp->cfr_map[sample_number];
     /* Convert VFR to CFR. */
     double target_pts = (double)((uint64_t)(sample_number - 1) * vohp->cfr_den) / vohp->cfr_num;
     double current_pts = DBL_MAX;
@@ -842,6 +880,48 @@ int libavsmash_video_find_first_valid_frame(libavsmash_video_decode_handler_t* v
     return 0;
 }
 
+/* Get the range of samples in decoding order required to decode the given frames in composition order.
+ * The range starts at the random accessible sample, so some samples in the range might be presented outside the given frames.
+ * Note that the frame numbers here are not affected by the VFR to CFR conversion.
+ * Return 0 if successful. Otherwise, return -1. */
+int libavsmash_video_get_packet_range(libavsmash_video_decode_handler_t* vdhp, uint32_t first_frame_number, uint32_t last_frame_number,
+    uint32_t* first_sample_number, uint32_t* last_sample_number)
+{
+    if (first_frame_number == 0 || first_frame_number > last_frame_number || last_frame_number > vdhp->sample_count)
+        return -1;
+    uint32_t rap_number = 0;
+    find_random_accessible_point(vdhp, first_frame_number, 0, &rap_number);
+    if (rap_number == 0)
+        return -1;
+    uint32_t last = rap_number;
+    for (uint32_t i = first_frame_number; i <= last_frame_number; i++)
+        last = MAX(last, get_decoding_sample_number(vdhp->order_converter, i));
+    *first_sample_number = rap_number;
+    *last_sample_number = last;
+    return 0;
+}
+
+/* Read the sample of the given number in decoding order without decoding.
+ * The timestamps of the packet are in the media timescale, and *sample_description_index tells its decoder configuration.
+ * This does not disturb decoding since samples are read at random by L-SMASH.
+ * Return 0 if successful. Otherwise, return -1. */
+int libavsmash_video_get_packet(
+    libavsmash_video_decode_handler_t* vdhp, uint32_t sample_number, AVPacket* pkt, uint32_t* sample_description_index)
+{
+    if (sample_number == 0 || sample_number > vdhp->sample_count
+        || libavsmash_read_sample(vdhp->root, vdhp->track_id, sample_number, pkt, sample_description_index))
+        return -1;
+    pkt->flags = pkt->flags != ISOM_SAMPLE_RANDOM_ACCESS_FLAG_NONE ? AV_PKT_FLAG_KEY : 0;
+    return 0;
+}
+
+/* Return 0 if successful. Otherwise, return -1. */
+int libavsmash_video_get_extradata(
+    libavsmash_video_decode_handler_t* vdhp, uint32_t sample_description_index, uint8_t** extradata, int* extradata_size)
+{
+    return libavsmash_get_extradata(&vdhp->config, sample_description_index, extradata, extradata_size);
+}
+
 int libavsmash_video_create_keyframe_list(libavsmash_video_decode_handler_t* vdhp)
 {
     vdhp->keyframe_list = (uint8_t*)lw_malloc_zero((vdhp->sample_count + 1) * sizeof(uint8_t));
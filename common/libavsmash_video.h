@@ -148,6 +148,15 @@ int libavsmash_video_get_frame(libavsmash_video_decode_handler_t* vdhp, libavsma
 
 int libavsmash_video_find_first_valid_frame(libavsmash_video_decode_handler_t* vdhp);
 
+int libavsmash_video_get_packet_range(libavsmash_video_decode_handler_t* vdhp, uint32_t first_frame_number, uint32_t last_frame_number,
+    uint32_t* first_sample_number, uint32_t* last_sample_number);
+
+int libavsmash_video_get_packet(
+    libavsmash_video_decode_handler_t* vdhp, uint32_t sample_number, AVPacket* pkt, uint32_t* sample_description_index);
+
+int libavsmash_video_get_extradata(
+    libavsmash_video_decode_handler_t* vdhp, uint32_t sample_description_index, uint8_t** extradata, int* extradata_size);
+
 int libavsmash_video_create_keyframe_list(libavsmash_video_decode_handler_t* vdhp);
 
 int libavsmash_video_is_keyframe(libavsmash_video_decode_handler_t* vdhp, libavsmash_video_output_handler_t* vohp, uint32_t sample_number);
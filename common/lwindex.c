@@ -25,6 +25,7 @@
 #define _GNU_SOURCE
 #endif
 
+#include <stdarg.h>
 #include <sys/stat.h>
 #include <xxhash.h>
 
@@ -48,6 +49,8 @@ typedef struct {
     AVBSFContext* bsf_ctx;
     AVFrame* picture;
     AVPacket pkt;
+    AVPacket* bsf_in_pkt; /* reused input of the bitstream filter */
+    AVPacket* bsf_out_pkt; /* reused output of the bitstream filter, held until the next packet */
     uint32_t delay_count;
     lw_field_info_t last_field_info;
     int mpeg12_video; /* 0: neither MPEG-1 Video nor MPEG-2 Video
@@ -57,8 +60,17 @@ typedef struct {
                    * 2: either VC-1 or WMV3 encapsulated in ASF */
     int already_decoded;
     int (*decode)(AVCodecContext*, AVFrame*, int*, AVPacket*);
+    uint64_t packet_allocations; /* transient packet buffers allocated while indexing */
+    uint64_t packet_allocations_avoided; /* transient packet buffers reused or aliased instead */
 } lwindex_helper_t;
 
+/* Allocation counters of the indexer, reported once an index is created */
+typedef struct {
+    uint64_t packet_allocations; /* transient packet buffers actually allocated */
+    uint64_t packet_allocations_avoided; /* transient packet buffers a copy per packet would have allocated in addition */
+    uint32_t frame_list_growths;
+} lwindex_alloc_stats_t;
+
 typedef struct {
     int number_of_helpers;
     lwindex_helper_t** helpers;
@@ -68,6 +80,7 @@ typedef struct {
     int thread_count;
     char* format_name;
     AVBufferRef* hw_device_ctx;
+    lwindex_alloc_stats_t stats;
 } lwindex_indexer_t;
 
 typedef struct {
@@ -1020,8 +1033,8 @@ static lwlibav_extradata_t* alloc_extradata_entries(lwlibav_extradata_handler_t*
 }
 
 /* The libavcodec VC-1 parser does not support VC-1 and WMV3 packets without start code. This function makes them
- * parsable by adding start code, and convert RBDU into EBDU if needed. */
-static int make_vc1_ebdu(lwindex_helper_t* helper, AVPacket* in_pkt, AVPacket* out_pkt, uint8_t bdu_type, int is_vc1)
+ * parsable by adding start code, and convert RBDU into EBDU if needed. The result is stored into helper->pkt. */
+static int make_vc1_ebdu(lwindex_helper_t* helper, AVPacket* in_pkt, uint8_t bdu_type, int is_vc1)
 {
     int enough_packet_size = (1 + !is_vc1) * (in_pkt->size + 4);
     if (enough_packet_size > helper->pkt.size) {
@@ -1059,7 +1072,7 @@ static int make_vc1_ebdu(lwindex_helper_t* helper, AVPacket* in_pkt, AVPacket* o
         }
     }
     memset(data + *size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
-    return av_packet_ref(out_pkt, &helper->pkt);
+    return 0;
 }
 
 static lwindex_helper_t* get_index_helper(lwindex_indexer_t* indexer, AVStream* stream, const int rap_verification)
@@ -1129,28 +1142,24 @@ static lwindex_helper_t* get_index_helper(lwindex_indexer_t* indexer, AVStream*
         }
         if (helper->parser_ctx && helper->vc1_wmv3 == 2) {
             /* Initialize the VC-1/WMV3 parser by extradata. */
-            int ret;
-            AVPacket parsable_pkt = { 0 };
+            AVPacket pkt = { 0 };
+            AVPacket* parsable_pkt = &pkt;
             if (codecpar->codec_id == AV_CODEC_ID_WMV3 || codecpar->codec_id == AV_CODEC_ID_WMV3IMAGE) {
                 /* Make a sequence header EBDU (0x0000010F). */
-                AVPacket pkt = { 0 };
                 pkt.data = codecpar->extradata;
                 pkt.size = codecpar->extradata_size;
-                ret = make_vc1_ebdu(helper, &pkt, &parsable_pkt, 0x0F, 0);
+                if (make_vc1_ebdu(helper, &pkt, 0x0F, 0) < 0)
+                    return NULL;
+                parsable_pkt = &helper->pkt;
             } else {
                 /* For WVC1, the first byte is its size. */
-                AVPacket pkt = { 0 };
                 pkt.data = codecpar->extradata + 1;
                 pkt.size = codecpar->extradata_size - 1;
-                ret = av_packet_ref(&parsable_pkt, &pkt);
             }
-            if (ret < 0)
-                return NULL;
             uint8_t* dummy;
             int dummy_size;
-            av_parser_parse2(helper->parser_ctx, helper->codec_ctx, &dummy, &dummy_size, parsable_pkt.data, parsable_pkt.size,
+            av_parser_parse2(helper->parser_ctx, helper->codec_ctx, &dummy, &dummy_size, parsable_pkt->data, parsable_pkt->size,
                 AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
-            av_packet_unref(&parsable_pkt);
         }
     } else
         helper->already_decoded = 0;
@@ -1176,11 +1185,15 @@ static int apply_bsf(lwindex_helper_t* helper, AVCodecContext* ctx, AVPacket* ou
         if ((ret = av_bsf_init(helper->bsf_ctx)) < 0)
             return ret;
     }
-    /* Clone input packet since av_bsf_send_packet() moves sent packet to the internal packet buffer.
-     * The allocated packet will be reused for draining the remaining packets. */
-    AVPacket* pkt = av_packet_clone(in_pkt);
-    if (!pkt)
+    /* Reference input packet since av_bsf_send_packet() moves sent packet to the internal packet buffer.
+     * The packet is kept by the helper and also used for draining the remaining packets. */
+    if (!helper->bsf_in_pkt && !(helper->bsf_in_pkt = av_packet_alloc()))
         return -1;
+    AVPacket* pkt = helper->bsf_in_pkt;
+    if ((ret = av_packet_ref(pkt, in_pkt)) < 0)
+        return ret;
+    ++helper->packet_allocations;
+    ++helper->packet_allocations_avoided; /* AVPacket itself */
     in_pkt = pkt; /* Don't send the original input packet to the bitstream filter. */
     /* Apply the filter actually here.
      * Note that ffmpeg's av_bsf_send_packet() does not set EOF by sending NULL payload packet while libav's does.
@@ -1214,7 +1227,7 @@ static int apply_bsf(lwindex_helper_t* helper, AVCodecContext* ctx, AVPacket* ou
     }
     ret = 0;
 fail:
-    av_packet_free(&pkt);
+    av_packet_unref(pkt);
     return ret;
 }
 
@@ -1385,16 +1398,27 @@ static void investigate_pix_fmt_by_decoding(AVCodecContext* video_ctx, AVPacket*
     decode_video_packet(video_ctx, picture, &got_picture, pkt);
 }
 
-static int make_packet_parsable(lwindex_helper_t* helper, AVCodecContext* ctx, AVPacket* out_pkt, AVPacket* in_pkt)
+/* Return the packet to be parsed, which is owned by either the caller or the helper and valid until the next call,
+ * or NULL on failure. No reference is taken, so nothing has to be released. */
+static AVPacket* make_packet_parsable(lwindex_helper_t* helper, AVCodecContext* ctx, AVPacket* in_pkt)
 {
-    if (helper->vc1_wmv3 == 2)
+    if (helper->vc1_wmv3 == 2) {
         /* Make a frame EBDU (0x0000010D). */
-        return make_vc1_ebdu(helper, in_pkt, out_pkt, 0x0D, ctx->codec_id == AV_CODEC_ID_VC1 || ctx->codec_id == AV_CODEC_ID_VC1IMAGE);
-    if (!helper->bsf)
+        if (make_vc1_ebdu(helper, in_pkt, 0x0D, ctx->codec_id == AV_CODEC_ID_VC1 || ctx->codec_id == AV_CODEC_ID_VC1IMAGE) < 0)
+            return NULL;
+        ++helper->packet_allocations_avoided;
+        return &helper->pkt;
+    }
+    if (!helper->bsf) {
         /* Just use input packet since no bitstream filters are defined for this packet. */
-        return av_packet_ref(out_pkt, in_pkt);
+        ++helper->packet_allocations_avoided;
+        return in_pkt;
+    }
     /* Convert frame data into parsable bitstream format. */
-    return apply_bsf(helper, ctx, out_pkt, in_pkt, NULL);
+    if (!helper->bsf_out_pkt && !(helper->bsf_out_pkt = av_packet_alloc()))
+        return NULL;
+    av_packet_unref(helper->bsf_out_pkt);
+    return apply_bsf(helper, ctx, helper->bsf_out_pkt, in_pkt, NULL) < 0 ? NULL : helper->bsf_out_pkt;
 }
 
 static int get_picture_type(lwindex_helper_t* helper, AVCodecContext* ctx, AVPacket* pkt, const int rap_verification)
@@ -1402,24 +1426,22 @@ static int get_picture_type(lwindex_helper_t* helper, AVCodecContext* ctx, AVPac
     if (!helper->parser_ctx)
         return 0;
     /* Get by the parser. */
-    AVPacket filtered_pkt = { 0 };
-    int ret = make_packet_parsable(helper, ctx, &filtered_pkt, pkt);
-    if (ret < 0)
-        return ret;
+    AVPacket* parsable_pkt = make_packet_parsable(helper, ctx, pkt);
+    if (!parsable_pkt)
+        return -1;
     uint8_t* dummy;
     int dummy_size;
-    av_parser_parse2(helper->parser_ctx, ctx, &dummy, &dummy_size, filtered_pkt.data, filtered_pkt.size, pkt->pts, pkt->dts, pkt->pos);
+    av_parser_parse2(helper->parser_ctx, ctx, &dummy, &dummy_size, parsable_pkt->data, parsable_pkt->size, pkt->pts, pkt->dts, pkt->pos);
     const int parser_pict_type = helper->parser_ctx->pict_type > 0 ? helper->parser_ctx->pict_type : 0;
     if (rap_verification) {
         if (parser_pict_type != AV_PICTURE_TYPE_I) {
             pkt->flags &= ~AV_PKT_FLAG_KEY;
-            av_packet_unref(&filtered_pkt);
             return parser_pict_type;
         }
         // The parser thinks it's an I-frame. Let's perform a decode test to be sure it's a valid RAP.
         av_frame_unref(helper->picture);
         int decode_complete;
-        helper->decode(ctx, helper->picture, &decode_complete, &filtered_pkt);
+        helper->decode(ctx, helper->picture, &decode_complete, parsable_pkt);
         if (!decode_complete) {
             AVPacket null_pkt = { 0 };
             helper->decode(ctx, helper->picture, &decode_complete, &null_pkt);
@@ -1434,14 +1456,12 @@ static int get_picture_type(lwindex_helper_t* helper, AVCodecContext* ctx, AVPac
         } else
             pkt->flags &= ~AV_PKT_FLAG_KEY;
         avcodec_flush_buffers(ctx);
-        av_packet_unref(&filtered_pkt);
         return pict_type_to_return;
     } else {
         // If the demuxer flag contradicts the parser, always trust the parser.
         // The parser is more reliable as it inspects the bitstream.
         if ((pkt->flags & AV_PKT_FLAG_KEY) && (parser_pict_type != AV_PICTURE_TYPE_I))
             pkt->flags &= ~AV_PKT_FLAG_KEY;
-        av_packet_unref(&filtered_pkt);
         return parser_pict_type;
     }
 }
@@ -1605,6 +1625,10 @@ static void cleanup_index_helpers(lwindex_indexer_t* indexer, AVFormatContext* f
         av_bsf_free(&helper->bsf_ctx);
         av_frame_free(&helper->picture);
         av_packet_unref(&helper->pkt);
+        av_packet_free(&helper->bsf_in_pkt);
+        av_packet_free(&helper->bsf_out_pkt);
+        indexer->stats.packet_allocations += helper->packet_allocations;
+        indexer->stats.packet_allocations_avoided += helper->packet_allocations_avoided;
         lwlibav_extradata_handler_t* list = &helper->exh;
         if (list->entries) {
             for (int i = 0; i < list->entry_count; i++)
@@ -1617,12 +1641,207 @@ static void cleanup_index_helpers(lwindex_indexer_t* indexer, AVFormatContext* f
     av_freep(&indexer->helpers);
 }
 
+/* The packet lines of each stream are gathered into one contiguous section of the index file,
+ * so that a reader can skip the streams it does not use.
+ * The lines are buffered per stream and spilled to a spool file block by block, which bounds the memory use. */
+#define LWINDEX_SECTION_BUFFER_SIZE (1 << 16)
+#define LWINDEX_SECTION_RECORD_MAX 512 // longer than any pair of packet lines
+
+typedef struct {
+    int64_t offset;
+    uint32_t size;
+} lwindex_spool_block_t;
+
+typedef struct {
+    int codec_type;
+    uint32_t packet_count;
+    int64_t size;
+    char* buffer;
+    uint32_t buffer_size;
+    lwindex_spool_block_t* blocks;
+    int block_count;
+} lwindex_section_t;
+
+typedef struct {
+    FILE* index;
+    FILE* spool;
+    char* spool_path;
+    int64_t spool_size;
+    lwindex_section_t* sections; // indexed by stream index
+    int section_count;
+    int error;
+} lwindex_section_writer_t;
+
+/* Without a spool file, the packet lines are written into the index file interleaved as they come. */
+static void open_section_writer(lwindex_section_writer_t* writer, FILE* index, const char* index_tmp_path)
+{
+    memset(writer, 0, sizeof(lwindex_section_writer_t));
+    writer->index = index;
+    if (!index)
+        return;
+    writer->spool_path = (char*)lw_malloc_zero(strlen(index_tmp_path) + 5);
+    if (!writer->spool_path)
+        return;
+    sprintf(writer->spool_path, "%s.sec", index_tmp_path);
+    writer->spool = lw_fopen(writer->spool_path, "w+b");
+    if (!writer->spool)
+        lw_freep(&writer->spool_path);
+}
+
+static void close_section_writer(lwindex_section_writer_t* writer)
+{
+    if (writer->spool) {
+        fclose(writer->spool);
+        lw_remove(writer->spool_path);
+    }
+    for (int i = 0; i < writer->section_count; i++) {
+        lw_free(writer->sections[i].buffer);
+        lw_free(writer->sections[i].blocks);
+    }
+    lw_free(writer->sections);
+    lw_free(writer->spool_path);
+    memset(writer, 0, sizeof(lwindex_section_writer_t));
+}
+
+static int spill_section(lwindex_section_writer_t* writer, lwindex_section_t* section)
+{
+    lwindex_spool_block_t* blocks
+        = (lwindex_spool_block_t*)realloc(section->blocks, (section->block_count + 1) * sizeof(lwindex_spool_block_t));
+    if (!blocks)
+        return -1;
+    section->blocks = blocks;
+    if (fwrite(section->buffer, 1, section->buffer_size, writer->spool) != section->buffer_size)
+        return -1;
+    blocks[section->block_count].offset = writer->spool_size;
+    blocks[section->block_count].size = section->buffer_size;
+    ++section->block_count;
+    writer->spool_size += section->buffer_size;
+    section->buffer_size = 0;
+    return 0;
+}
+
+/* Append a packet record to the section of the stream.
+ * Errors are latched and reported by write_sections(). */
+static void print_section(lwindex_section_writer_t* writer, int stream_index, int codec_type, const char* format, ...)
+{
+    va_list args;
+    if (!writer->spool) {
+        if (writer->index) {
+            va_start(args, format);
+            vfprintf(writer->index, format, args);
+            va_end(args);
+        }
+        return;
+    }
+    if (writer->error)
+        return;
+    if (stream_index >= writer->section_count) {
+        lwindex_section_t* sections = (lwindex_section_t*)realloc(writer->sections, (stream_index + 1) * sizeof(lwindex_section_t));
+        if (!sections) {
+            writer->error = 1;
+            return;
+        }
+        memset(sections + writer->section_count, 0, (stream_index + 1 - writer->section_count) * sizeof(lwindex_section_t));
+        writer->sections = sections;
+        writer->section_count = stream_index + 1;
+    }
+    lwindex_section_t* section = &writer->sections[stream_index];
+    if (!section->buffer) {
+        section->buffer = (char*)lw_malloc_zero(LWINDEX_SECTION_BUFFER_SIZE);
+        if (!section->buffer) {
+            writer->error = 1;
+            return;
+        }
+    }
+    if (section->buffer_size + LWINDEX_SECTION_RECORD_MAX > LWINDEX_SECTION_BUFFER_SIZE && spill_section(writer, section) < 0) {
+        writer->error = 1;
+        return;
+    }
+    va_start(args, format);
+    int length = vsnprintf(section->buffer + section->buffer_size, LWINDEX_SECTION_BUFFER_SIZE - section->buffer_size, format, args);
+    va_end(args);
+    if (length < 0 || section->buffer_size + length >= LWINDEX_SECTION_BUFFER_SIZE) {
+        writer->error = 1;
+        return;
+    }
+    section->codec_type = codec_type;
+    section->buffer_size += length;
+    section->size += length;
+    ++section->packet_count;
+}
+
+/* Write the table of the sections followed by the sections themselves in stream order. */
+static int write_sections(lwindex_section_writer_t* writer, FILE* index)
+{
+    if (!writer->spool)
+        return 0;
+    if (writer->error)
+        return -1;
+    int section_count = 0;
+    for (int i = 0; i < writer->section_count; i++)
+        section_count += writer->sections[i].packet_count > 0;
+    fprintf(index, "<StreamSections=%d>\n", section_count);
+    int64_t offset = 0;
+    for (int i = 0; i < writer->section_count; i++) {
+        lwindex_section_t* section = &writer->sections[i];
+        if (section->packet_count == 0)
+            continue;
+        fprintf(index, "%d,%d,%" PRIu32 ",%" PRId64 ",%" PRId64 "\n", i, section->codec_type, section->packet_count, offset, section->size);
+        offset += section->size;
+    }
+    fprintf(index, "</StreamSections>\n");
+    char* copy_buffer = (char*)lw_malloc_zero(LWINDEX_SECTION_BUFFER_SIZE);
+    if (!copy_buffer)
+        return -1;
+    int ret = 0;
+    for (int i = 0; i < writer->section_count && ret == 0; i++) {
+        lwindex_section_t* section = &writer->sections[i];
+        for (int j = 0; j < section->block_count; j++) {
+            lwindex_spool_block_t* block = &section->blocks[j];
+            if (lw_fseek(writer->spool, block->offset, SEEK_SET) != 0 || fread(copy_buffer, 1, block->size, writer->spool) != block->size
+                || fwrite(copy_buffer, 1, block->size, index) != block->size) {
+                ret = -1;
+                break;
+            }
+        }
+        if (ret == 0 && fwrite(section->buffer, 1, section->buffer_size, index) != section->buffer_size)
+            ret = -1;
+    }
+    lw_free(copy_buffer);
+    return ret;
+}
+
+/* Estimate the number of packets of the longest stream of the type from the container.
+ * The estimate is only a hint: it is clipped to a sane range and the frame list still grows beyond it. */
+static uint32_t estimate_frame_list_count(AVFormatContext* format_ctx, enum AVMediaType codec_type)
+{
+    int64_t count = 0;
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        AVStream* stream = format_ctx->streams[i];
+        AVCodecParameters* codecpar = stream->codecpar;
+        if (codecpar->codec_type != codec_type)
+            continue;
+        int64_t estimate = stream->nb_frames;
+        if (estimate <= 0 && format_ctx->duration > 0) {
+            if (codec_type == AVMEDIA_TYPE_VIDEO && stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
+                estimate = av_rescale_q(format_ctx->duration, AV_TIME_BASE_Q, av_inv_q(stream->avg_frame_rate));
+            else if (codec_type == AVMEDIA_TYPE_AUDIO && codecpar->frame_size > 0 && codecpar->sample_rate > 0)
+                estimate = av_rescale(format_ctx->duration, codecpar->sample_rate, (int64_t)AV_TIME_BASE * codecpar->frame_size);
+        }
+        count = MAX(count, estimate);
+    }
+    /* Leave a margin for the error of the estimate. */
+    count += count / 8 + 2;
+    return (uint32_t)av_clip64(count, 1 << 16, 1 << 21);
+}
+
 static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp,
     lwlibav_audio_decode_handler_t* adhp, lwlibav_audio_output_handler_t* aohp, AVFormatContext* format_ctx, lwlibav_option_t* opt,
-    progress_indicator_t* indicator, progress_handler_t* php)
+    progress_indicator_t* indicator, progress_handler_t* php, const char* index_path, uint64_t fingerprint)
 {
-    uint32_t video_info_count = 1 << 16;
-    uint32_t audio_info_count = 1 << 16;
+    /* Size the frame lists from the container so that they rarely have to be grown and copied while indexing. */
+    uint32_t video_info_count = estimate_frame_list_count(format_ctx, AVMEDIA_TYPE_VIDEO);
+    uint32_t audio_info_count = estimate_frame_list_count(format_ctx, AVMEDIA_TYPE_AUDIO);
     video_frame_info_t* video_info = (video_frame_info_t*)malloc(video_info_count * sizeof(video_frame_info_t));
     if (!video_info)
         return -1;
@@ -1637,15 +1856,19 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
         <InputFilePath>foobar.omo</InputFilePath>
         <FileSize=1048576>
         <FileLastModificationTime=000>
-        <FileHash=0x0123456789abcdef>
+        <FileFingerprint=0x0123456789abcdef>
         <LibavReaderIndex=0x00000208,0,marumoska>
         <ActiveVideoStreamIndex>+0000000000</ActiveVideoStreamIndex>
         <ActiveAudioStreamIndex>-0000000001</ActiveAudioStreamIndex>
         <DefaultAudioStreamIndex>-0000000001</DefaultAudioStreamIndex>
         <FillAudioGaps>0</FillAudioGaps>
+        <PacketCount>+0000000001,+0000000000</PacketCount>
         <StreamInfo=0,0>
         Codec=2,TimeBase=1001/24000,Width=1920,Height=1080,Format=yuv420p,ColorSpace=5
         </StreamInfo>
+        <StreamSections=1>
+        0,0,1,0,78
+        </StreamSections>
         Index=0,POS=0,PTS=2002,DTS=0,EDI=0
         Key=1,Pic=1,POC=0,Repeat=1,Field=0,Super=0
         </LibavReaderIndex>
@@ -1660,20 +1883,28 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
         </ExtraDataList>
         </LibavReaderIndexFile>
      */
+    /* The index is written to a temporary file that replaces the index file only once it is complete,
+     * so that readers never see a partially written index.
+     * The name of the temporary file is unique to each writer, even to those not excluded by the lock on the index. */
     FILE* index = NULL;
-    if (opt->index_file_path)
-        index = !opt->no_create_index ? lw_fopen(opt->index_file_path, "wb") : NULL;
-    else if (!opt->no_create_index) {
-        char* index_path = create_lwi_path(opt);
-        index = lw_fopen(index_path, "wb");
-        if (!index)
+    char* index_tmp_path = NULL;
+    if (index_path) {
+        static unsigned int writer_count = 0;
+        lw_lock_global_mutex();
+        unsigned int writer_number = ++writer_count;
+        lw_unlock_global_mutex();
+        index_tmp_path = (char*)lw_malloc_zero(strlen(index_path) + 32);
+        if (index_tmp_path) {
+            sprintf(index_tmp_path, "%s.%d-%u.tmp", index_path, (int)lw_getpid(), writer_number);
+            index = lw_fopen(index_tmp_path, "wb");
+        }
+        if (!index) {
             fprintf(stderr, "lsmas: unable to create index file %s\n", index_path);
-        lw_free(index_path);
-    }
-    if (!index && !opt->no_create_index) {
-        free(video_info);
-        free(audio_info);
-        return -1;
+            lw_free(index_tmp_path);
+            free(video_info);
+            free(audio_info);
+            return -1;
+        }
     }
     lwhp->format_name = (char*)format_ctx->iformat->name;
     lwhp->format_flags = format_ctx->iformat->flags;
@@ -1685,6 +1916,8 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
     adhp->dv_in_avi = !strcmp(lwhp->format_name, "avi") ? -1 : 0;
     int32_t video_index_pos = 0;
     int32_t audio_index_pos = 0;
+    int32_t packet_count_pos = 0;
+    int64_t header_size = 0;
 #ifdef _WIN32
     wchar_t* wname = NULL;
 #endif // _WIN32
@@ -1708,7 +1941,10 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
 #endif
         fprintf(index, "<FileSize=%" PRId64 ">\n", file_stat.st_size);
         fprintf(index, "<FileLastModificationTime=%" PRId64 ">\n", file_stat.st_mtime);
-        fprintf(index, "<FileHash=0x%016" PRIx64 ">\n", xxhash_file(lwhp->file_path, file_stat.st_size));
+        /* The fingerprint may already be known from naming the index. */
+        if (!fingerprint)
+            fingerprint = xxhash_file_fingerprint(lwhp->file_path, file_stat.st_size);
+        fprintf(index, "<FileFingerprint=0x%016" PRIx64 ">\n", fingerprint);
         fprintf(index, "<LibavReaderIndex=0x%08x,%d,%s>\n", lwhp->format_flags, lwhp->raw_demuxer, lwhp->format_name);
         video_index_pos = ftell(index);
         fprintf(index, "<ActiveVideoStreamIndex>%+011d</ActiveVideoStreamIndex>\n", -1);
@@ -1716,6 +1952,11 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
         fprintf(index, "<ActiveAudioStreamIndex>%+011d</ActiveAudioStreamIndex>\n", adhp->stream_index);
         fprintf(index, "<DefaultAudioStreamIndex>%+011d</DefaultAudioStreamIndex>\n", -1);
         fprintf(index, "<FillAudioGaps>%d</FillAudioGaps>\n", aohp->fill_audio_gaps);
+        /* The numbers of packets of the active streams are filled after indexing.
+         * These allow the parser to allocate the frame lists at once. */
+        packet_count_pos = ftell(index);
+        fprintf(index, "<PacketCount>%+011d,%+011d</PacketCount>\n", 0, 0);
+        header_size = ftell(index);
     }
     AVPacket pkt = { 0 };
     int pix_fmt_investigated = 0;
@@ -1737,6 +1978,8 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
     if (indicator->open)
         indicator->open(php);
     /* Start to read frames and write the index file. */
+    lwindex_section_writer_t sections;
+    open_section_writer(&sections, index, index_tmp_path);
     lwindex_indexer_t indexer = {
         0, /* number_of_helpers */
         NULL, /* helpers */
@@ -1745,7 +1988,8 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
         adhp->preferred_decoder_names, /* preferred_audio_decoder_names */
         lwhp->threads, /* thread_count */
         lwhp->format_name, /* format_name */
-        vdhp->hw_device_ctx /* hw device buffer */
+        vdhp->hw_device_ctx, /* hw device buffer */
+        { 0 } /* stats */
     };
     for (unsigned int stream_index = 0; stream_index < format_ctx->nb_streams; stream_index++) {
         AVStream* stream = format_ctx->streams[stream_index];
@@ -1940,6 +2184,7 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
                     vdhp->max_height = pkt_ctx->height;
                 if (video_sample_count + 1 == video_info_count) {
                     video_info_count <<= 1;
+                    ++indexer.stats.frame_list_growths;
                     video_frame_info_t* temp = (video_frame_info_t*)realloc(video_info, video_info_count * sizeof(video_frame_info_t));
                     if (!temp) {
                         av_packet_unref(&pkt);
@@ -1966,7 +2211,7 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
                     entry->codec_tag = pkt_ctx->codec_tag;
             }
             /* Write a video packet info to the index file. */
-            print_index(index,
+            print_section(&sections, pkt.stream_index, AVMEDIA_TYPE_VIDEO,
                 "Index=%d,POS=%" PRId64 ",PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=%d\n"
                 "Key=%d,Pic=%d,POC=%d,Repeat=%d,Field=%d,Super=%d\n",
                 pkt.stream_index, pkt.pos, pkt.pts, pkt.dts, extradata_index, !!(pkt.flags & AV_PKT_FLAG_KEY), pict_type, poc, repeat_pict,
@@ -2032,7 +2277,7 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
                                         info->pts = prev_end;
                                         info->dts = prev_info->dts + prev_duration;
                                         info->file_offset = -1;
-                                        print_index(index,
+                                        print_section(&sections, pkt.stream_index, AVMEDIA_TYPE_AUDIO,
                                             "Index=%d,POS=%" PRId64 ",PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=%d\n"
                                             "Length=%d\n",
                                             pkt.stream_index, info->file_offset, info->pts, info->dts, extradata_index, info->length);
@@ -2046,6 +2291,7 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
                             audio_sample_rate = pkt_ctx->sample_rate;
                         if (audio_sample_count + 1 == audio_info_count) {
                             audio_info_count <<= 1;
+                            ++indexer.stats.frame_list_growths;
                             audio_frame_info_t* temp
                                 = (audio_frame_info_t*)realloc(audio_info, audio_info_count * sizeof(audio_frame_info_t));
                             if (!temp) {
@@ -2082,7 +2328,7 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
                 }
             }
             /* Write an audio packet info to the index file. */
-            print_index(index,
+            print_section(&sections, pkt.stream_index, AVMEDIA_TYPE_AUDIO,
                 "Index=%d,POS=%" PRId64 ",PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=%d\n"
                 "Length=%d\n",
                 pkt.stream_index, pkt.pos, pkt.pts, pkt.dts, extradata_index, frame_length);
@@ -2132,13 +2378,16 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
                     if (audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length)
                         constant_frame_length = 0;
                 }
-                print_index(index,
+                print_section(&sections, stream_index, AVMEDIA_TYPE_AUDIO,
                     "Index=%d,POS=-1,PTS=%" PRId64 ",DTS=%" PRId64 ",EDI=-1\n"
                     "Length=%d\n",
                     stream_index, AV_NOPTS_VALUE, AV_NOPTS_VALUE, frame_length);
             }
         }
     }
+    if (write_sections(&sections, index) < 0)
+        goto fail_index;
+    close_section_writer(&sections);
     print_index(index, "</LibavReaderIndex>\n");
     const int consistent_field_and_repeat = consistent_field_order && consistent_repeat_pict;
     print_index(index, "<VideoConsistentFieldRepeatPict>%d</VideoConsistentFieldRepeatPict>\n", consistent_field_and_repeat);
@@ -2291,6 +2540,11 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
         }
     }
     print_index(index, "</LibavReaderIndexFile>\n");
+    if (index) {
+        fseek(index, packet_count_pos, SEEK_SET);
+        fprintf(index, "<PacketCount>%+011d,%+011d</PacketCount>\n", video_sample_count, audio_sample_count);
+        fseek(index, 0, SEEK_END);
+    }
     if (vdhp->stream_index >= 0) {
         vdhp->keyframe_list = (uint8_t*)lw_malloc_zero((video_sample_count + 1) * sizeof(uint8_t));
         if (!vdhp->keyframe_list)
@@ -2319,8 +2573,21 @@ static int create_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handl
     lw_free(wname);
 #endif // _WIN32
     cleanup_index_helpers(&indexer, format_ctx, rap_verification);
-    if (index)
-        fclose(index);
+    lw_log_show(&vdhp->lh, LW_LOG_INFO,
+        "Indexing allocated %" PRIu64 " transient packet buffers (%" PRIu64 " without reuse) and grew the frame lists %" PRIu32 " times.",
+        indexer.stats.packet_allocations, indexer.stats.packet_allocations + indexer.stats.packet_allocations_avoided,
+        indexer.stats.frame_list_growths);
+    if (index) {
+        int err = fclose(index);
+        /* The text index is kept if it cannot be compressed. */
+        if (!err && opt->compress_index)
+            lwindex_compress_file(index_tmp_path, header_size);
+        if (err || lw_rename(index_tmp_path, index_path)) {
+            fprintf(stderr, "lsmas: unable to create index file %s\n", index_path);
+            lw_remove(index_tmp_path);
+        }
+        lw_free(index_tmp_path);
+    }
     if (indicator->close)
         indicator->close(php);
     vdhp->format = NULL;
@@ -2331,10 +2598,14 @@ fail_index:
     lw_free(wname);
 #endif // _WIN32
     cleanup_index_helpers(&indexer, format_ctx, rap_verification);
+    close_section_writer(&sections);
     free(video_info);
     free(audio_info);
-    if (index)
+    if (index) {
         fclose(index);
+        lw_remove(index_tmp_path);
+        lw_free(index_tmp_path);
+    }
     if (indicator->close)
         indicator->close(php);
     vdhp->format = NULL;
@@ -2342,15 +2613,52 @@ fail_index:
     return -1;
 }
 
-static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp,
-    lwlibav_audio_decode_handler_t* adhp, lwlibav_audio_output_handler_t* aohp, lwlibav_option_t* opt, lwindex_data_t* data, FILE* index)
+typedef struct {
+    lwlibav_file_handler_t* lwhp;
+    lwlibav_video_decode_handler_t* vdhp;
+    lwlibav_audio_decode_handler_t* adhp;
+    lwlibav_audio_output_handler_t* aohp;
+    lwlibav_option_t* opt;
+    int header_verified;
+    int video_present;
+    int audio_present;
+    int duration_stream_index;
+    lwindex_stream_info_t* stream_info;
+    video_frame_info_t* video_info;
+    audio_frame_info_t* audio_info;
+    uint32_t video_info_count;
+    uint32_t audio_info_count;
+    uint32_t video_sample_count;
+    uint32_t invisible_count;
+    int64_t last_keyframe_pts;
+    uint32_t audio_sample_count;
+    int audio_sample_rate;
+    int constant_frame_length;
+    uint64_t audio_duration;
+} lwindex_parse_context_t;
+
+/* Return the number of packets of the stream section, or a default allocation size of the frame list if unknown.
+ * The section also holds the packets not stored in the frame list, so this is an upper bound. */
+static uint32_t get_section_packet_count(const lwindex_data_t* data, int stream_index)
 {
-    lwindex_stream_info_t* stream_info = NULL;
-    if (!data) {
-        return -1;
-    }
+    for (int i = 0; i < data->num_stream_sections; i++)
+        if (data->stream_sections[i].stream_index == stream_index)
+            return data->stream_sections[i].packet_count;
+    return (1 << 16) - 2;
+}
+
+/* Verify the header of the index file and set up the frame lists.
+ * This is called once all the tags preceding the first index entry have been parsed. */
+static int verify_index_header(lwindex_parse_context_t* ctx, const lwindex_data_t* data)
+{
+    lwlibav_file_handler_t* lwhp = ctx->lwhp;
+    lwlibav_video_decode_handler_t* vdhp = ctx->vdhp;
+    lwlibav_audio_decode_handler_t* adhp = ctx->adhp;
+    lwlibav_audio_output_handler_t* aohp = ctx->aohp;
+    lwlibav_option_t* opt = ctx->opt;
+    ctx->header_verified = 1;
     /* Test to open the target file. */
-    char* file_path = data->input_file_path;
+    const char* file_path = data->input_file_path;
     size_t file_path_length = strlen(opt->file_path);
     const char* ext = file_path_length >= 5 ? &opt->file_path[file_path_length - 4] : NULL;
     if (ext && !strncmp(ext, ".lwi", strlen(".lwi"))) {
@@ -2369,15 +2677,15 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
             return -1;
         memcpy(lwhp->file_path, opt->file_path, file_path_length);
     }
-    /* Parse the index file. */
+    /* Verify the target file. */
 #ifdef _WIN32
     wchar_t* wname = NULL;
     struct _stat64 file_stat;
     if (lw_string_to_wchar(CP_UTF8, lwhp->file_path, &wname)) {
-        if (_wstat64(wname, &file_stat)) {
-            lw_free(wname);
+        int err = _wstat64(wname, &file_stat);
+        lw_free(wname);
+        if (err)
             return -1;
-        }
     } else {
         if (_stat64(lwhp->file_path, &file_stat))
             return -1;
@@ -2389,9 +2697,15 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
 #endif
     if (data->file_size != file_stat.st_size)
         return -1;
-    if (data->file_last_modification_time != file_stat.st_mtime) {
+    int mtime_matched = data->file_last_modification_time == file_stat.st_mtime;
+    if (opt->verify_policy == LWINDEX_VERIFY_NEVER && !mtime_matched)
+        return -1;
+    if (opt->verify_policy == LWINDEX_VERIFY_ALWAYS || (opt->verify_policy == LWINDEX_VERIFY_MTIME && !mtime_matched)) {
         // Also check hashsum
-        if ((!data->file_hash || data->file_hash != xxhash_file(lwhp->file_path, file_stat.st_size))
+        if (data->file_fingerprint) {
+            if (data->file_fingerprint != xxhash_file_fingerprint(lwhp->file_path, file_stat.st_size))
+                return -1;
+        } else if ((!data->file_hash || data->file_hash != xxhash_file(lwhp->file_path, file_stat.st_size))
             && (!data->file_hash || data->file_hash != xxhash32_file(lwhp->file_path, file_stat.st_size)))
             return -1;
     }
@@ -2399,17 +2713,13 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
     lwhp->raw_demuxer = data->raw_demuxer;
     lwhp->format_name = strdup(data->format_name);
     adhp->dv_in_avi = !strcmp(lwhp->format_name, "avi") ? -1 : 0;
-    int video_present = (data->active_video_stream_index >= 0);
-    int audio_present = (data->active_audio_stream_index >= 0);
+    ctx->video_present = (data->active_video_stream_index >= 0);
+    ctx->audio_present = (data->active_audio_stream_index >= 0);
     vdhp->stream_index = opt->force_video ? opt->force_video_index : data->active_video_stream_index;
     switch (opt->force_audio_index) {
     case -1: {
-        if (data->default_audio_stream_index != data->active_audio_stream_index) {
-#ifdef _WIN32
-            lw_free(wname);
-#endif // _WIN32
+        if (data->default_audio_stream_index != data->active_audio_stream_index)
             return -1;
-        }
     }
     case -2:
         adhp->stream_index = data->active_audio_stream_index;
@@ -2418,46 +2728,46 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
         adhp->stream_index = opt->force_audio_index;
         break;
     }
-    uint32_t video_info_count = 1 << 16;
-    uint32_t audio_info_count = 1 << 16;
-    video_frame_info_t* video_info = NULL;
-    audio_frame_info_t* audio_info = NULL;
+    ctx->duration_stream_index = vdhp->stream_index;
+    /* Allocate the frame lists at once if the numbers of packets are known.
+     * Otherwise, the frame lists grow while parsing. */
+    ctx->video_info_count = (data->video_packet_count && vdhp->stream_index == data->active_video_stream_index)
+        ? data->video_packet_count + 2
+        : get_section_packet_count(data, vdhp->stream_index) + 2;
+    ctx->audio_info_count = (data->audio_packet_count && adhp->stream_index == data->active_audio_stream_index)
+        ? data->audio_packet_count + 2
+        : get_section_packet_count(data, adhp->stream_index) + 2;
     if (vdhp->stream_index >= 0) {
-        video_info = (video_frame_info_t*)malloc(video_info_count * sizeof(video_frame_info_t));
-        if (!video_info)
-            goto fail_parsing;
+        ctx->video_info = (video_frame_info_t*)malloc(ctx->video_info_count * sizeof(video_frame_info_t));
+        if (!ctx->video_info)
+            return -1;
     }
     if (adhp->stream_index >= 0) {
-        audio_info = (audio_frame_info_t*)malloc(audio_info_count * sizeof(audio_frame_info_t));
-        if (!audio_info)
-            goto fail_parsing;
+        ctx->audio_info = (audio_frame_info_t*)malloc(ctx->audio_info_count * sizeof(audio_frame_info_t));
+        if (!ctx->audio_info)
+            return -1;
     }
     if (data->active_audio_stream_index == -2 && opt->force_audio_index != -2) // Maybe redundant.
-        goto fail_parsing;
+        return -1;
     if (opt->force_audio_index != -2 && data->fill_audio_gaps != aohp->fill_audio_gaps)
-        goto fail_parsing;
+        return -1;
     vdhp->codec_id = AV_CODEC_ID_NONE;
     adhp->codec_id = AV_CODEC_ID_NONE;
     vdhp->initial_pix_fmt = AV_PIX_FMT_NONE;
     vdhp->initial_colorspace = AVCOL_SPC_NB;
     aohp->output_sample_format = AV_SAMPLE_FMT_NONE;
-    uint32_t video_sample_count = 0;
-    uint32_t invisible_count = 0;
-    int64_t last_keyframe_pts = AV_NOPTS_VALUE;
-    uint32_t audio_sample_count = 0;
-    int audio_sample_rate = 0;
-    int constant_frame_length = 1;
-    uint64_t audio_duration = 0;
+    ctx->last_keyframe_pts = AV_NOPTS_VALUE;
+    ctx->constant_frame_length = 1;
 
     int max_stream_index = 0;
     for (int i = 0; i < data->num_streams; i++)
         if (data->stream_info[i].stream_index > max_stream_index)
             max_stream_index = data->stream_info[i].stream_index;
-    stream_info = (lwindex_stream_info_t*)malloc((max_stream_index + 1) * sizeof(lwindex_stream_info_t));
-    if (!stream_info)
-        goto fail_parsing;
+    ctx->stream_info = (lwindex_stream_info_t*)malloc((max_stream_index + 1) * sizeof(lwindex_stream_info_t));
+    if (!ctx->stream_info)
+        return -1;
     for (int i = 0; i < data->num_streams; i++) {
-        lwindex_stream_info_t* info = &stream_info[data->stream_info[i].stream_index];
+        lwindex_stream_info_t* info = &ctx->stream_info[data->stream_info[i].stream_index];
         info->codec_type = data->stream_info[i].codec_type;
         if (info->codec_type == AVMEDIA_TYPE_VIDEO) {
             info->codec_id = data->stream_info[i].codec;
@@ -2468,9 +2778,6 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
             strncpy(info->fmt, data->stream_info[i].format, FORMAT_LENGTH);
             info->fmt[FORMAT_LENGTH - 1] = '\0';
             info->colorspace = data->stream_info[i].data.type0.color_space;
-
-            if (data->stream_info[i].stream_index == vdhp->stream_index)
-                vdhp->stream_duration = data->stream_info[i].stream_duration;
         } else if (info->codec_type == AVMEDIA_TYPE_AUDIO) {
             info->codec_id = data->stream_info[i].codec;
             info->time_base.num = data->stream_info[i].time_base.num;
@@ -2483,158 +2790,213 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
             info->bits_per_sample = data->stream_info[i].bits_per_sample;
         }
     }
+    return 0;
+}
 
-    for (int i = 0; i < data->num_index_entries; i++) {
-        index_entry_t* entry = &data->index_entries[i];
-        int stream_index = entry->stream_index;
-        int codec_type = stream_info[stream_index].codec_type;
-        int codec_id = stream_info[stream_index].codec_id;
-        AVRational time_base = stream_info[stream_index].time_base;
+/* Store an index entry into the frame list directly while parsing the index file. */
+static int parse_index_entry(void* opaque, const lwindex_data_t* data, const index_entry_t* entry)
+{
+    lwindex_parse_context_t* ctx = (lwindex_parse_context_t*)opaque;
+    if (!ctx->header_verified && verify_index_header(ctx, data) < 0)
+        return -1;
+    lwlibav_video_decode_handler_t* vdhp = ctx->vdhp;
+    lwlibav_audio_decode_handler_t* adhp = ctx->adhp;
+    lwlibav_audio_output_handler_t* aohp = ctx->aohp;
+    lwlibav_option_t* opt = ctx->opt;
+    int stream_index = entry->stream_index;
+    int codec_type = ctx->stream_info[stream_index].codec_type;
+    int codec_id = ctx->stream_info[stream_index].codec_id;
+    AVRational time_base = ctx->stream_info[stream_index].time_base;
 
-        if (codec_type == AVMEDIA_TYPE_VIDEO) {
-            if (adhp->dv_in_avi == -1 && codec_id == AV_CODEC_ID_DVVIDEO && !opt->force_audio) {
-                adhp->dv_in_avi = 1;
-                if (vdhp->stream_index == -1) {
-                    vdhp->stream_index = stream_index;
-                    video_info = (video_frame_info_t*)malloc(video_info_count * sizeof(video_frame_info_t));
-                    if (!video_info)
-                        goto fail_parsing;
-                }
+    if (codec_type == AVMEDIA_TYPE_VIDEO) {
+        if (adhp->dv_in_avi == -1 && codec_id == AV_CODEC_ID_DVVIDEO && !opt->force_audio) {
+            adhp->dv_in_avi = 1;
+            if (vdhp->stream_index == -1) {
+                vdhp->stream_index = stream_index;
+                ctx->video_info = (video_frame_info_t*)malloc(ctx->video_info_count * sizeof(video_frame_info_t));
+                if (!ctx->video_info)
+                    return -1;
             }
-            if (stream_index == vdhp->stream_index) {
-                int width = stream_info[stream_index].width;
-                int height = stream_info[stream_index].height;
-                char* pix_fmt = stream_info[stream_index].fmt;
-                int colorspace = stream_info[stream_index].colorspace;
-
-                int key = entry->data.type0.key;
-                int pict_type = entry->data.type0.pic;
-                if (vdhp->codec_id == AV_CODEC_ID_NONE)
-                    vdhp->codec_id = (enum AVCodecID)codec_id;
-                if ((key | width | height) || pict_type == -1 || colorspace != AVCOL_SPC_NB) {
-                    if (vdhp->initial_width == 0 || vdhp->initial_height == 0) {
-                        vdhp->initial_width = width;
-                        vdhp->initial_height = height;
+        }
+        if (stream_index == vdhp->stream_index) {
+            int width = ctx->stream_info[stream_index].width;
+            int height = ctx->stream_info[stream_index].height;
+            char* pix_fmt = ctx->stream_info[stream_index].fmt;
+            int colorspace = ctx->stream_info[stream_index].colorspace;
+
+            int key = entry->data.type0.key;
+            int pict_type = entry->data.type0.pic;
+            if (vdhp->codec_id == AV_CODEC_ID_NONE)
+                vdhp->codec_id = (enum AVCodecID)codec_id;
+            if ((key | width | height) || pict_type == -1 || colorspace != AVCOL_SPC_NB) {
+                if (vdhp->initial_width == 0 || vdhp->initial_height == 0) {
+                    vdhp->initial_width = width;
+                    vdhp->initial_height = height;
+                    vdhp->max_width = width;
+                    vdhp->max_height = height;
+                } else {
+                    if (vdhp->max_width < width)
                         vdhp->max_width = width;
+                    if (vdhp->max_height < height)
                         vdhp->max_height = height;
-                    } else {
-                        if (vdhp->max_width < width)
-                            vdhp->max_width = width;
-                        if (vdhp->max_height < height)
-                            vdhp->max_height = height;
-                    }
-                    if (vdhp->initial_pix_fmt == AV_PIX_FMT_NONE)
-                        vdhp->initial_pix_fmt = av_get_pix_fmt(pix_fmt);
-                    if (vdhp->initial_colorspace == AVCOL_SPC_NB)
-                        vdhp->initial_colorspace = (enum AVColorSpace)colorspace;
-                    if (vdhp->time_base.num == 0 || vdhp->time_base.den == 0) {
-                        vdhp->time_base.num = time_base.num;
-                        vdhp->time_base.den = time_base.den;
-                    }
-                    ++video_sample_count;
-                    video_frame_info_t* info = &video_info[video_sample_count];
-                    memset(info, 0, sizeof(video_frame_info_t));
-                    info->pts = entry->pts;
-                    info->dts = entry->dts;
-                    info->file_offset = entry->pos;
-                    info->sample_number = video_sample_count;
-                    info->extradata_index = entry->edi;
-                    info->pict_type = entry->data.type0.pic;
-                    info->poc = entry->data.type0.poc;
-                    info->repeat_pict = entry->data.type0.repeat;
-                    info->field_info = (lw_field_info_t)entry->data.type0.field;
-                    info->is_superframe = entry->data.type0.super;
-                    if (entry->pts != AV_NOPTS_VALUE && last_keyframe_pts != AV_NOPTS_VALUE && entry->pts < last_keyframe_pts)
-                        info->flags |= LW_VFRAME_FLAG_LEADING;
-                    if (key) {
-                        info->flags |= LW_VFRAME_FLAG_KEY;
-                        last_keyframe_pts = entry->pts;
-                    }
-                    if (info->repeat_pict == 0 && info->field_info == LW_FIELD_INFO_UNKNOWN && av_get_pix_fmt(pix_fmt) == AV_PIX_FMT_NONE
-                        && ((enum AVCodecID)codec_id == AV_CODEC_ID_H264 || (enum AVCodecID)codec_id == AV_CODEC_ID_HEVC)
-                        && (width == 0 || height == 0))
-                        info->flags |= LW_VFRAME_FLAG_CORRUPT;
-                    if ((enum AVCodecID)codec_id == AV_CODEC_ID_VP8 && info->pts == AV_NOPTS_VALUE && info->dts == AV_NOPTS_VALUE
-                        && info->file_offset == -1) {
-                        /* VPx invisible altref frame. */
-                        info->flags |= LW_VFRAME_FLAG_INVISIBLE;
-                        ++invisible_count;
-                    }
                 }
-                if (video_sample_count + 1 == video_info_count) {
-                    video_info_count <<= 1;
-                    video_frame_info_t* temp = (video_frame_info_t*)realloc(video_info, video_info_count * sizeof(video_frame_info_t));
-                    if (!temp)
-                        goto fail_parsing;
-                    video_info = temp;
+                if (vdhp->initial_pix_fmt == AV_PIX_FMT_NONE)
+                    vdhp->initial_pix_fmt = av_get_pix_fmt(pix_fmt);
+                if (vdhp->initial_colorspace == AVCOL_SPC_NB)
+                    vdhp->initial_colorspace = (enum AVColorSpace)colorspace;
+                if (vdhp->time_base.num == 0 || vdhp->time_base.den == 0) {
+                    vdhp->time_base.num = time_base.num;
+                    vdhp->time_base.den = time_base.den;
+                }
+                ++ctx->video_sample_count;
+                video_frame_info_t* info = &ctx->video_info[ctx->video_sample_count];
+                memset(info, 0, sizeof(video_frame_info_t));
+                info->pts = entry->pts;
+                info->dts = entry->dts;
+                info->file_offset = entry->pos;
+                info->sample_number = ctx->video_sample_count;
+                info->extradata_index = entry->edi;
+                info->pict_type = entry->data.type0.pic;
+                info->poc = entry->data.type0.poc;
+                info->repeat_pict = entry->data.type0.repeat;
+                info->field_info = (lw_field_info_t)entry->data.type0.field;
+                info->is_superframe = entry->data.type0.super;
+                if (entry->pts != AV_NOPTS_VALUE && ctx->last_keyframe_pts != AV_NOPTS_VALUE && entry->pts < ctx->last_keyframe_pts)
+                    info->flags |= LW_VFRAME_FLAG_LEADING;
+                if (key) {
+                    info->flags |= LW_VFRAME_FLAG_KEY;
+                    ctx->last_keyframe_pts = entry->pts;
+                }
+                if (info->repeat_pict == 0 && info->field_info == LW_FIELD_INFO_UNKNOWN && av_get_pix_fmt(pix_fmt) == AV_PIX_FMT_NONE
+                    && ((enum AVCodecID)codec_id == AV_CODEC_ID_H264 || (enum AVCodecID)codec_id == AV_CODEC_ID_HEVC)
+                    && (width == 0 || height == 0))
+                    info->flags |= LW_VFRAME_FLAG_CORRUPT;
+                if ((enum AVCodecID)codec_id == AV_CODEC_ID_VP8 && info->pts == AV_NOPTS_VALUE && info->dts == AV_NOPTS_VALUE
+                    && info->file_offset == -1) {
+                    /* VPx invisible altref frame. */
+                    info->flags |= LW_VFRAME_FLAG_INVISIBLE;
+                    ++ctx->invisible_count;
                 }
             }
-        } else if (codec_type == AVMEDIA_TYPE_AUDIO) {
-            if (stream_index == adhp->stream_index) {
-                uint64_t layout = stream_info[stream_index].layout;
-                int channels = stream_info[stream_index].channels;
-                int sample_rate = stream_info[stream_index].sample_rate;
-                char* sample_fmt = stream_info[stream_index].fmt;
-                int bits_per_sample = stream_info[stream_index].bits_per_sample;
-                int frame_length = entry->data.type1.length;
-                if (adhp->codec_id == AV_CODEC_ID_NONE)
-                    adhp->codec_id = (enum AVCodecID)codec_id;
-                if ((channels | layout | sample_rate | bits_per_sample) && entry->edi != -1 && audio_duration <= INT32_MAX) {
-                    if (audio_sample_rate == 0)
-                        audio_sample_rate = sample_rate;
-                    if (adhp->time_base.num == 0 || adhp->time_base.den == 0) {
-                        adhp->time_base.num = time_base.num;
-                        adhp->time_base.den = time_base.den;
-                    }
-                    if (channels > aohp->output_channel_layout.nb_channels)
-                        av_channel_layout_from_mask(&aohp->output_channel_layout, layout);
-                    aohp->output_sample_format = select_better_sample_format(aohp->output_sample_format, av_get_sample_fmt(sample_fmt));
-                    aohp->output_sample_rate = MAX(aohp->output_sample_rate, audio_sample_rate);
-                    aohp->output_bits_per_sample = MAX(aohp->output_bits_per_sample, bits_per_sample);
-                    ++audio_sample_count;
-                    audio_frame_info_t* info = &audio_info[audio_sample_count];
-                    memset(info, 0, sizeof(audio_frame_info_t));
-                    info->pts = entry->pts;
-                    info->dts = entry->dts;
-                    info->file_offset = entry->pos;
-                    info->sample_number = audio_sample_count;
-                    info->extradata_index = entry->edi;
-                    info->sample_rate = sample_rate;
-                } else
-                    for (uint32_t i = 1; i <= adhp->exh.delay_count; i++) {
-                        uint32_t audio_frame_number = audio_sample_count - adhp->exh.delay_count + i;
-                        if (audio_frame_number > audio_sample_count)
-                            goto fail_parsing;
-                        audio_info[audio_frame_number].length = frame_length;
-                        if (audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length)
-                            constant_frame_length = 0;
-                        audio_duration += frame_length;
-                    }
-                if (audio_sample_count + 1 == audio_info_count) {
-                    audio_info_count <<= 1;
-                    audio_frame_info_t* temp = (audio_frame_info_t*)realloc(audio_info, audio_info_count * sizeof(audio_frame_info_t));
-                    if (!temp)
-                        goto fail_parsing;
-                    audio_info = temp;
+            if (ctx->video_sample_count + 1 == ctx->video_info_count) {
+                ctx->video_info_count <<= 1;
+                video_frame_info_t* temp
+                    = (video_frame_info_t*)realloc(ctx->video_info, ctx->video_info_count * sizeof(video_frame_info_t));
+                if (!temp)
+                    return -1;
+                ctx->video_info = temp;
+            }
+        }
+    } else if (codec_type == AVMEDIA_TYPE_AUDIO) {
+        if (stream_index == adhp->stream_index) {
+            uint64_t layout = ctx->stream_info[stream_index].layout;
+            int channels = ctx->stream_info[stream_index].channels;
+            int sample_rate = ctx->stream_info[stream_index].sample_rate;
+            char* sample_fmt = ctx->stream_info[stream_index].fmt;
+            int bits_per_sample = ctx->stream_info[stream_index].bits_per_sample;
+            int frame_length = entry->data.type1.length;
+            if (adhp->codec_id == AV_CODEC_ID_NONE)
+                adhp->codec_id = (enum AVCodecID)codec_id;
+            if ((channels | layout | sample_rate | bits_per_sample) && entry->edi != -1 && ctx->audio_duration <= INT32_MAX) {
+                if (ctx->audio_sample_rate == 0)
+                    ctx->audio_sample_rate = sample_rate;
+                if (adhp->time_base.num == 0 || adhp->time_base.den == 0) {
+                    adhp->time_base.num = time_base.num;
+                    adhp->time_base.den = time_base.den;
                 }
-                if (frame_length == -1)
-                    ++adhp->exh.delay_count;
-                else if (audio_sample_count > adhp->exh.delay_count) {
-                    uint32_t audio_frame_number = audio_sample_count - adhp->exh.delay_count;
-                    audio_info[audio_frame_number].length = frame_length;
-                    if (audio_frame_number > 1 && audio_info[audio_frame_number].length != audio_info[audio_frame_number - 1].length)
-                        constant_frame_length = 0;
-                    audio_duration += frame_length;
+                if (channels > aohp->output_channel_layout.nb_channels)
+                    av_channel_layout_from_mask(&aohp->output_channel_layout, layout);
+                aohp->output_sample_format = select_better_sample_format(aohp->output_sample_format, av_get_sample_fmt(sample_fmt));
+                aohp->output_sample_rate = MAX(aohp->output_sample_rate, ctx->audio_sample_rate);
+                aohp->output_bits_per_sample = MAX(aohp->output_bits_per_sample, bits_per_sample);
+                ++ctx->audio_sample_count;
+                audio_frame_info_t* info = &ctx->audio_info[ctx->audio_sample_count];
+                memset(info, 0, sizeof(audio_frame_info_t));
+                info->pts = entry->pts;
+                info->dts = entry->dts;
+                info->file_offset = entry->pos;
+                info->sample_number = ctx->audio_sample_count;
+                info->extradata_index = entry->edi;
+                info->sample_rate = sample_rate;
+            } else
+                for (uint32_t i = 1; i <= adhp->exh.delay_count; i++) {
+                    uint32_t audio_frame_number = ctx->audio_sample_count - adhp->exh.delay_count + i;
+                    if (audio_frame_number > ctx->audio_sample_count)
+                        return -1;
+                    ctx->audio_info[audio_frame_number].length = frame_length;
+                    if (audio_frame_number > 1
+                        && ctx->audio_info[audio_frame_number].length != ctx->audio_info[audio_frame_number - 1].length)
+                        ctx->constant_frame_length = 0;
+                    ctx->audio_duration += frame_length;
                 }
+            if (ctx->audio_sample_count + 1 == ctx->audio_info_count) {
+                ctx->audio_info_count <<= 1;
+                audio_frame_info_t* temp
+                    = (audio_frame_info_t*)realloc(ctx->audio_info, ctx->audio_info_count * sizeof(audio_frame_info_t));
+                if (!temp)
+                    return -1;
+                ctx->audio_info = temp;
+            }
+            if (frame_length == -1)
+                ++adhp->exh.delay_count;
+            else if (ctx->audio_sample_count > adhp->exh.delay_count) {
+                uint32_t audio_frame_number = ctx->audio_sample_count - adhp->exh.delay_count;
+                ctx->audio_info[audio_frame_number].length = frame_length;
+                if (audio_frame_number > 1 && ctx->audio_info[audio_frame_number].length != ctx->audio_info[audio_frame_number - 1].length)
+                    ctx->constant_frame_length = 0;
+                ctx->audio_duration += frame_length;
             }
         }
     }
+    return 0;
+}
+
+/* Select the stream sections that parse_index_entry() stores into the frame lists. */
+static int select_index_stream(void* opaque, const lwindex_data_t* data, int stream_index)
+{
+    lwindex_parse_context_t* ctx = (lwindex_parse_context_t*)opaque;
+    if (!ctx->header_verified && verify_index_header(ctx, data) < 0)
+        return -1;
+    if (stream_index == ctx->vdhp->stream_index || stream_index == ctx->adhp->stream_index)
+        return 1;
+    /* A DV video stream may turn out to be the audio source. */
+    for (int i = 0; i < data->num_streams; i++)
+        if (data->stream_info[i].stream_index == stream_index)
+            return data->stream_info[i].codec_type == AVMEDIA_TYPE_VIDEO && data->stream_info[i].codec == AV_CODEC_ID_DVVIDEO
+                && ctx->adhp->dv_in_avi == -1 && !ctx->opt->force_audio;
+    return 0;
+}
+
+static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp,
+    lwlibav_audio_decode_handler_t* adhp, lwlibav_audio_output_handler_t* aohp, lwlibav_option_t* opt, lwindex_parse_context_t* ctx,
+    lwindex_data_t* data, FILE* index)
+{
+    if (!ctx->header_verified && verify_index_header(ctx, data) < 0) {
+        free(ctx->video_info);
+        free(ctx->audio_info);
+        free(ctx->stream_info);
+        return -1;
+    }
+    lwindex_stream_info_t* stream_info = ctx->stream_info;
+    video_frame_info_t* video_info = ctx->video_info;
+    audio_frame_info_t* audio_info = ctx->audio_info;
+    int video_present = ctx->video_present;
+    int audio_present = ctx->audio_present;
+    uint32_t video_sample_count = ctx->video_sample_count;
+    uint32_t invisible_count = ctx->invisible_count;
+    uint32_t audio_sample_count = ctx->audio_sample_count;
+    int audio_sample_rate = ctx->audio_sample_rate;
+    int constant_frame_length = ctx->constant_frame_length;
+    uint64_t audio_duration = ctx->audio_duration;
     if (video_present && opt->force_video && opt->force_video_index != -1
         && (video_sample_count == 0 || vdhp->initial_pix_fmt == AV_PIX_FMT_NONE || vdhp->initial_width == 0 || vdhp->initial_height == 0))
         goto fail_parsing; /* Need to re-create the index file. */
     if (audio_present && opt->force_audio && opt->force_audio_index != -1 && (audio_sample_count == 0 || audio_duration == 0))
         goto fail_parsing; /* Need to re-create the index file. */
     /* Parse stream durations. */
+    for (int i = 0; i < data->num_streams; i++)
+        if (data->stream_info[i].codec_type == AVMEDIA_TYPE_VIDEO && data->stream_info[i].stream_index == ctx->duration_stream_index)
+            vdhp->stream_duration = data->stream_info[i].stream_duration;
 
     /* Parse AVIndexEntry. */
     for (int i = 0; i < data->num_streams; i++) {
@@ -2775,15 +3137,9 @@ static int parse_index_real(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
             }
         }
     }
-#ifdef _WIN32
-    lw_free(wname);
-#endif // _WIN32
     free(stream_info);
     return 0;
 fail_parsing:
-#ifdef _WIN32
-    lw_free(wname);
-#endif // _WIN32
     vdhp->frame_list = NULL;
     adhp->frame_list = NULL;
     if (video_info)
@@ -2798,15 +3154,60 @@ static int parse_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handle
     lwlibav_audio_decode_handler_t* adhp, lwlibav_audio_output_handler_t* aohp, lwlibav_option_t* opt, FILE* index)
 {
     rewind(index);
-    lwindex_data_t* data = lwindex_parse(index, (opt->force_audio_index == -2) || opt->av_sync, opt->force_audio_index != -2);
+    lwindex_parse_context_t ctx = { 0 };
+    ctx.lwhp = lwhp;
+    ctx.vdhp = vdhp;
+    ctx.adhp = adhp;
+    ctx.aohp = aohp;
+    ctx.opt = opt;
+    /* Index entries are streamed into the frame lists without being stored in lwindex_data_t. */
+    lwindex_data_t* data = lwindex_parse_with_handler(index, (opt->force_audio_index == -2) || opt->av_sync, opt->force_audio_index != -2,
+        parse_index_entry, select_index_stream, &ctx);
     if (!data) {
+        free(ctx.video_info);
+        free(ctx.audio_info);
+        free(ctx.stream_info);
         return -1;
     }
-    int ret = parse_index_real(lwhp, vdhp, vohp, adhp, aohp, opt, data, index);
+    int ret = parse_index_real(lwhp, vdhp, vohp, adhp, aohp, opt, &ctx, data, index);
     lwindex_free(data);
     return ret;
 }
 
+static void discard_parsed_stream(lwlibav_decode_handler_t* dhp)
+{
+    av_freep(&dhp->index_entries);
+    dhp->index_entries_count = 0;
+    for (int i = 0; i < dhp->exh.entry_count; i++)
+        av_freep(&dhp->exh.entries[i].extradata);
+    lw_freep(&dhp->exh.entries);
+    dhp->exh.entry_count = 0;
+}
+
+/* Free what a failed parse of an index file may have left in the handlers, so that the index file can be parsed again. */
+static void discard_parsed_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp, lwlibav_audio_decode_handler_t* adhp)
+{
+    lw_freep(&lwhp->file_path);
+    lw_freep(&lwhp->format_name);
+    lw_freep(&vdhp->keyframe_list);
+    discard_parsed_stream((lwlibav_decode_handler_t*)vdhp);
+    discard_parsed_stream((lwlibav_decode_handler_t*)adhp);
+}
+
+/* Open and parse the index file at path.
+ * found is set if the file exists, in which case the handlers may have been partially set up even on failure. */
+static int try_index_file(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp,
+    lwlibav_audio_decode_handler_t* adhp, lwlibav_audio_output_handler_t* aohp, lwlibav_option_t* opt, const char* path, int* found)
+{
+    FILE* index = lw_fopen(path, (opt->force_video || opt->force_audio) ? "r+b" : "rb");
+    if (!index)
+        return -1;
+    *found = 1;
+    int ret = parse_index(lwhp, vdhp, vohp, adhp, aohp, opt, index);
+    fclose(index);
+    return ret;
+}
+
 int lwlibav_construct_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp,
     lwlibav_audio_decode_handler_t* adhp, lwlibav_audio_output_handler_t* aohp, lw_log_handler_t* lhp, lwlibav_option_t* opt,
     progress_indicator_t* indicator, progress_handler_t* php)
@@ -2815,26 +3216,46 @@ int lwlibav_construct_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
     size_t file_path_length = strlen(opt->file_path);
     const char* ext = file_path_length >= 5 ? &opt->file_path[file_path_length - 4] : NULL;
     int has_lwi_ext = ext && !strncmp(ext, ".lwi", strlen(".lwi"));
-    FILE* index;
-    if (has_lwi_ext)
-        index = lw_fopen(opt->file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb");
-    else if (opt->index_file_path)
-        index = lw_fopen(opt->index_file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb");
-    else {
-        char* index_file_path = create_lwi_path(opt);
-        if (!index_file_path)
+    char* lwi_path = NULL;
+    uint64_t fingerprint = 0;
+    if (!opt->index_file_path) {
+        lwi_path = create_lwi_path(opt, &fingerprint);
+        if (!lwi_path)
             return -1;
-        index = lw_fopen(index_file_path, (opt->force_video || opt->force_audio) ? "r+b" : "rb");
-        free(index_file_path);
     }
-    if (index) {
-        if (parse_index(lwhp, vdhp, vohp, adhp, aohp, opt, index) == 0) {
-            /* Opening and parsing the index file succeeded. */
-            fclose(index);
-            lwhp->threads = opt->threads;
-            return 0;
-        }
-        fclose(index);
+    const char* index_path = opt->index_file_path ? opt->index_file_path : lwi_path;
+    const char* read_path = has_lwi_ext ? opt->file_path : index_path;
+    lw_file_lock_t* lock = NULL;
+    int index_found = 0;
+    int64_t index_size = -1;
+    int64_t index_mtime = -1;
+    get_file_stat(read_path, &index_size, &index_mtime);
+    int ret = try_index_file(lwhp, vdhp, vohp, adhp, aohp, opt, read_path, &index_found);
+    if (ret != 0 && !opt->no_create_index) {
+        /* Index files may be shared between threads, processes and hosts.
+         * Only one of them creates a missing or stale index while the others wait for it instead of duplicating the work. */
+        char* lock_path = (char*)lw_malloc_zero(strlen(index_path) + 6);
+        if (lock_path) {
+            sprintf(lock_path, "%s.lock", index_path);
+            lock = lw_lock_file(lock_path);
+            lw_free(lock_path);
+        }
+        /* Parse the index again if it was written while waiting. */
+        int64_t size = -1;
+        int64_t mtime = -1;
+        get_file_stat(read_path, &size, &mtime);
+        if (size != -1 && (size != index_size || mtime != index_mtime)) {
+            if (index_found)
+                discard_parsed_index(lwhp, vdhp, adhp);
+            ret = try_index_file(lwhp, vdhp, vohp, adhp, aohp, opt, read_path, &index_found);
+        }
+    }
+    if (ret == 0) {
+        /* Opening and parsing the index file succeeded. */
+        lw_unlock_file(lock);
+        lw_free(lwi_path);
+        lwhp->threads = opt->threads;
+        return lwlibav_video_build_frame_table(vdhp);
     }
     /* Open file. */
     if (!lwhp->file_path) {
@@ -2846,7 +3267,7 @@ int lwlibav_construct_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
             lwhp->file_path[file_path_length - 4] = '\0';
     }
     AVFormatContext* format_ctx = NULL;
-    if (lavf_open_file(&format_ctx, lwhp->file_path, lhp)) {
+    if (lavf_open_file(&format_ctx, lwhp->file_path, LW_FILE_ACCESS_SEQUENTIAL, lhp)) {
         if (format_ctx)
             lavf_close_file(&format_ctx);
         goto fail;
@@ -2855,14 +3276,21 @@ int lwlibav_construct_index(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_h
     vdhp->stream_index = -1;
     adhp->stream_index = opt->force_audio_index;
     /* Create the index file. */
-    int err = create_index(lwhp, vdhp, vohp, adhp, aohp, format_ctx, opt, indicator, php);
+    int err = create_index(
+        lwhp, vdhp, vohp, adhp, aohp, format_ctx, opt, indicator, php, opt->no_create_index ? NULL : index_path, fingerprint);
+    lw_unlock_file(lock);
+    lw_free(lwi_path);
     /* Close file.
      * By opening file for video and audio separately, indecent work about frame reading can be avoidable. */
     lavf_close_file(&format_ctx);
     vdhp->ctx = NULL;
     adhp->ctx = NULL;
+    if (err == 0)
+        err = lwlibav_video_build_frame_table(vdhp);
     return err;
 fail:
+    lw_unlock_file(lock);
+    lw_free(lwi_path);
     if (lwhp->file_path)
         lw_freep(&lwhp->file_path);
     return -1;
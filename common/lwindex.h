@@ -45,7 +45,14 @@ extern "C" {
 /* index file version
  * This version is bumped when its structure changed so that the lwindex invokes
  * reindexing opened file immediately. */
-#define LWINDEX_INDEX_FILE_VERSION 19
+#define LWINDEX_INDEX_FILE_VERSION 20
+
+/* How the index is matched against the source file when it is opened. */
+enum {
+    LWINDEX_VERIFY_MTIME = 0, /* Hash the source file only if its modification time differs from the index. */
+    LWINDEX_VERIFY_ALWAYS = 1, /* Hash the source file even if its size and modification time match. */
+    LWINDEX_VERIFY_NEVER = 2, /* Never hash the source file; its size and modification time must match. */
+};
 
 typedef struct {
     const char* file_path;
@@ -66,6 +73,8 @@ typedef struct {
         uint32_t fps_den;
     } vfr2cfr;
     int rap_verification;
+    int compress_index; /* Store a newly created index file as the zlib-compressed container. */
+    int verify_policy; /* LWINDEX_VERIFY_* */
 } lwlibav_option_t;
 
 #ifdef __cplusplus
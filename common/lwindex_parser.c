@@ -20,23 +20,204 @@
 
 /* This file is available under an ISC license. */
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+#include <libavutil/cpu.h>
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#include <zlib.h>
+
 #include "lwindex_parser.h"
 #include "lwindex_sscanf_unrolled.h"
-
-#define BUFFER_SIZE (1 << 14) // 16KB
+#include "osdep.h"
+
+/* MSVC does not define __SSE2__, but SSE2 is always available on x64 and with /arch:SSE2 on x86. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LWINDEX_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(LWINDEX_SSE2)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define BUFFER_SIZE (1 << 20) // 1MB, large enough that a whole index of a typical clip needs only a few reads
+#if BUFFER_SIZE < LWINDEX_COMPRESSED_BLOCK_SIZE
+#error "The read buffer must hold a whole block of a compressed index."
+#endif
+
+/* The packet lines of <LibavReaderIndex> are buffered in windows of this size and each window is split into chunks
+ * that are parsed concurrently. */
+#define FRAME_SECTION_WINDOW_SIZE (1 << 26) // 64MB
+#define FRAME_SECTION_WINDOW_MIN_SIZE (1 << 20) // The window grows from this size only as far as the sections need.
+#define FRAME_SECTION_CHUNK_MIN_SIZE (1 << 20) // Smaller windows are parsed by the calling thread alone.
+#define FRAME_SECTION_MAX_THREADS 16
+#define FRAME_SECTION_PADDING 64 // Slack for the vector loads in the unrolled sscanf helpers.
 
 typedef struct {
     char* buffer;
     size_t size;
     size_t current_pos;
     FILE* file;
-    int64_t file_offset_of_buffer_start;
+    int64_t file_offset_of_buffer_start; // -1 if the buffer holds a decompressed block
+    int compressed;
+    char* packed; // compressed data of the current block
 } BufferedFile;
 
-static BufferedFile global_buffered_file = { NULL, 0, 0, NULL };
+static BufferedFile global_buffered_file = { NULL, 0, 0, NULL, 0, 0, NULL };
+
+/* The window of parse_frame_section(), shared by all the frame sections of an index. */
+static char* frame_window = NULL;
+static size_t frame_window_size = 0;
 
 static int stream_mapping[MAX_STREAM_ID];
 
+/* Return the index of the lowest set bit of a non-zero mask. */
+static inline int lowest_set_bit(uint64_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanForward64(&index, mask);
+#else
+    if (!_BitScanForward(&index, (unsigned long)mask)) {
+        _BitScanForward(&index, (unsigned long)(mask >> 32));
+        index += 32;
+    }
+#endif
+    return (int)index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+/* Return the first '\n' in [p, end), or NULL if there is none.
+ * Index files are dominated by short packet lines, so scan a vector at a time where the target allows it. */
+static inline const char* find_newline(const char* p, const char* end)
+{
+#if defined(__AVX2__)
+    const __m256i nl32 = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), nl32));
+        if (mask)
+            return p + lowest_set_bit(mask);
+    }
+#endif
+#if defined(__AVX2__) || defined(LWINDEX_SSE2)
+    const __m128i nl16 = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl16));
+        if (mask)
+            return p + lowest_set_bit(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t nl16 = vdupq_n_u8('\n');
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t*)p), nl16);
+        /* Narrow each byte to a nibble so that the comparison result fits in 64 bits. */
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask)
+            return p + (lowest_set_bit(mask) >> 2);
+    }
+#endif
+    return (const char*)memchr(p, '\n', end - p);
+}
+
+static void buffer_clear()
+{
+    if (global_buffered_file.buffer != NULL) {
+        free(global_buffered_file.buffer);
+    }
+    if (global_buffered_file.packed != NULL) {
+        free(global_buffered_file.packed);
+    }
+    global_buffered_file.buffer = NULL;
+    global_buffered_file.size = 0;
+    global_buffered_file.current_pos = 0;
+    global_buffered_file.file = NULL;
+    global_buffered_file.file_offset_of_buffer_start = -1;
+    global_buffered_file.compressed = 0;
+    global_buffered_file.packed = NULL;
+    free(frame_window);
+    frame_window = NULL;
+    frame_window_size = 0;
+}
+
+static uint32_t read_le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Read the next chunk of the index into the buffer and return its size, or 0 at the end of the file or on error.
+ * With a compressed container, a chunk is a whole block, and its file offset is known only if the block is stored as is. */
+static size_t buffered_refill(FILE* stream)
+{
+    if (global_buffered_file.buffer == NULL) {
+        global_buffered_file.buffer = (char*)malloc(BUFFER_SIZE);
+        if (global_buffered_file.buffer == NULL) {
+            perror("malloc failed");
+            return 0;
+        }
+    }
+
+    int64_t current_read_start_offset = lw_ftell(stream);
+    if (current_read_start_offset == -1L && !global_buffered_file.compressed) {
+        current_read_start_offset = global_buffered_file.file_offset_of_buffer_start + global_buffered_file.current_pos;
+    }
+    global_buffered_file.size = 0;
+    global_buffered_file.current_pos = 0;
+
+    if (!global_buffered_file.compressed) {
+        global_buffered_file.file_offset_of_buffer_start = current_read_start_offset;
+        global_buffered_file.size = fread(global_buffered_file.buffer, 1, BUFFER_SIZE, stream);
+        return global_buffered_file.size;
+    }
+
+    uint8_t block_header[8];
+    if (fread(block_header, 1, sizeof(block_header), stream) != sizeof(block_header)) {
+        return 0;
+    }
+    uint32_t raw_size = read_le32(block_header);
+    uint32_t stored_size = read_le32(block_header + 4);
+    if (raw_size == 0 || raw_size > LWINDEX_COMPRESSED_BLOCK_SIZE || stored_size > raw_size) {
+        fprintf(stderr, "Invalid block in compressed index.\n");
+        return 0;
+    }
+    if (stored_size == raw_size) {
+        global_buffered_file.file_offset_of_buffer_start
+            = current_read_start_offset != -1L ? current_read_start_offset + (int64_t)sizeof(block_header) : -1;
+        if (fread(global_buffered_file.buffer, 1, raw_size, stream) != raw_size) {
+            return 0;
+        }
+    } else {
+        global_buffered_file.file_offset_of_buffer_start = -1;
+        if (global_buffered_file.packed == NULL) {
+            global_buffered_file.packed = (char*)malloc(LWINDEX_COMPRESSED_BLOCK_SIZE);
+            if (global_buffered_file.packed == NULL) {
+                perror("malloc failed");
+                return 0;
+            }
+        }
+        uLongf decompressed_size = raw_size;
+        if (fread(global_buffered_file.packed, 1, stored_size, stream) != stored_size
+            || uncompress((Bytef*)global_buffered_file.buffer, &decompressed_size, (const Bytef*)global_buffered_file.packed, stored_size)
+                != Z_OK
+            || decompressed_size != raw_size) {
+            fprintf(stderr, "Failed to decompress index block.\n");
+            return 0;
+        }
+    }
+    global_buffered_file.size = raw_size;
+    return raw_size;
+}
+
 static char* buffered_fgets(char* str, int n, FILE* stream)
 {
     if (str == NULL || n <= 0 || stream == NULL) {
@@ -45,42 +226,19 @@ static char* buffered_fgets(char* str, int n, FILE* stream)
 
     if (global_buffered_file.file != stream) {
         // New file, initialize/reset the buffer
-        if (global_buffered_file.buffer != NULL) {
-            free(global_buffered_file.buffer);
-        }
-        global_buffered_file.buffer = NULL;
-        global_buffered_file.size = 0;
-        global_buffered_file.current_pos = 0;
+        buffer_clear();
         global_buffered_file.file = stream;
-        global_buffered_file.file_offset_of_buffer_start = ftell(stream);
+        global_buffered_file.file_offset_of_buffer_start = lw_ftell(stream);
         if (global_buffered_file.file_offset_of_buffer_start == -1L) {
             global_buffered_file.file_offset_of_buffer_start = 0;
         }
     }
 
     int i = 0;
-    int64_t current_read_start_offset = -1;
     while (i < n - 1) { // Leave space for null terminator
         if (global_buffered_file.current_pos >= global_buffered_file.size) {
             // Buffer empty, need to read more data
-            if (global_buffered_file.buffer == NULL) {
-                global_buffered_file.buffer = (char*)malloc(BUFFER_SIZE);
-                if (global_buffered_file.buffer == NULL) {
-                    perror("malloc failed");
-                    return NULL; // Or handle the error differently
-                }
-            }
-
-            current_read_start_offset = ftell(stream);
-            if (current_read_start_offset == -1L) {
-                current_read_start_offset = global_buffered_file.file_offset_of_buffer_start + global_buffered_file.current_pos;
-            }
-            global_buffered_file.file_offset_of_buffer_start = current_read_start_offset;
-
-            global_buffered_file.size = fread(global_buffered_file.buffer, 1, BUFFER_SIZE, stream);
-            global_buffered_file.current_pos = 0;
-
-            if (global_buffered_file.size == 0) {
+            if (buffered_refill(stream) == 0) {
                 // End of file or error
                 if (i == 0) {
                     // No characters read before EOF
@@ -93,11 +251,19 @@ static char* buffered_fgets(char* str, int n, FILE* stream)
             }
         }
 
-        str[i] = global_buffered_file.buffer[global_buffered_file.current_pos];
-        global_buffered_file.current_pos++;
-        i++;
-
-        if (str[i - 1] == '\n') {
+        // Copy up to the next newline in one go instead of byte by byte.
+        const char* start = global_buffered_file.buffer + global_buffered_file.current_pos;
+        size_t length = global_buffered_file.size - global_buffered_file.current_pos;
+        if (length > (size_t)(n - 1 - i))
+            length = n - 1 - i;
+        const char* newline = find_newline(start, start + length);
+        if (newline)
+            length = newline - start + 1;
+        memcpy(str + i, start, length);
+        global_buffered_file.current_pos += length;
+        i += (int)length;
+
+        if (newline) {
             // Line end found
             str[i] = '\0';
             return str;
@@ -117,14 +283,9 @@ static size_t buffered_fread(void* ptr, size_t length, FILE* stream)
 
     if (global_buffered_file.file != stream) {
         // New file, initialize/reset the buffer
-        if (global_buffered_file.buffer != NULL) {
-            free(global_buffered_file.buffer);
-        }
-        global_buffered_file.buffer = NULL;
-        global_buffered_file.size = 0;
-        global_buffered_file.current_pos = 0;
+        buffer_clear();
         global_buffered_file.file = stream;
-        global_buffered_file.file_offset_of_buffer_start = ftell(stream);
+        global_buffered_file.file_offset_of_buffer_start = lw_ftell(stream);
         if (global_buffered_file.file_offset_of_buffer_start == -1L) {
             global_buffered_file.file_offset_of_buffer_start = 0;
         }
@@ -132,29 +293,11 @@ static size_t buffered_fread(void* ptr, size_t length, FILE* stream)
 
     size_t bytes_read = 0;
     char* dest = (char*)ptr;
-    int64_t current_read_start_offset = -1;
 
     while (bytes_read < length) {
         if (global_buffered_file.current_pos >= global_buffered_file.size) {
             // Buffer empty, need to read more data
-            if (global_buffered_file.buffer == NULL) {
-                global_buffered_file.buffer = (char*)malloc(BUFFER_SIZE);
-                if (global_buffered_file.buffer == NULL) {
-                    perror("malloc failed");
-                    return bytes_read; // Or handle the error differently
-                }
-            }
-
-            current_read_start_offset = ftell(stream);
-            if (current_read_start_offset == -1L) {
-                current_read_start_offset = global_buffered_file.file_offset_of_buffer_start + global_buffered_file.current_pos;
-            }
-            global_buffered_file.file_offset_of_buffer_start = current_read_start_offset;
-
-            global_buffered_file.size = fread(global_buffered_file.buffer, 1, BUFFER_SIZE, stream);
-            global_buffered_file.current_pos = 0;
-
-            if (global_buffered_file.size == 0) {
+            if (buffered_refill(stream) == 0) {
                 // End of file or error
                 return bytes_read;
             }
@@ -172,16 +315,105 @@ static size_t buffered_fread(void* ptr, size_t length, FILE* stream)
     return bytes_read;
 }
 
-static void buffer_clear()
+/* Discard the next length bytes of the index.
+ * Beyond the buffered data, a plain index is sought instead of being read.  Return 0 on success and -1 on error. */
+static int buffered_skip(FILE* stream, int64_t length)
 {
-    if (global_buffered_file.buffer != NULL) {
-        free(global_buffered_file.buffer);
+    while (length > 0) {
+        size_t remaining_in_buffer = global_buffered_file.size - global_buffered_file.current_pos;
+        if ((int64_t)remaining_in_buffer >= length) {
+            global_buffered_file.current_pos += (size_t)length;
+            return 0;
+        }
+        length -= remaining_in_buffer;
+        global_buffered_file.current_pos = global_buffered_file.size;
+        if (!global_buffered_file.compressed && global_buffered_file.file_offset_of_buffer_start != -1) {
+            int64_t target = global_buffered_file.file_offset_of_buffer_start + global_buffered_file.size + length;
+            if (lw_fseek(stream, target, SEEK_SET) != 0)
+                return -1;
+            global_buffered_file.file_offset_of_buffer_start = target;
+            global_buffered_file.size = 0;
+            global_buffered_file.current_pos = 0;
+            return 0;
+        }
+        if (buffered_refill(stream) == 0)
+            return -1;
     }
-    global_buffered_file.buffer = NULL;
-    global_buffered_file.size = 0;
-    global_buffered_file.current_pos = 0;
-    global_buffered_file.file = NULL;
-    global_buffered_file.file_offset_of_buffer_start = -1;
+    return 0;
+}
+
+enum index_tag {
+    INDEX_TAG_UNKNOWN = 0,
+    INDEX_TAG_LSMASH_WORKS_INDEX_VERSION,
+    INDEX_TAG_LIBAV_READER_INDEX_FILE,
+    INDEX_TAG_INPUT_FILE_PATH,
+    INDEX_TAG_FILE_SIZE,
+    INDEX_TAG_FILE_LAST_MODIFICATION_TIME,
+    INDEX_TAG_FILE_HASH,
+    INDEX_TAG_FILE_FINGERPRINT,
+    INDEX_TAG_LIBAV_READER_INDEX,
+    INDEX_TAG_ACTIVE_VIDEO_STREAM_INDEX,
+    INDEX_TAG_ACTIVE_AUDIO_STREAM_INDEX,
+    INDEX_TAG_DEFAULT_AUDIO_STREAM_INDEX,
+    INDEX_TAG_FILL_AUDIO_GAPS,
+    INDEX_TAG_PACKET_COUNT,
+    INDEX_TAG_STREAM_INFO,
+    INDEX_TAG_VIDEO_CONSISTENT_FIELD_REPEAT_PICT,
+    INDEX_TAG_STREAM_DURATION,
+    INDEX_TAG_STREAM_INDEX_ENTRIES,
+    INDEX_TAG_STREAM_SECTIONS,
+    INDEX_TAG_EXTRA_DATA_LIST,
+};
+
+/* Map a tag name to its enum so that the parser dispatches with one switch instead of a chain of string compares. */
+static enum index_tag lookup_tag(const char* tag)
+{
+#define CHECK_TAG(name, value)  \
+    if (strcmp(tag, name) == 0) \
+        return value;
+    switch (tag[0]) {
+    case 'A':
+        CHECK_TAG("ActiveVideoStreamIndex", INDEX_TAG_ACTIVE_VIDEO_STREAM_INDEX)
+        CHECK_TAG("ActiveAudioStreamIndex", INDEX_TAG_ACTIVE_AUDIO_STREAM_INDEX)
+        break;
+    case 'D':
+        CHECK_TAG("DefaultAudioStreamIndex", INDEX_TAG_DEFAULT_AUDIO_STREAM_INDEX)
+        break;
+    case 'E':
+        CHECK_TAG("ExtraDataList", INDEX_TAG_EXTRA_DATA_LIST)
+        break;
+    case 'F':
+        CHECK_TAG("FileSize", INDEX_TAG_FILE_SIZE)
+        CHECK_TAG("FileLastModificationTime", INDEX_TAG_FILE_LAST_MODIFICATION_TIME)
+        CHECK_TAG("FileHash", INDEX_TAG_FILE_HASH)
+        CHECK_TAG("FileFingerprint", INDEX_TAG_FILE_FINGERPRINT)
+        CHECK_TAG("FillAudioGaps", INDEX_TAG_FILL_AUDIO_GAPS)
+        break;
+    case 'I':
+        CHECK_TAG("InputFilePath", INDEX_TAG_INPUT_FILE_PATH)
+        break;
+    case 'L':
+        CHECK_TAG("LSMASHWorksIndexVersion", INDEX_TAG_LSMASH_WORKS_INDEX_VERSION)
+        CHECK_TAG("LibavReaderIndexFile", INDEX_TAG_LIBAV_READER_INDEX_FILE)
+        CHECK_TAG("LibavReaderIndex", INDEX_TAG_LIBAV_READER_INDEX)
+        break;
+    case 'P':
+        CHECK_TAG("PacketCount", INDEX_TAG_PACKET_COUNT)
+        break;
+    case 'S':
+        CHECK_TAG("StreamInfo", INDEX_TAG_STREAM_INFO)
+        CHECK_TAG("StreamDuration", INDEX_TAG_STREAM_DURATION)
+        CHECK_TAG("StreamIndexEntries", INDEX_TAG_STREAM_INDEX_ENTRIES)
+        CHECK_TAG("StreamSections", INDEX_TAG_STREAM_SECTIONS)
+        break;
+    case 'V':
+        CHECK_TAG("VideoConsistentFieldRepeatPict", INDEX_TAG_VIDEO_CONSISTENT_FIELD_REPEAT_PICT)
+        break;
+    default:
+        break;
+    }
+#undef CHECK_TAG
+    return INDEX_TAG_UNKNOWN;
 }
 
 static int read_tag(char* buffer, char* tag, char* attribute, char* content)
@@ -315,7 +547,348 @@ static size_t calculate_new_size(size_t current_size)
     }
 }
 
+/* Parse an "Index=..." line and the "Key=..." or "Length=..." line following it.
+ * Return 1 if the entry was stored, 0 if it belongs to an excluded stream type and -1 on error. */
+static int parse_index_record(
+    const lwindex_data_t* data, const char* line, const char* next_line, int include_video, int include_audio, index_entry_t* index_entry)
+{
+    memset(index_entry, 0, sizeof(index_entry_t));
+
+    int32_t stream_index, extradata_index;
+    if (sscanf_unrolled_main_index(line, &stream_index, &index_entry->pos, &index_entry->pts, &index_entry->dts, &extradata_index) != 5) {
+        fprintf(stderr, "Failed to parse index entry.\n");
+        return -1;
+    }
+    index_entry->stream_index = stream_index;
+    index_entry->edi = extradata_index;
+
+    if (index_entry->stream_index >= MAX_STREAM_ID || stream_mapping[index_entry->stream_index] == -1) {
+        fprintf(stderr, "Stream index %d not found or mapping invalid.\n", index_entry->stream_index);
+        return -1;
+    }
+
+    const int mapped_stream_index = stream_mapping[index_entry->stream_index];
+    if (data->stream_info[mapped_stream_index].codec_type == AV_STREAM_TYPE_VIDEO) {
+        if (!include_video)
+            return 0;
+        int32_t key, pict_type, poc, repeat_pict, field_info, is_superframe;
+        if (sscanf_unrolled_video_index(next_line, &key, &pict_type, &poc, &repeat_pict, &field_info, &is_superframe) != 6) {
+            fprintf(stderr, "Failed to parse video index entry.\n");
+            return -1;
+        }
+        index_entry->codec_type = AV_STREAM_TYPE_VIDEO;
+        index_entry->data.type0.key = key;
+        index_entry->data.type0.pic = pict_type;
+        index_entry->data.type0.poc = poc;
+        index_entry->data.type0.repeat = repeat_pict;
+        index_entry->data.type0.field = field_info;
+        index_entry->data.type0.super = is_superframe;
+        return 1;
+    } else if (data->stream_info[mapped_stream_index].codec_type == AV_STREAM_TYPE_AUDIO) {
+        if (!include_audio)
+            return 0;
+        int32_t frame_length;
+        if (sscanf_unrolled_audio_index(next_line, &frame_length) != 1) {
+            fprintf(stderr, "Failed to parse audio index entry.\n");
+            return -1;
+        }
+        index_entry->codec_type = AV_STREAM_TYPE_AUDIO;
+        index_entry->data.type1.length = frame_length;
+        return 1;
+    }
+
+    fprintf(stderr, "Unexpected stream type: %d\n", data->stream_info[mapped_stream_index].codec_type);
+    return -1;
+}
+
+typedef struct {
+    const lwindex_data_t* data;
+    const char* start; // first byte of the chunk, always the beginning of an "Index=" line
+    const char* end;
+    int include_video;
+    int include_audio;
+    index_entry_t* entries;
+    size_t num_entries;
+    int error;
+} frame_section_chunk_t;
+
+static void parse_frame_section_chunk(frame_section_chunk_t* chunk)
+{
+    // A record takes at least 41 bytes of text, which bounds the number of entries in the chunk.
+    size_t entries_size = (chunk->end - chunk->start) / 41 + 1;
+    chunk->entries = (index_entry_t*)malloc(entries_size * sizeof(index_entry_t));
+    if (!chunk->entries) {
+        fprintf(stderr, "Failed to allocate memory for index entries.\n");
+        chunk->error = 1;
+        return;
+    }
+
+    const char* line = chunk->start;
+    while (line < chunk->end) {
+        const char* line_end = find_newline(line, chunk->end);
+        const char* next_line_end = line_end ? find_newline(line_end + 1, chunk->end) : NULL;
+        if (!next_line_end) {
+            fprintf(stderr, "Unexpected end of file while reading index entry.\n");
+            chunk->error = 1;
+            return;
+        }
+        const int ret
+            = parse_index_record(chunk->data, line, line_end + 1, chunk->include_video, chunk->include_audio, &chunk->entries[chunk->num_entries]);
+        if (ret < 0) {
+            chunk->error = 1;
+            return;
+        }
+        chunk->num_entries += ret;
+        line = next_line_end + 1;
+    }
+}
+
+static void frame_section_worker(void* arg)
+{
+    parse_frame_section_chunk((frame_section_chunk_t*)arg);
+}
+
+/* Parse a window of whole records, splitting it across worker threads when it is large enough,
+ * and hand the entries over in file order. */
+static int parse_frame_window(const char* window, size_t length, lwindex_data_t* data, int include_video, int include_audio,
+    lwindex_entry_handler_t handler, void* opaque, size_t* index_entries_size)
+{
+    int num_chunks = (int)(length / FRAME_SECTION_CHUNK_MIN_SIZE);
+    int cpu_count = av_cpu_count();
+    if (num_chunks > cpu_count)
+        num_chunks = cpu_count;
+    if (num_chunks > FRAME_SECTION_MAX_THREADS)
+        num_chunks = FRAME_SECTION_MAX_THREADS;
+    if (num_chunks < 1)
+        num_chunks = 1;
+
+    frame_section_chunk_t chunks[FRAME_SECTION_MAX_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    const char* window_end = window + length;
+    const char* chunk_start = window;
+    for (int i = 0; i < num_chunks; i++) {
+        // Move each boundary forward to the next "Index=" line so that no record is split.
+        const char* chunk_end = window_end;
+        if (i < num_chunks - 1) {
+            const char* p = window + length / num_chunks * (i + 1);
+            if (p < chunk_start)
+                p = chunk_start;
+            while ((p = find_newline(p, window_end)) != NULL) {
+                p++;
+                if (window_end - p >= 6 && strncmp(p, "Index=", strlen("Index=")) == 0)
+                    break;
+            }
+            if (p)
+                chunk_end = p;
+        }
+        chunks[i].data = data;
+        chunks[i].start = chunk_start;
+        chunks[i].end = chunk_end;
+        chunks[i].include_video = include_video;
+        chunks[i].include_audio = include_audio;
+        chunk_start = chunk_end;
+    }
+
+    // The first chunk is parsed by the calling thread.  A chunk whose thread cannot be started is parsed here as well.
+    lw_thread_t* threads[FRAME_SECTION_MAX_THREADS] = { NULL };
+    for (int i = 1; i < num_chunks; i++)
+        threads[i] = lw_create_thread(frame_section_worker, &chunks[i]);
+    parse_frame_section_chunk(&chunks[0]);
+    for (int i = 1; i < num_chunks; i++) {
+        if (threads[i])
+            lw_join_thread(threads[i]);
+        else
+            parse_frame_section_chunk(&chunks[i]);
+    }
+
+    int ret = 0;
+    for (int i = 0; i < num_chunks && ret == 0; i++) {
+        frame_section_chunk_t* chunk = &chunks[i];
+        if (chunk->error) {
+            ret = -1;
+        } else if (handler) {
+            for (size_t j = 0; j < chunk->num_entries; j++)
+                if (handler(opaque, data, &chunk->entries[j]) < 0) {
+                    ret = -1;
+                    break;
+                }
+        } else if (chunk->num_entries) {
+            size_t required = (size_t)data->num_index_entries + chunk->num_entries;
+            if (required > INT_MAX) {
+                fprintf(stderr, "Too many index entries.\n");
+                ret = -1;
+                break;
+            }
+            if (required > *index_entries_size) {
+                size_t new_size = *index_entries_size;
+                while (new_size < required)
+                    new_size = calculate_new_size(new_size);
+                index_entry_t* tmp = (index_entry_t*)realloc(data->index_entries, new_size * sizeof(index_entry_t));
+                if (!tmp) {
+                    fprintf(stderr, "Failed to reallocate index entries.\n");
+                    ret = -1;
+                    break;
+                }
+                data->index_entries = tmp;
+                *index_entries_size = new_size;
+            }
+            memcpy(&data->index_entries[data->num_index_entries], chunk->entries, chunk->num_entries * sizeof(index_entry_t));
+            data->num_index_entries = (int)required;
+        }
+    }
+    for (int i = 0; i < num_chunks; i++)
+        free(chunks[i].entries);
+    return ret;
+}
+
+/* Make room in the window for one more line after length bytes.
+ * The window grows geometrically, and never beyond a whole record past FRAME_SECTION_WINDOW_SIZE. */
+static int reserve_frame_window(size_t length)
+{
+    size_t required = length + MAX_LINE_LENGTH + 1 + FRAME_SECTION_PADDING;
+    if (required <= frame_window_size)
+        return 0;
+    size_t new_size = frame_window_size ? frame_window_size : FRAME_SECTION_WINDOW_MIN_SIZE;
+    while (new_size < required)
+        new_size *= 2;
+    if (new_size > FRAME_SECTION_WINDOW_SIZE + 2 * MAX_LINE_LENGTH + FRAME_SECTION_PADDING)
+        new_size = FRAME_SECTION_WINDOW_SIZE + 2 * MAX_LINE_LENGTH + FRAME_SECTION_PADDING;
+    char* tmp = (char*)realloc(frame_window, new_size);
+    if (!tmp) {
+        fprintf(stderr, "Failed to allocate memory for the frame section.\n");
+        return -1;
+    }
+    frame_window = tmp;
+    frame_window_size = new_size;
+    return 0;
+}
+
+/* Parse the packet lines of <LibavReaderIndex>, starting from the "Index=" line held in line unless it is empty.
+ * With a negative budget the lines run up to the next tag, otherwise exactly budget bytes of lines are consumed.
+ * The text is gathered window by window and each window is parsed in parallel.
+ * The window is kept for the following sections and grows only as far as the sections need, so a small index or
+ * a short stream section does not cost a full FRAME_SECTION_WINDOW_SIZE.
+ * Return 1 if line holds the first line after the section, 0 at the end of the section or the file and -1 on error. */
+static int parse_frame_section(FILE* index, lwindex_data_t* data, char* line, int64_t budget, int include_video, int include_audio,
+    lwindex_entry_handler_t handler, void* opaque, size_t* index_entries_size)
+{
+    // The window has room for a whole record beyond the nominal size so that it always ends on a record boundary.
+    if (reserve_frame_window(0) < 0)
+        return -1;
+
+    const int bounded = budget >= 0;
+    size_t length = 0;
+    int need_second_line = 0;
+    if (line[0] != '\0') {
+        length = strlen(line);
+        memcpy(frame_window, line, length);
+        if (frame_window[length - 1] != '\n')
+            frame_window[length++] = '\n';
+        need_second_line = 1;
+    }
+    int ret = 0;
+    for (;;) {
+        int end_of_section = 0;
+        while (need_second_line || length < FRAME_SECTION_WINDOW_SIZE) {
+            if (bounded && budget == 0) {
+                end_of_section = 1;
+                break;
+            }
+            if (reserve_frame_window(length) < 0) {
+                ret = -1;
+                break;
+            }
+            char* dst = frame_window + length;
+            if (buffered_fgets(dst, MAX_LINE_LENGTH, index) == NULL) {
+                if (bounded) {
+                    fprintf(stderr, "Unexpected end of file while reading stream section.\n");
+                    ret = -1;
+                }
+                end_of_section = 1;
+                break;
+            }
+            if (bounded) {
+                int64_t line_length = (int64_t)strlen(dst);
+                budget = line_length < budget ? budget - line_length : 0;
+            }
+            if (need_second_line) {
+                // The line following "Index=..." always belongs to the record.  A malformed one fails in the chunk parser.
+                need_second_line = 0;
+            } else if (dst[0] == '<' && !bounded) {
+                strcpy(line, dst);
+                ret = 1;
+                end_of_section = 1;
+                break;
+            } else if (strncmp(dst, "Index=", strlen("Index=")) != 0) {
+                fprintf(stderr, "Unexpected content: %s, ignored.\n", dst);
+                continue;
+            } else
+                need_second_line = 1;
+            length += strlen(dst);
+            if (frame_window[length - 1] != '\n')
+                frame_window[length++] = '\n';
+        }
+        if (ret < 0)
+            break;
+        memset(frame_window + length, 0, FRAME_SECTION_PADDING);
+
+        if (parse_frame_window(frame_window, length, data, include_video, include_audio, handler, opaque, index_entries_size) < 0) {
+            ret = -1;
+            break;
+        }
+        length = 0;
+        if (end_of_section)
+            break;
+    }
+
+    return ret;
+}
+
+/* Parse the packet lines laid out in per-stream sections as listed in <StreamSections>.
+ * The sections of excluded stream types and of the streams rejected by the filter are skipped without being parsed,
+ * and a plain index is not even read there.  The index is left at the end of the last section. */
+static int parse_stream_sections(FILE* index, lwindex_data_t* data, char* line, int include_video, int include_audio,
+    lwindex_entry_handler_t handler, lwindex_stream_filter_t filter, void* opaque, size_t* index_entries_size)
+{
+    int64_t position = 0;
+    int64_t end = 0;
+    for (int i = 0; i < data->num_stream_sections; i++) {
+        const stream_section_entry_t* section = &data->stream_sections[i];
+        if (section->offset < end || section->size < 0) {
+            fprintf(stderr, "Invalid stream section of stream %d.\n", section->stream_index);
+            return -1;
+        }
+        end = section->offset + section->size;
+        if ((section->codec_type == AV_STREAM_TYPE_VIDEO && !include_video) || (section->codec_type == AV_STREAM_TYPE_AUDIO && !include_audio))
+            continue;
+        int wanted = filter ? filter(opaque, data, section->stream_index) : 1;
+        if (wanted < 0)
+            return -1;
+        if (!wanted)
+            continue;
+        if (buffered_skip(index, section->offset - position) < 0) {
+            fprintf(stderr, "Failed to seek to stream section of stream %d.\n", section->stream_index);
+            return -1;
+        }
+        line[0] = '\0';
+        if (parse_frame_section(index, data, line, section->size, include_video, include_audio, handler, opaque, index_entries_size) < 0)
+            return -1;
+        position = end;
+    }
+    if (buffered_skip(index, end - position) < 0) {
+        fprintf(stderr, "Failed to skip stream sections.\n");
+        return -1;
+    }
+    return 0;
+}
+
 lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
+{
+    return lwindex_parse_with_handler(index, include_video, include_audio, NULL, NULL, NULL);
+}
+
+lwindex_data_t* lwindex_parse_with_handler(FILE* index, int include_video, int include_audio, lwindex_entry_handler_t handler,
+    lwindex_stream_filter_t filter, void* opaque)
 {
     if (!index) {
         return NULL;
@@ -335,8 +908,7 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
     char* attribute = (char*)malloc(MAX_VALUE_LENGTH);
     char* content = (char*)malloc(MAX_VALUE_LENGTH);
     char* line = (char*)malloc(MAX_LINE_LENGTH);
-    char* next_line = (char*)malloc(MAX_LINE_LENGTH);
-    if (!tag || !attribute || !content || !line || !next_line)
+    if (!tag || !attribute || !content || !line)
 
     {
         fprintf(stderr, "Failed to allocate memory for internal variables");
@@ -345,15 +917,20 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
 
     memset(stream_mapping, -1, MAX_STREAM_ID * sizeof(int));
 
-    size_t index_entries_size = INIT_INDEX_ENTRIES;
-
-    // Initial allocation for index entries.  Reallocate later if needed.
-    data->index_entries = (index_entry_t*)malloc(INIT_INDEX_ENTRIES * sizeof(index_entry_t));
-    if (!data->index_entries) {
-        fprintf(stderr, "Failed to allocate memory for index_entries");
-        goto fail_parsing;
+    size_t index_entries_size = 0;
+    int line_pending = 0;
+
+    // Index entries are passed to the handler one by one if present, so there is nothing to store.
+    if (!handler) {
+        // Initial allocation for index entries.  Reallocate later if needed.
+        index_entries_size = INIT_INDEX_ENTRIES;
+        data->index_entries = (index_entry_t*)malloc(INIT_INDEX_ENTRIES * sizeof(index_entry_t));
+        if (!data->index_entries) {
+            fprintf(stderr, "Failed to allocate memory for index_entries");
+            goto fail_parsing;
+        }
+        memset(data->index_entries, 0, INIT_INDEX_ENTRIES * sizeof(index_entry_t));
     }
-    memset(data->index_entries, 0, INIT_INDEX_ENTRIES * sizeof(index_entry_t));
     data->num_index_entries = 0;
 
     data->extra_data_list = (extra_data_list_t*)malloc(MAX_EXTRA_DATA_LIST * sizeof(extra_data_list_t));
@@ -366,13 +943,24 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
 
     buffer_clear();
     global_buffered_file.file = index;
-    global_buffered_file.file_offset_of_buffer_start = ftell(index);
+    global_buffered_file.file_offset_of_buffer_start = lw_ftell(index);
     if (global_buffered_file.file_offset_of_buffer_start == -1L) {
         global_buffered_file.file_offset_of_buffer_start = 0;
     }
 
+    // A compressed container starts with its magic instead of the first tag.
+    char magic[LWINDEX_COMPRESSED_MAGIC_SIZE];
+    if (fread(magic, 1, LWINDEX_COMPRESSED_MAGIC_SIZE, index) == LWINDEX_COMPRESSED_MAGIC_SIZE
+        && memcmp(magic, LWINDEX_COMPRESSED_MAGIC, LWINDEX_COMPRESSED_MAGIC_SIZE) == 0) {
+        global_buffered_file.compressed = 1;
+    } else if (lw_fseek(index, global_buffered_file.file_offset_of_buffer_start, SEEK_SET) != 0) {
+        fprintf(stderr, "Failed to seek the index file.\n");
+        goto fail_parsing;
+    }
+
     enum index_entry_scope scope = INDEX_ENTRY_SCOPE_GLOBAL;
-    while (buffered_fgets(line, MAX_LINE_LENGTH, index) != NULL) {
+    while (line_pending || buffered_fgets(line, MAX_LINE_LENGTH, index) != NULL) {
+        line_pending = 0;
         if (strncmp(line, "</LibavReaderIndex>", strlen("</LibavReaderIndex>")) == 0) {
             // End of frame scope
             scope = INDEX_ENTRY_SCOPE_GLOBAL;
@@ -387,29 +975,48 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
             }
 
             read_tag(line, tag, attribute, content);
-            if (strcmp(tag, "LSMASHWorksIndexVersion") == 0) {
+            switch (lookup_tag(tag)) {
+            case INDEX_TAG_LSMASH_WORKS_INDEX_VERSION: {
                 strncpy(data->lsmash_works_index_version, attribute, sizeof(data->lsmash_works_index_version) - 1);
                 data->lsmash_works_index_version[sizeof(data->lsmash_works_index_version) - 1] = '\0';
-            } else if (strcmp(tag, "LibavReaderIndexFile") == 0) {
+                break;
+            }
+            case INDEX_TAG_LIBAV_READER_INDEX_FILE: {
                 data->libav_reader_index_file = atoi(attribute);
                 scope = INDEX_ENTRY_SCOPE_GLOBAL;
-            } else if (strcmp(tag, "InputFilePath") == 0) {
+                break;
+            }
+            case INDEX_TAG_INPUT_FILE_PATH: {
                 strncpy(data->input_file_path, content, sizeof(data->input_file_path) - 1);
                 data->input_file_path[sizeof(data->input_file_path) - 1] = '\0';
-            } else if (strcmp(tag, "FileSize") == 0) {
+                break;
+            }
+            case INDEX_TAG_FILE_SIZE: {
                 data->file_size = strtoull(attribute, NULL, 10);
-            } else if (strcmp(tag, "FileLastModificationTime") == 0) {
+                break;
+            }
+            case INDEX_TAG_FILE_LAST_MODIFICATION_TIME: {
                 data->file_last_modification_time = strtoll(attribute, NULL, 10);
-            } else if (strcmp(tag, "FileHash") == 0) {
+                break;
+            }
+            case INDEX_TAG_FILE_HASH: {
                 data->file_hash = strtoull(attribute, NULL, 16);
-            } else if (strcmp(tag, "LibavReaderIndex") == 0) {
+                break;
+            }
+            case INDEX_TAG_FILE_FINGERPRINT: {
+                data->file_fingerprint = strtoull(attribute, NULL, 16);
+                break;
+            }
+            case INDEX_TAG_LIBAV_READER_INDEX: {
                 if (sscanf(attribute, "0x%x,%d,%[^>]", (unsigned int*)&data->format_flags, &data->raw_demuxer, data->format_name) != 3) {
                     fprintf(stderr, "Failed to parse libav reader index.\n");
                     goto fail_parsing;
                 }
                 // Start of frame scope
                 scope = INDEX_ENTRY_SCOPE_STREAM;
-            } else if (strcmp(tag, "ActiveVideoStreamIndex") == 0) {
+                break;
+            }
+            case INDEX_TAG_ACTIVE_VIDEO_STREAM_INDEX: {
                 data->active_video_stream_index = strtol(content, NULL, 10);
                 if (current_line_start_offset != -1) {
                     char* tag_start_in_line = strstr(line, "<ActiveVideoStreamIndex>");
@@ -419,7 +1026,9 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
                 } else {
                     data->active_video_stream_index_pos = -1;
                 }
-            } else if (strcmp(tag, "ActiveAudioStreamIndex") == 0) {
+                break;
+            }
+            case INDEX_TAG_ACTIVE_AUDIO_STREAM_INDEX: {
                 data->active_audio_stream_index = strtol(content, NULL, 10);
                 if (current_line_start_offset != -1) {
                     char* tag_start_in_line = strstr(line, "<ActiveAudioStreamIndex>");
@@ -429,11 +1038,25 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
                 } else {
                     data->active_audio_stream_index_pos = -1;
                 }
-            } else if (strcmp(tag, "DefaultAudioStreamIndex") == 0) {
+                break;
+            }
+            case INDEX_TAG_DEFAULT_AUDIO_STREAM_INDEX: {
                 data->default_audio_stream_index = strtol(content, NULL, 10);
-            } else if (strcmp(tag, "FillAudioGaps") == 0) {
+                break;
+            }
+            case INDEX_TAG_FILL_AUDIO_GAPS: {
                 data->fill_audio_gaps = strtol(content, NULL, 10);
-            } else if (strcmp(tag, "StreamInfo") == 0) {
+                break;
+            }
+            case INDEX_TAG_PACKET_COUNT: {
+                int32_t video_packet_count, audio_packet_count;
+                if (sscanf(content, "%" SCNd32 ",%" SCNd32, &video_packet_count, &audio_packet_count) == 2) {
+                    data->video_packet_count = video_packet_count > 0 ? video_packet_count : 0;
+                    data->audio_packet_count = audio_packet_count > 0 ? audio_packet_count : 0;
+                }
+                break;
+            }
+            case INDEX_TAG_STREAM_INFO: {
                 if (buffered_fgets(line, MAX_LINE_LENGTH, index) == NULL) {
                     fprintf(stderr, "Unexpected end of file while reading stream info.\n");
                     goto fail_parsing;
@@ -464,9 +1087,13 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
                 }
 
                 data->num_streams++;
-            } else if (strcmp(tag, "VideoConsistentFieldRepeatPict") == 0) {
+                break;
+            }
+            case INDEX_TAG_VIDEO_CONSISTENT_FIELD_REPEAT_PICT: {
                 data->consistent_field_and_repeat = strtol(content, NULL, 10);
-            } else if (strcmp(tag, "StreamDuration") == 0) {
+                break;
+            }
+            case INDEX_TAG_STREAM_DURATION: {
                 uint8_t stream_index;
                 uint8_t codec_type;
                 int64_t stream_duration;
@@ -487,9 +1114,9 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
                     stream_info_entry_t* stream = &data->stream_info[stream_mapping[stream_index]];
                     stream->stream_duration = stream_duration;
                 }
+                break;
             }
-
-            else if (strcmp(tag, "StreamIndexEntries") == 0) {
+            case INDEX_TAG_STREAM_INDEX_ENTRIES: {
 
                 uint8_t stream_index;
                 uint8_t codec_type;
@@ -555,7 +1182,9 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
                     fprintf(stderr, "Unexpected tag while reading stream index entries.\n");
                     goto fail_parsing;
                 }
-            } else if (strcmp(tag, "ExtraDataList") == 0) {
+                break;
+            }
+            case INDEX_TAG_EXTRA_DATA_LIST: {
                 if (data->num_extra_data_list >= MAX_EXTRA_DATA_LIST) {
                     fprintf(stderr, "Too many extra data list entries.\n");
                     goto fail_parsing;
@@ -637,75 +1266,64 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
                 }
 
                 data->num_extra_data_list++;
-            } else {
-                fprintf(stderr, "Unexpected tag: %s from line %s", tag, line);
+                break;
             }
-        } else if (scope == INDEX_ENTRY_SCOPE_STREAM && strncmp(line, "Index=", strlen("Index=")) == 0) {
-            if (data->num_index_entries >= index_entries_size && index_entries_size < MAX_INDEX_ENTRIES) {
-                index_entries_size = calculate_new_size(index_entries_size);
-                index_entry_t* tmp = (index_entry_t*)realloc(data->index_entries, index_entries_size * sizeof(index_entry_t));
-                if (!tmp) {
-                    fprintf(stderr, "Failed to reallocate index entries.\n");
+            case INDEX_TAG_STREAM_SECTIONS: {
+                int section_count = atoi(attribute);
+                if (section_count < 0 || section_count > MAX_STREAM_ID || data->stream_sections) {
+                    fprintf(stderr, "Invalid stream sections.\n");
                     goto fail_parsing;
                 }
-                data->index_entries = tmp;
-            }
-
-            if (buffered_fgets(next_line, MAX_LINE_LENGTH, index) == NULL) {
-                fprintf(stderr, "Unexpected end of file while reading index entry.\n");
-                goto fail_parsing;
-            }
-
-            index_entry_t* index_entry = &data->index_entries[data->num_index_entries];
-
-            int32_t stream_index, extradata_index;
-            if (sscanf_unrolled_main_index(line, &stream_index, &index_entry->pos, &index_entry->pts, &index_entry->dts, &extradata_index)
-                != 5) {
-                fprintf(stderr, "Failed to parse index entry.\n");
-                goto fail_parsing;
-            }
-            index_entry->stream_index = stream_index;
-            index_entry->edi = extradata_index;
-
-            if (index_entry->stream_index >= MAX_STREAM_ID || stream_mapping[index_entry->stream_index] == -1) {
-                fprintf(stderr, "Stream index %d not found or mapping invalid.\n", index_entry->stream_index);
-                goto fail_parsing;
-            }
-
-            const int mapped_stream_index = stream_mapping[index_entry->stream_index];
-            if (data->stream_info[mapped_stream_index].codec_type == AV_STREAM_TYPE_VIDEO) {
-                if (include_video) {
-                    int32_t key, pict_type, poc, repeat_pict, field_info, is_superframe;
-                    if (sscanf_unrolled_video_index(next_line, &key, &pict_type, &poc, &repeat_pict, &field_info, &is_superframe) != 6) {
-                        fprintf(stderr, "Failed to parse video index entry.\n");
+                data->stream_sections = (stream_section_entry_t*)malloc((section_count + 1) * sizeof(stream_section_entry_t));
+                if (!data->stream_sections) {
+                    fprintf(stderr, "Failed to allocate memory for stream sections.\n");
+                    goto fail_parsing;
+                }
+                for (int i = 0; i < section_count; i++) {
+                    if (buffered_fgets(line, MAX_LINE_LENGTH, index) == NULL) {
+                        fprintf(stderr, "Unexpected end of file while reading stream sections.\n");
                         goto fail_parsing;
                     }
-                    data->num_index_entries++;
-                    index_entry->data.type0.key = key;
-                    index_entry->data.type0.pic = pict_type;
-                    index_entry->data.type0.poc = poc;
-                    index_entry->data.type0.repeat = repeat_pict;
-                    index_entry->data.type0.field = field_info;
-                    index_entry->data.type0.super = is_superframe;
-                }
-            } else if (data->stream_info[mapped_stream_index].codec_type == AV_STREAM_TYPE_AUDIO) {
-                if (include_audio) {
-                    int32_t frame_length;
-                    if (sscanf_unrolled_audio_index(next_line, &frame_length) != 1) {
-                        fprintf(stderr, "Failed to parse audio index entry.\n");
+                    uint32_t stream_index, codec_type, packet_count;
+                    int64_t offset, size;
+                    if (sscanf(line, "%" SCNu32 ",%" SCNu32 ",%" SCNu32 ",%" SCNd64 ",%" SCNd64, &stream_index, &codec_type, &packet_count,
+                            &offset, &size)
+                            != 5
+                        || stream_index >= MAX_STREAM_ID) {
+                        fprintf(stderr, "Failed to parse stream section.\n");
                         goto fail_parsing;
                     }
-                    data->num_index_entries++;
-                    index_entry->data.type1.length = frame_length;
+                    stream_section_entry_t* section = &data->stream_sections[i];
+                    section->stream_index = stream_index;
+                    section->codec_type = codec_type;
+                    section->packet_count = packet_count;
+                    section->offset = offset;
+                    section->size = size;
                 }
-            } else {
-                fprintf(stderr, "Unexpected stream type: %d\n", data->stream_info[mapped_stream_index].codec_type);
-                goto fail_parsing;
+                data->num_stream_sections = section_count;
+                if (buffered_fgets(line, MAX_LINE_LENGTH, index) == NULL
+                    || strncmp(line, "</StreamSections>", strlen("</StreamSections>")) != 0) {
+                    fprintf(stderr, "Unexpected tag while reading stream sections.\n");
+                    goto fail_parsing;
+                }
+                // The sections follow the table immediately.
+                if (scope == INDEX_ENTRY_SCOPE_STREAM
+                    && parse_stream_sections(
+                           index, data, line, include_video, include_audio, handler, filter, opaque, &index_entries_size)
+                        < 0)
+                    goto fail_parsing;
+                break;
             }
-
-        }
-
-        else {
+            default:
+                fprintf(stderr, "Unexpected tag: %s from line %s", tag, line);
+                break;
+            }
+        } else if (scope == INDEX_ENTRY_SCOPE_STREAM && strncmp(line, "Index=", strlen("Index=")) == 0) {
+            // The rest of the frame section is consumed at once.  Its terminating line is left in line.
+            line_pending = parse_frame_section(index, data, line, -1, include_video, include_audio, handler, opaque, &index_entries_size);
+            if (line_pending < 0)
+                goto fail_parsing;
+        } else {
             fprintf(stderr, "Unexpected content: %s, ignored.\n", line);
         }
     }
@@ -723,8 +1341,6 @@ lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio)
         free(content);
     if (line)
         free(line);
-    if (next_line)
-        free(next_line);
 
     buffer_clear();
     return data;
@@ -738,8 +1354,6 @@ fail_parsing:
         free(content);
     if (line)
         free(line);
-    if (next_line)
-        free(next_line);
 
     buffer_clear();
     lwindex_free(data);
@@ -754,6 +1368,9 @@ void lwindex_free(lwindex_data_t* data)
     if (data->index_entries)
         free(data->index_entries);
 
+    if (data->stream_sections)
+        free(data->stream_sections);
+
     if (data->stream_info) {
         for (int i = 0; i < data->num_streams; i++) {
             if (data->stream_info[i].stream_index_entries)
@@ -776,3 +1393,101 @@ void lwindex_free(lwindex_data_t* data)
     }
     free(data);
 }
+
+static int summarize_index_entry(void* opaque, const lwindex_data_t* data, const index_entry_t* entry)
+{
+    lwindex_stream_summary_t* stream = &((lwindex_stream_summary_t*)opaque)[entry->stream_index];
+    if (entry->pts != INT64_MIN) { // AV_NOPTS_VALUE
+        if (stream->min_pts == INT64_MIN || entry->pts < stream->min_pts)
+            stream->min_pts = entry->pts;
+        if (stream->max_pts == INT64_MIN || entry->pts > stream->max_pts)
+            stream->max_pts = entry->pts;
+    }
+    if (entry->codec_type == AV_STREAM_TYPE_VIDEO && entry->data.type0.key) {
+        const uint32_t count = stream->num_keyframe_packets;
+        if (count == 0 || (count >= 256 && (count & (count - 1)) == 0)) {
+            // The list is full whenever its size reaches a power of two from 256 on.
+            size_t new_size = count ? (size_t)count << 1 : 256;
+            uint32_t* tmp = (uint32_t*)realloc(stream->keyframe_packets, new_size * sizeof(uint32_t));
+            if (!tmp) {
+                fprintf(stderr, "Failed to allocate memory for keyframe packets.\n");
+                return -1;
+            }
+            stream->keyframe_packets = tmp;
+        }
+        stream->keyframe_packets[stream->num_keyframe_packets++] = stream->packet_count;
+    } else if (entry->codec_type == AV_STREAM_TYPE_AUDIO)
+        stream->sample_count += entry->data.type1.length;
+    stream->packet_count++;
+    return 0;
+}
+
+lwindex_info_t* lwindex_query_info(FILE* index)
+{
+    lwindex_info_t* info = (lwindex_info_t*)malloc(sizeof(lwindex_info_t));
+    if (!info) {
+        fprintf(stderr, "Failed to allocate memory for index info.\n");
+        return NULL;
+    }
+    memset(info, 0, sizeof(lwindex_info_t));
+    // Indexed by the stream index written in the packet lines.
+    lwindex_stream_summary_t* summaries = (lwindex_stream_summary_t*)malloc(MAX_STREAM_ID * sizeof(lwindex_stream_summary_t));
+    if (!summaries) {
+        fprintf(stderr, "Failed to allocate memory for index info.\n");
+        goto fail;
+    }
+    memset(summaries, 0, MAX_STREAM_ID * sizeof(lwindex_stream_summary_t));
+    for (int i = 0; i < MAX_STREAM_ID; i++) {
+        summaries[i].min_pts = INT64_MIN;
+        summaries[i].max_pts = INT64_MIN;
+    }
+
+    info->data = lwindex_parse_with_handler(index, 1, 1, summarize_index_entry, NULL, summaries);
+    if (!info->data)
+        goto fail;
+    lwindex_data_t* data = info->data;
+    if (data->num_streams > 0) {
+        info->streams = (lwindex_stream_summary_t*)malloc(data->num_streams * sizeof(lwindex_stream_summary_t));
+        if (!info->streams) {
+            fprintf(stderr, "Failed to allocate memory for index info.\n");
+            goto fail;
+        }
+    }
+    for (int i = 0; i < data->num_streams; i++) {
+        const stream_info_entry_t* stream_info = &data->stream_info[i];
+        lwindex_stream_summary_t* stream = &info->streams[i];
+        *stream = summaries[stream_info->stream_index];
+        summaries[stream_info->stream_index].keyframe_packets = NULL; // moved
+        stream->stream_index = stream_info->stream_index;
+        stream->codec_type = stream_info->codec_type;
+        if (stream_info->stream_duration > 0)
+            stream->duration = stream_info->stream_duration;
+        else if (stream->packet_count > 1 && stream->min_pts != INT64_MIN)
+            // The last packet lasts as long as the average one.
+            stream->duration = (stream->max_pts - stream->min_pts) * stream->packet_count / (stream->packet_count - 1);
+    }
+    free(summaries);
+    return info;
+
+fail:
+    if (summaries) {
+        for (int i = 0; i < MAX_STREAM_ID; i++)
+            free(summaries[i].keyframe_packets);
+        free(summaries);
+    }
+    lwindex_free_info(info);
+    return NULL;
+}
+
+void lwindex_free_info(lwindex_info_t* info)
+{
+    if (!info)
+        return;
+    if (info->streams) {
+        for (int i = 0; i < info->data->num_streams; i++)
+            free(info->streams[i].keyframe_packets);
+        free(info->streams);
+    }
+    lwindex_free(info->data);
+    free(info);
+}
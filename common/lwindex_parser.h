@@ -41,6 +41,15 @@
 #define MAX_EXTRA_DATA_LIST 64
 #define FORMAT_LENGTH 64
 
+/* Compressed index container
+ * The magic is followed by blocks of [raw size (uint32 LE)][stored size (uint32 LE)][data].
+ * A block whose stored size equals its raw size holds plain text, otherwise its data is a zlib stream.
+ * The first block covers the header tags up to <PacketCount> and is never compressed,
+ * so that the tags rewritten in place keep fixed file offsets. */
+#define LWINDEX_COMPRESSED_MAGIC "LWIZ"
+#define LWINDEX_COMPRESSED_MAGIC_SIZE 4
+#define LWINDEX_COMPRESSED_BLOCK_SIZE (1 << 20)
+
 enum av_stream_type {
     AV_STREAM_TYPE_VIDEO = 0,
     AV_STREAM_TYPE_AUDIO = 1,
@@ -143,13 +152,22 @@ typedef struct {
     } data;
 } index_entry_t; // Extensively used, 32 bytes
 
+typedef struct {
+    uint32_t stream_index : 8;
+    uint32_t codec_type : 2; // 0 for type0, 1 for type1
+    uint32_t packet_count;
+    int64_t offset; // from the first packet line of <LibavReaderIndex>
+    int64_t size;
+} stream_section_entry_t;
+
 typedef struct {
     char lsmash_works_index_version[16];
     int libav_reader_index_file;
     char input_file_path[MAX_FILE_PATH_LENGTH];
     uint64_t file_size;
     int64_t file_last_modification_time;
-    uint64_t file_hash;
+    uint64_t file_hash; // hash of the first and last mebibytes, written by older versions
+    uint64_t file_fingerprint; // hash of the regions sampled by xxhash_file_fingerprint(), 0 if absent
     char format_name[256];
     int format_flags;
     int raw_demuxer;
@@ -157,8 +175,12 @@ typedef struct {
     int active_audio_stream_index;
     int default_audio_stream_index;
     int fill_audio_gaps;
+    uint32_t video_packet_count; // number of packets of the active video stream, 0 if unknown
+    uint32_t audio_packet_count; // number of packets of the active audio stream, 0 if unknown
     stream_info_entry_t* stream_info;
     int num_streams;
+    stream_section_entry_t* stream_sections; // NULL if the packet lines of the streams are interleaved
+    int num_stream_sections;
 
     index_entry_t* index_entries;
     int num_index_entries;
@@ -169,7 +191,40 @@ typedef struct {
     int64_t active_audio_stream_index_pos;
 } lwindex_data_t;
 
+// Called for each index entry instead of storing it into index_entries.
+// All the tags preceding the entry, such as the header and StreamInfo, are already stored in data.
+// Return a negative value to abort parsing.
+typedef int (*lwindex_entry_handler_t)(void* opaque, const lwindex_data_t* data, const index_entry_t* entry);
+
+// Called once for each stream section before its entries are parsed.
+// Return 1 to parse the section, 0 to skip it and a negative value to abort parsing.
+typedef int (*lwindex_stream_filter_t)(void* opaque, const lwindex_data_t* data, int stream_index);
+
 lwindex_data_t* lwindex_parse(FILE* index, int include_video, int include_audio);
+lwindex_data_t* lwindex_parse_with_handler(FILE* index, int include_video, int include_audio, lwindex_entry_handler_t handler,
+    lwindex_stream_filter_t filter, void* opaque);
 void lwindex_free(lwindex_data_t* data);
 
+/* Summary of the packets of a stream, gathered without storing them */
+typedef struct {
+    int stream_index;
+    int codec_type; // 0 for type0, 1 for type1
+    uint32_t packet_count;
+    int64_t duration; // in time_base; from <StreamDuration> if present, otherwise estimated from the presentation timestamps
+    int64_t min_pts; // INT64_MIN if no packet has a presentation timestamp
+    int64_t max_pts;
+    uint32_t* keyframe_packets; // type0: 0-based decoding order numbers of the keyframe packets, which are not frame numbers
+    uint32_t num_keyframe_packets;
+    uint64_t sample_count; // type1: sum of the frame lengths
+} lwindex_stream_summary_t;
+
+typedef struct {
+    lwindex_data_t* data; // header tags and stream info; index_entries is not filled
+    lwindex_stream_summary_t* streams; // one per data->stream_info entry, in the same order
+} lwindex_info_t;
+
+// Answer metadata queries from the index alone, without opening the source file or any decoder.
+lwindex_info_t* lwindex_query_info(FILE* index);
+void lwindex_free_info(lwindex_info_t* info);
+
 #endif // LWINDEX_PARSER_H
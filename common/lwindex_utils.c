@@ -4,8 +4,11 @@
 
 /* This file is available under an ISC license. */
 
+#include <sys/stat.h>
 #include <xxhash.h>
+#include <zlib.h>
 
+#include "lwindex_parser.h"
 #include "lwindex_utils.h"
 
 void print_index(FILE* index, const char* format, ...)
@@ -56,16 +59,96 @@ unsigned xxhash32_file(const char* file_path, int64_t file_size)
     return hash;
 }
 
-char* create_lwi_path(lwlibav_option_t* opt)
+/* Hash regions sampled evenly across the file, the first and last ones included.
+ * This costs a few seeks but far less reading than the head and tail hash above,
+ * while also catching changes in the middle of the file. */
+uint64_t xxhash_file_fingerprint(const char* file_path, int64_t file_size)
 {
+    FILE* fp = lw_fopen(file_path, "rb");
+    if (!fp)
+        return 0;
+    uint8_t* region = (uint8_t*)lw_malloc_zero(LWINDEX_FINGERPRINT_REGION_SIZE);
+    XXH3_state_t* state = XXH3_createState();
+    uint64_t hash = 0;
+    if (!region || !state || XXH3_64bits_reset_withSeed(state, (XXH64_hash_t)file_size) == XXH_ERROR)
+        goto end;
+    const int64_t region_size = LWINDEX_FINGERPRINT_REGION_SIZE;
+    const int64_t sampled_size = region_size * LWINDEX_FINGERPRINT_REGIONS;
+    /* Small files are hashed as a whole. */
+    const int regions = file_size > sampled_size ? LWINDEX_FINGERPRINT_REGIONS : (int)((file_size + region_size - 1) / region_size);
+    for (int i = 0; i < regions; i++) {
+        int64_t offset = file_size > sampled_size ? (file_size - region_size) / (LWINDEX_FINGERPRINT_REGIONS - 1) * i : region_size * i;
+        if (i == regions - 1 && file_size > sampled_size)
+            offset = file_size - region_size;
+        if (lw_fseek(fp, offset, SEEK_SET))
+            goto end;
+        size_t read_len = fread(region, 1, LWINDEX_FINGERPRINT_REGION_SIZE, fp);
+        if (XXH3_64bits_update(state, region, read_len) == XXH_ERROR)
+            goto end;
+    }
+    hash = XXH3_64bits_digest(state);
+end:
+    fclose(fp);
+    XXH3_freeState(state);
+    lw_free(region);
+    return hash;
+}
+
+int get_file_stat(const char* file_path, int64_t* size, int64_t* mtime)
+{
+#ifdef _WIN32
+    wchar_t* wname = NULL;
+    struct _stat64 file_stat;
+    int err;
+    if (lw_string_to_wchar(CP_UTF8, file_path, &wname)) {
+        err = _wstat64(wname, &file_stat);
+        lw_free(wname);
+    } else
+        err = _stat64(file_path, &file_stat);
+    if (err)
+        return -1;
+#else
+    struct stat file_stat;
+    if (stat(file_path, &file_stat))
+        return -1;
+#endif
+    *size = file_stat.st_size;
+    *mtime = file_stat.st_mtime;
+    return 0;
+}
+
+char* create_lwi_path(lwlibav_option_t* opt, uint64_t* fingerprint)
+{
+    if (fingerprint)
+        *fingerprint = 0;
     if (!opt->cache_dir || opt->cache_dir[0] == '\0') {
         char* buf = lw_malloc_zero(strlen(opt->file_path) + 5);
         sprintf(buf, "%s.lwi", opt->file_path);
         return buf;
     }
 
-    const int max_filename = 254; // be conservative
     const char* dir = opt->cache_dir ? opt->cache_dir : ".";
+    /* Name the index after the content in a shared cache directory,
+     * so that the same media reached through different paths or hosts shares one index.
+     * Without verification the source is identified by its size and modification time alone, so nothing is read to name it. */
+    int64_t file_size, file_mtime;
+    if (get_file_stat(opt->file_path, &file_size, &file_mtime) == 0) {
+        char* buf = (char*)lw_malloc_zero(strlen(dir) + 1 + 20 + 1 + 20 + 4 + 1);
+        if (!buf)
+            return NULL;
+        if (opt->verify_policy == LWINDEX_VERIFY_NEVER)
+            sprintf(buf, "%s/%" PRId64 "-%" PRId64 ".lwi", dir, file_size, file_mtime);
+        else {
+            uint64_t hash = xxhash_file_fingerprint(opt->file_path, file_size);
+            if (fingerprint)
+                *fingerprint = hash;
+            sprintf(buf, "%s/%016" PRIx64 "-%" PRId64 ".lwi", dir, hash, file_size);
+        }
+        return buf;
+    }
+
+    /* Fall back on the path if the file cannot be examined. */
+    const int max_filename = 254; // be conservative
     const char* rpath = lw_realpath(opt->file_path, NULL);
     char* malloced = NULL;
     if (rpath)
@@ -103,3 +186,72 @@ char* create_lwi_path(lwlibav_option_t* opt)
     lw_free(malloced);
     return buf;
 }
+
+static void write_le32(uint8_t* p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+/* Repack the text index at index_path into the compressed container described in lwindex_parser.h.
+ * The first header_size bytes become the uncompressed first block.
+ * The text index is replaced only if the whole container was written. */
+int lwindex_compress_file(const char* index_path, int64_t header_size)
+{
+    char* tmp_path = (char*)lw_malloc_zero(strlen(index_path) + 5);
+    uint8_t* raw = (uint8_t*)lw_malloc_zero(LWINDEX_COMPRESSED_BLOCK_SIZE);
+    uLong packed_bound = compressBound(LWINDEX_COMPRESSED_BLOCK_SIZE);
+    uint8_t* packed = (uint8_t*)lw_malloc_zero(packed_bound);
+    FILE* in = NULL;
+    FILE* out = NULL;
+    int ret = -1;
+    if (!tmp_path || !raw || !packed)
+        goto end;
+    sprintf(tmp_path, "%s.tmp", index_path);
+    in = lw_fopen(index_path, "rb");
+    if (!in)
+        goto end;
+    out = lw_fopen(tmp_path, "wb");
+    if (!out)
+        goto end;
+    if (fwrite(LWINDEX_COMPRESSED_MAGIC, 1, LWINDEX_COMPRESSED_MAGIC_SIZE, out) != LWINDEX_COMPRESSED_MAGIC_SIZE)
+        goto end;
+    int is_header = header_size > 0;
+    size_t block_size = is_header ? (size_t)MIN(header_size, LWINDEX_COMPRESSED_BLOCK_SIZE) : LWINDEX_COMPRESSED_BLOCK_SIZE;
+    size_t raw_size;
+    while ((raw_size = fread(raw, 1, block_size, in)) > 0) {
+        uLongf packed_size = packed_bound;
+        const uint8_t* data = packed;
+        /* Blocks that do not shrink are stored as is. */
+        if (is_header || compress2(packed, &packed_size, raw, raw_size, Z_DEFAULT_COMPRESSION) != Z_OK || packed_size >= raw_size) {
+            data = raw;
+            packed_size = raw_size;
+        }
+        uint8_t block_header[8];
+        write_le32(block_header, (uint32_t)raw_size);
+        write_le32(block_header + 4, (uint32_t)packed_size);
+        if (fwrite(block_header, 1, sizeof(block_header), out) != sizeof(block_header) || fwrite(data, 1, packed_size, out) != packed_size)
+            goto end;
+        is_header = 0;
+        block_size = LWINDEX_COMPRESSED_BLOCK_SIZE;
+    }
+    if (!ferror(in))
+        ret = 0;
+end:
+    if (in)
+        fclose(in);
+    if (out && fclose(out) != 0)
+        ret = -1;
+    if (out) {
+        if (ret == 0)
+            ret = lw_rename(tmp_path, index_path);
+        if (ret != 0)
+            lw_remove(tmp_path);
+    }
+    lw_free(tmp_path);
+    lw_free(raw);
+    lw_free(packed);
+    return ret;
+}
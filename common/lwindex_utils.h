@@ -10,9 +10,18 @@
 #include "lwindex.h"
 #include "osdep.h"
 
+/* Sampled regions of xxhash_file_fingerprint() */
+#define LWINDEX_FINGERPRINT_REGIONS 16
+#define LWINDEX_FINGERPRINT_REGION_SIZE (1 << 16)
+
 void print_index(FILE* index, const char* format, ...);
 uint64_t xxhash_file(const char* file_path, int64_t file_size);
 unsigned xxhash32_file(const char* file_path, int64_t file_size);
-char* create_lwi_path(lwlibav_option_t* opt);
+uint64_t xxhash_file_fingerprint(const char* file_path, int64_t file_size);
+/* Get the size and the modification time of a file. Return -1 on failure. */
+int get_file_stat(const char* file_path, int64_t* size, int64_t* mtime);
+/* The fingerprint of the source, if it was computed to name the index, is returned via fingerprint, 0 otherwise. */
+char* create_lwi_path(lwlibav_option_t* opt, uint64_t* fingerprint);
+int lwindex_compress_file(const char* index_path, int64_t header_size);
 
 #endif // !LWINDEX_UTILS_H
@@ -57,6 +57,7 @@ void lwlibav_audio_free_decode_handler(lwlibav_audio_decode_handler_t* adhp)
                 av_free(exhp->entries[i].extradata);
         lw_free(exhp->entries);
     }
+    lwlibav_free_decoder_pool(exhp);
     av_packet_unref(&adhp->packet);
     lw_free(adhp->frame_list);
     av_free(adhp->index_entries);
@@ -144,7 +145,7 @@ void lwlibav_audio_force_seek(lwlibav_audio_decode_handler_t* adhp)
 int lwlibav_audio_get_desired_track(const char* file_path, lwlibav_audio_decode_handler_t* adhp, int threads)
 {
     AVCodecContext* ctx = NULL;
-    if (adhp->stream_index < 0 || adhp->frame_count == 0 || lavf_open_file(&adhp->format, file_path, &adhp->lh) < 0
+    if (adhp->stream_index < 0 || adhp->frame_count == 0 || lavf_open_file(&adhp->format, file_path, LW_FILE_ACCESS_RANDOM, &adhp->lh) < 0
         || find_and_open_decoder(&ctx, adhp->format->streams[adhp->stream_index]->codecpar, adhp->preferred_decoder_names, 0, threads,
                adhp->drc, adhp->ff_options, NULL)
             < 0) {
@@ -23,6 +23,437 @@
 #include "lwlibav_dec.h"
 #include "cpp_compat.h"
 #include "decode.h"
+#include "osdep.h"
+
+/* Read cache shared by the demuxers of the same file
+ * The video and audio sources, and the second video decoder, demux the file on their own.
+ * When they go through the file together, as in a full export, what one of them has just read is served to the others
+ * from memory, so that the file is read once. Demuxers apart farther than the cache just read the file again.
+ * While a demuxer reads sequentially, a background thread reads the next blocks ahead of it,
+ * so that the latency of slow storage overlaps with demuxing and decoding.
+ * The read-ahead is refilled once half of it is consumed, and consecutive blocks are read with one request
+ * through a staging buffer, so that each round trip to the storage brings half of the read-ahead.
+ * The requests of a refill are issued at once, which are then in flight together with io_uring on Linux. */
+#define SHARED_IO_BUFFER_SIZE (1 << 15) /* for each demuxer */
+#define SHARED_IO_BLOCK_SIZE (1 << 18)
+#define SHARED_IO_BLOCK_COUNT 64 /* up to 16 MiB for each file */
+#define SHARED_IO_MAX_READAHEAD_BLOCKS 16
+
+/* Decoding seeks, so the blocks are small to cut what is read in vain at each seek.
+ * Indexing reads through the file once, so it reads further ahead instead to cut the round trips to the storage.
+ * The depth belongs to each demuxer, since the demuxers sharing a file may read it either way. */
+static const int shared_io_readahead_blocks[] = {
+    4, /* LW_FILE_ACCESS_RANDOM */
+    SHARED_IO_MAX_READAHEAD_BLOCKS, /* LW_FILE_ACCESS_SEQUENTIAL */
+};
+
+typedef enum {
+    SHARED_IO_BLOCK_EMPTY,
+    SHARED_IO_BLOCK_FILLING, /* being read without the lock held */
+    SHARED_IO_BLOCK_VALID,
+} shared_io_block_state;
+
+typedef struct {
+    uint8_t* data;
+    shared_io_block_state state;
+    int64_t number; /* of the block in the file, -1 if empty */
+    int size; /* valid bytes, less than the block size at the end of the file */
+    uint64_t last_use;
+} shared_io_block_t;
+
+typedef struct shared_io_tag shared_io_t;
+
+struct shared_io_tag {
+    shared_io_t* next;
+    char* file_path;
+    int reference_count;
+    lw_read_file_t* file;
+    int64_t file_size;
+    lw_mutex_t* lock; /* guards the following */
+    lw_cond_t* changed; /* a block was filled, read-ahead was requested or the thread is asked to quit */
+    shared_io_block_t* blocks;
+    uint64_t clock;
+    lw_thread_t* readahead_thread;
+    uint8_t* readahead_buffer; /* used only by the thread */
+    int64_t readahead_start; /* the next block to read ahead */
+    int64_t readahead_end;
+    int quit;
+};
+
+typedef struct {
+    shared_io_t* shared;
+    int64_t position;
+    int64_t last_block;
+    int64_t readahead_end; /* of the latest read-ahead requested by this demuxer */
+    int readahead_blocks;
+} shared_io_reader_t;
+
+static shared_io_t* shared_ios = NULL; /* guarded by the global mutex */
+
+static shared_io_block_t* find_shared_io_block(shared_io_t* shared, int64_t number)
+{
+    for (int i = 0; i < SHARED_IO_BLOCK_COUNT; i++)
+        if (shared->blocks[i].number == number)
+            return &shared->blocks[i];
+    return NULL;
+}
+
+/* Take an empty block or the least recently used one for filling with the given block of the file.
+ * Return NULL if every block is being filled or on allocation failure. */
+static shared_io_block_t* start_filling_shared_io_block(shared_io_t* shared, int64_t number)
+{
+    shared_io_block_t* block = NULL;
+    for (int i = 0; i < SHARED_IO_BLOCK_COUNT; i++) {
+        shared_io_block_t* candidate = &shared->blocks[i];
+        if (candidate->state == SHARED_IO_BLOCK_FILLING)
+            continue;
+        if (!block
+            || (block->state == SHARED_IO_BLOCK_VALID
+                && (candidate->state == SHARED_IO_BLOCK_EMPTY || candidate->last_use < block->last_use)))
+            block = candidate;
+    }
+    if (!block || (!block->data && !(block->data = (uint8_t*)av_malloc(SHARED_IO_BLOCK_SIZE))))
+        return NULL;
+    block->state = SHARED_IO_BLOCK_FILLING;
+    block->number = number;
+    return block;
+}
+
+static void finish_filling_shared_io_block(shared_io_t* shared, shared_io_block_t* block, int size)
+{
+    if (size < 0) {
+        block->state = SHARED_IO_BLOCK_EMPTY;
+        block->number = -1;
+    } else {
+        block->state = SHARED_IO_BLOCK_VALID;
+        block->size = size;
+        block->last_use = ++shared->clock;
+    }
+}
+
+/* Read a block into the cache. The lock is released while reading. */
+static shared_io_block_t* fill_shared_io_block(shared_io_t* shared, int64_t number)
+{
+    shared_io_block_t* block = start_filling_shared_io_block(shared, number);
+    if (!block)
+        return NULL;
+    lw_unlock_mutex(shared->lock);
+    int size = lw_read_file_at(shared->file, block->data, SHARED_IO_BLOCK_SIZE, number * SHARED_IO_BLOCK_SIZE);
+    lw_lock_mutex(shared->lock);
+    finish_filling_shared_io_block(shared, block, size);
+    lw_broadcast_cond(shared->changed);
+    return size < 0 ? NULL : block;
+}
+
+static shared_io_block_t* get_shared_io_block(shared_io_t* shared, int64_t number)
+{
+    shared_io_block_t* block;
+    while ((block = find_shared_io_block(shared, number)) != NULL) {
+        if (block->state == SHARED_IO_BLOCK_VALID) {
+            block->last_use = ++shared->clock;
+            return block;
+        }
+        /* Wait for the reader of the block, e.g. the read-ahead. */
+        lw_wait_cond(shared->changed, shared->lock);
+    }
+    return fill_shared_io_block(shared, number);
+}
+
+static void shared_io_readahead(void* arg)
+{
+    shared_io_t* shared = (shared_io_t*)arg;
+    shared_io_block_t* blocks[SHARED_IO_MAX_READAHEAD_BLOCKS];
+    lw_read_request_t requests[SHARED_IO_MAX_READAHEAD_BLOCKS];
+    int block_requests[SHARED_IO_MAX_READAHEAD_BLOCKS];
+    int sizes[SHARED_IO_MAX_READAHEAD_BLOCKS];
+    if (!(shared->readahead_buffer = (uint8_t*)av_malloc(SHARED_IO_MAX_READAHEAD_BLOCKS * SHARED_IO_BLOCK_SIZE)))
+        return; /* The demuxers read without the read-ahead. */
+    lw_lock_mutex(shared->lock);
+    while (!shared->quit) {
+        /* A run of consecutive blocks is read into the same place in the staging buffer with one request. */
+        int count = 0;
+        int request_count = 0;
+        for (; count < SHARED_IO_MAX_READAHEAD_BLOCKS && shared->readahead_start < shared->readahead_end; shared->readahead_start++) {
+            int64_t number = shared->readahead_start;
+            if (number * SHARED_IO_BLOCK_SIZE >= shared->file_size || find_shared_io_block(shared, number))
+                continue;
+            shared_io_block_t* block = start_filling_shared_io_block(shared, number);
+            if (!block)
+                break;
+            if (count > 0 && blocks[count - 1]->number == number - 1)
+                requests[request_count - 1].size += SHARED_IO_BLOCK_SIZE;
+            else {
+                requests[request_count].buf = shared->readahead_buffer + count * SHARED_IO_BLOCK_SIZE;
+                requests[request_count].size = SHARED_IO_BLOCK_SIZE;
+                requests[request_count].offset = number * SHARED_IO_BLOCK_SIZE;
+                ++request_count;
+            }
+            block_requests[count] = request_count - 1;
+            blocks[count++] = block;
+        }
+        if (count == 0) {
+            lw_wait_cond(shared->changed, shared->lock);
+            continue;
+        }
+        lw_unlock_mutex(shared->lock);
+        int abandoned = lw_read_file_batch(shared->file, requests, request_count) < 0;
+        /* The blocks being filled belong to this thread, so they are copied into without the lock. */
+        for (int i = 0; i < count; i++) {
+            lw_read_request_t* request = &requests[block_requests[i]];
+            int offset = (int)(blocks[i]->number * SHARED_IO_BLOCK_SIZE - request->offset);
+            sizes[i] = request->result < 0 ? -1 : MAX(0, MIN(request->result - offset, SHARED_IO_BLOCK_SIZE));
+            if (sizes[i] > 0)
+                memcpy(blocks[i]->data, shared->readahead_buffer + i * SHARED_IO_BLOCK_SIZE, sizes[i]);
+        }
+        lw_lock_mutex(shared->lock);
+        for (int i = 0; i < count; i++)
+            finish_filling_shared_io_block(shared, blocks[i], sizes[i]);
+        lw_broadcast_cond(shared->changed);
+        if (abandoned) {
+            /* The staging buffer may still be written by the reads abandoned, so it is leaked and the demuxers read by themselves. */
+            shared->readahead_buffer = NULL;
+            break;
+        }
+    }
+    lw_unlock_mutex(shared->lock);
+}
+
+static void request_readahead(shared_io_t* shared, int64_t number, int count)
+{
+    if (!shared->readahead_thread && !(shared->readahead_thread = lw_create_thread(shared_io_readahead, shared)))
+        return;
+    shared->readahead_start = number;
+    shared->readahead_end = number + count;
+    lw_broadcast_cond(shared->changed);
+}
+
+static int shared_io_read(void* opaque, uint8_t* buf, int size)
+{
+    shared_io_reader_t* reader = (shared_io_reader_t*)opaque;
+    shared_io_t* shared = reader->shared;
+    int copied = 0;
+    int err = 0;
+    lw_lock_mutex(shared->lock);
+    while (copied < size) {
+        int64_t number = reader->position / SHARED_IO_BLOCK_SIZE;
+        shared_io_block_t* block = get_shared_io_block(shared, number);
+        if (!block) {
+            err = AVERROR(EIO);
+            break;
+        }
+        if (number != reader->last_block && number != reader->last_block + 1)
+            reader->readahead_end = 0; /* seeked */
+        else if (number == reader->last_block + 1 && reader->readahead_end - number <= reader->readahead_blocks / 2) {
+            reader->readahead_end = number + 1 + reader->readahead_blocks;
+            request_readahead(shared, number + 1, reader->readahead_blocks);
+        }
+        reader->last_block = number;
+        int offset = (int)(reader->position % SHARED_IO_BLOCK_SIZE);
+        if (offset >= block->size)
+            break; /* the end of the file */
+        int length = MIN(block->size - offset, size - copied);
+        memcpy(buf + copied, block->data + offset, length);
+        copied += length;
+        reader->position += length;
+    }
+    lw_unlock_mutex(shared->lock);
+    return copied > 0 ? copied : err < 0 ? err : AVERROR_EOF;
+}
+
+static int64_t shared_io_seek(void* opaque, int64_t offset, int whence)
+{
+    shared_io_reader_t* reader = (shared_io_reader_t*)opaque;
+    if (whence & AVSEEK_SIZE)
+        return reader->shared->file_size;
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+        position = offset;
+        break;
+    case SEEK_CUR:
+        position = reader->position + offset;
+        break;
+    case SEEK_END:
+        position = reader->shared->file_size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (position < 0)
+        return AVERROR(EINVAL);
+    reader->position = position;
+    return position;
+}
+
+static void free_shared_io(shared_io_t* shared)
+{
+    if (shared->readahead_thread) {
+        lw_lock_mutex(shared->lock);
+        shared->quit = 1;
+        lw_broadcast_cond(shared->changed);
+        lw_unlock_mutex(shared->lock);
+        lw_join_thread(shared->readahead_thread);
+    }
+    av_free(shared->readahead_buffer);
+    if (shared->blocks)
+        for (int i = 0; i < SHARED_IO_BLOCK_COUNT; i++)
+            av_free(shared->blocks[i].data);
+    lw_free(shared->blocks);
+    lw_close_read_file(shared->file);
+    lw_destroy_cond(shared->changed);
+    lw_destroy_mutex(shared->lock);
+    lw_free(shared->file_path);
+    lw_free(shared);
+}
+
+static void release_shared_io(shared_io_t* shared)
+{
+    lw_lock_global_mutex();
+    if (--shared->reference_count > 0) {
+        lw_unlock_global_mutex();
+        return;
+    }
+    shared_io_t** p = &shared_ios;
+    while (*p && *p != shared)
+        p = &(*p)->next;
+    if (*p)
+        *p = shared->next;
+    lw_unlock_global_mutex();
+    free_shared_io(shared);
+}
+
+/* The access pattern of the latest opener is hinted to the system. */
+static shared_io_t* acquire_shared_io(const char* file_path, int access)
+{
+    lw_lock_global_mutex();
+    shared_io_t* shared = shared_ios;
+    while (shared && strcmp(shared->file_path, file_path))
+        shared = shared->next;
+    if (shared) {
+        ++shared->reference_count;
+        lw_unlock_global_mutex();
+        lw_advise_read_file(shared->file, access);
+        return shared;
+    }
+    lw_unlock_global_mutex();
+    shared = (shared_io_t*)lw_malloc_zero(sizeof(shared_io_t));
+    if (!shared)
+        return NULL;
+    shared->file_path = (char*)lw_malloc_zero(strlen(file_path) + 1);
+    shared->blocks = (shared_io_block_t*)lw_malloc_zero(SHARED_IO_BLOCK_COUNT * sizeof(shared_io_block_t));
+    shared->lock = lw_create_mutex();
+    shared->changed = lw_create_cond();
+    shared->file = lw_open_read_file(file_path);
+    if (!shared->file_path || !shared->blocks || !shared->lock || !shared->changed || !shared->file
+        || (shared->file_size = lw_get_read_file_size(shared->file)) <= 0) {
+        free_shared_io(shared);
+        return NULL;
+    }
+    for (int i = 0; i < SHARED_IO_BLOCK_COUNT; i++)
+        shared->blocks[i].number = -1;
+    strcpy(shared->file_path, file_path);
+    lw_advise_read_file(shared->file, access);
+    shared->reference_count = 1;
+    lw_lock_global_mutex();
+    shared->next = shared_ios;
+    shared_ios = shared;
+    lw_unlock_global_mutex();
+    return shared;
+}
+
+/* Return an I/O context reading the file through the shared cache, or NULL if the file cannot be shared. */
+static AVIOContext* open_shared_io(const char* file_path, int access)
+{
+    /* Other protocols may not be seekable or may be read by demuxers on their own. */
+    const char* protocol = avio_find_protocol_name(file_path);
+    if (!protocol || strcmp(protocol, "file"))
+        return NULL;
+    shared_io_t* shared = acquire_shared_io(file_path, access);
+    if (!shared)
+        return NULL;
+    shared_io_reader_t* reader = (shared_io_reader_t*)lw_malloc_zero(sizeof(shared_io_reader_t));
+    uint8_t* buffer = (uint8_t*)av_malloc(SHARED_IO_BUFFER_SIZE);
+    AVIOContext* pb = reader && buffer
+        ? avio_alloc_context(buffer, SHARED_IO_BUFFER_SIZE, 0, reader, shared_io_read, NULL, shared_io_seek)
+        : NULL;
+    if (!pb) {
+        av_free(buffer);
+        lw_free(reader);
+        release_shared_io(shared);
+        return NULL;
+    }
+    reader->shared = shared;
+    reader->last_block = -2;
+    reader->readahead_blocks = shared_io_readahead_blocks[access];
+    return pb;
+}
+
+static void close_shared_io(AVIOContext** pb)
+{
+    shared_io_reader_t* reader = (shared_io_reader_t*)(*pb)->opaque;
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+    release_shared_io(reader->shared);
+    lw_free(reader);
+}
+
+int lavf_open_file(AVFormatContext** format_ctx, const char* file_path, int access, lw_log_handler_t* lhp)
+{
+    AVDictionary* prob_size = NULL;
+    av_dict_set(&prob_size, "probesize", "6000000", 0);
+    AVIOContext* pb = open_shared_io(file_path, access);
+    if (pb) {
+        *format_ctx = avformat_alloc_context();
+        if (*format_ctx) {
+            (*format_ctx)->pb = pb;
+            /* The context is freed on failure. */
+            if (avformat_open_input(format_ctx, file_path, NULL, &prob_size) == 0)
+                goto find_stream_info;
+        }
+        close_shared_io(&pb);
+        av_dict_free(&prob_size);
+        av_dict_set(&prob_size, "probesize", "6000000", 0);
+    }
+    if (avformat_open_input(format_ctx, file_path, NULL, &prob_size)) {
+#ifdef _WIN32
+        wchar_t* wname;
+        if (lw_string_to_wchar(CP_ACP, file_path, &wname)) {
+            char* name;
+            if (lw_string_from_wchar(CP_UTF8, wname, &name)) {
+                lw_free(wname);
+                const int open = avformat_open_input(format_ctx, name, NULL, &prob_size);
+                lw_free(name);
+                if (open)
+                    goto fail_open;
+            } else {
+                lw_free(wname);
+                goto fail_open;
+            }
+        } else
+#endif // _WIN32
+            goto fail_open;
+    }
+find_stream_info:
+    if (avformat_find_stream_info(*format_ctx, NULL) < 0) {
+        lw_log_show(lhp, LW_LOG_FATAL, "Failed to avformat_find_stream_info.");
+        return -1;
+    }
+    av_dict_free(&prob_size);
+    return 0;
+
+fail_open:
+    lw_log_show(lhp, LW_LOG_FATAL, "Failed to avformat_open_input.");
+    return -1;
+}
+
+void lavf_close_file(AVFormatContext** format_ctx)
+{
+    /* The demuxer does not close the I/O context given by the caller. */
+    AVIOContext* pb = *format_ctx && ((*format_ctx)->flags & AVFMT_FLAG_CUSTOM_IO) ? (*format_ctx)->pb : NULL;
+    avformat_close_input(format_ctx);
+    if (pb)
+        close_shared_io(&pb);
+}
 
 /* Close and open the new decoder to flush buffers in the decoder even if the decoder implements avcodec_flush_buffers().
  * It seems this brings about more stable composition when seeking.
@@ -35,6 +466,61 @@ void lwlibav_flush_buffers(lwlibav_decode_handler_t* dhp)
     dhp->exh.delay_count = 0;
 }
 
+static void free_pooled_decoder(lwlibav_decoder_pool_entry_t* slot)
+{
+    slot->ctx->opaque = NULL;
+    avcodec_free_context(&slot->ctx);
+}
+
+/* Keep the decoder opened with the given extradata for later use.
+ * If the pool is full, the least recently used decoder is closed. */
+static void park_decoder(lwlibav_extradata_handler_t* exhp, AVCodecContext** ctx, int extradata_index)
+{
+    if (extradata_index < 0 || extradata_index >= exhp->entry_count) {
+        (*ctx)->opaque = NULL;
+        avcodec_free_context(ctx);
+        return;
+    }
+    lwlibav_decoder_pool_entry_t* slot = &exhp->pool[0];
+    for (int i = 0; i < LWLIBAV_DECODER_POOL_SIZE; i++) {
+        lwlibav_decoder_pool_entry_t* p = &exhp->pool[i];
+        if (!p->ctx) {
+            slot = p;
+            break;
+        }
+        if (p->last_use < slot->last_use)
+            slot = p;
+    }
+    if (slot->ctx)
+        free_pooled_decoder(slot);
+    slot->ctx = *ctx;
+    slot->extradata_index = extradata_index;
+    slot->last_use = ++exhp->pool_clock;
+    *ctx = NULL;
+}
+
+/* Take out the decoder opened with the given extradata from the pool.
+ * Return NULL if not found. */
+static AVCodecContext* unpark_decoder(lwlibav_extradata_handler_t* exhp, int extradata_index)
+{
+    for (int i = 0; i < LWLIBAV_DECODER_POOL_SIZE; i++) {
+        lwlibav_decoder_pool_entry_t* slot = &exhp->pool[i];
+        if (slot->ctx && slot->extradata_index == extradata_index) {
+            AVCodecContext* ctx = slot->ctx;
+            slot->ctx = NULL;
+            return ctx;
+        }
+    }
+    return NULL;
+}
+
+void lwlibav_free_decoder_pool(lwlibav_extradata_handler_t* exhp)
+{
+    for (int i = 0; i < LWLIBAV_DECODER_POOL_SIZE; i++)
+        if (exhp->pool[i].ctx)
+            free_pooled_decoder(&exhp->pool[i]);
+}
+
 void lwlibav_update_configuration(lwlibav_decode_handler_t* dhp, uint32_t frame_number, int extradata_index, int64_t rap_pos)
 {
     lwlibav_extradata_handler_t* exhp = &dhp->exh;
@@ -48,12 +534,14 @@ void lwlibav_update_configuration(lwlibav_decode_handler_t* dhp, uint32_t frame_
     AVCodecParameters* codecpar = dhp->format->streams[dhp->stream_index]->codecpar;
     void* app_specific = dhp->ctx->opaque;
     const int thread_count = dhp->ctx->thread_count;
-    /* Close the decoder here. */
-    dhp->ctx->opaque = NULL;
-    avcodec_free_context(&dhp->ctx);
+    /* Park the decoder here instead of closing it. */
+    park_decoder(exhp, &dhp->ctx, exhp->current_index);
     /* Find an appropriate decoder. */
     const lwlibav_extradata_t* entry = &exhp->entries[extradata_index];
-    const AVCodec* codec = find_decoder(entry->codec_id, codecpar, dhp->preferred_decoder_names, dhp->prefer_hw_decoder);
+    AVCodecContext* pooled_ctx = unpark_decoder(exhp, extradata_index);
+    const AVCodec* codec = pooled_ctx
+        ? pooled_ctx->codec
+        : find_decoder(entry->codec_id, codecpar, dhp->preferred_decoder_names, dhp->prefer_hw_decoder);
     if (!codec) {
         strcpy(error_string, "Failed to find the decoder.\n");
         goto fail;
@@ -78,6 +566,15 @@ void lwlibav_update_configuration(lwlibav_decode_handler_t* dhp, uint32_t frame_
     }
     /* This is needed by some CODECs such as UtVideo and raw video. */
     codecpar->codec_tag = entry->codec_tag;
+    if (pooled_ctx) {
+        /* The decoder is already set up with this extradata, so flushing is enough. */
+        dhp->ctx = pooled_ctx;
+        exhp->current_index = extradata_index;
+        lwlibav_flush_buffers(dhp);
+        dhp->ctx->get_buffer2 = exhp->get_buffer ? exhp->get_buffer : avcodec_default_get_buffer2;
+        dhp->ctx->opaque = app_specific;
+        return;
+    }
     /* Open an appropriate decoder.
      * Here, we force single threaded decoding since some decoder doesn't do its proper initialization with multi-threaded decoding. */
     if (open_decoder(&dhp->ctx, codecpar, codec, 1, dhp->drc, dhp->ff_options, dhp->prefer_hw_decoder, dhp->hw_device_ctx) < 0) {
@@ -102,6 +599,10 @@ void lwlibav_update_configuration(lwlibav_decode_handler_t* dhp, uint32_t frame_
     dhp->ctx->height = height;
     return;
 fail:
+    if (pooled_ctx) {
+        pooled_ctx->opaque = NULL;
+        avcodec_free_context(&pooled_ctx);
+    }
     exhp->delay_count = 0;
     dhp->error = 1;
     lw_log_show(&dhp->lh, LW_LOG_FATAL, "%sIt is recommended you reopen the file.", error_string);
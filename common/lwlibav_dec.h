@@ -23,8 +23,8 @@
 #ifndef LWLIBAV_DEC_H
 #define LWLIBAV_DEC_H
 
-#ifdef _WIN32
 #include "osdep.h"
+#ifdef _WIN32
 #include <windows.h>
 #endif // _WIN32
 
@@ -34,6 +34,8 @@
 #define SEEK_POS_CORRECTION 0x00000008
 #define SEEK_PTS_GENERATED 0x00000010
 
+#define LWLIBAV_DECODER_POOL_SIZE 3 /* the maximum number of parked decoders */
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -72,12 +74,22 @@ typedef struct {
     int block_align;
 } lwlibav_extradata_t;
 
+typedef struct {
+    AVCodecContext* ctx; /* NULL if this slot is empty */
+    int extradata_index; /* index of extradata the decoder was opened with */
+    uint32_t last_use;
+} lwlibav_decoder_pool_entry_t;
+
 typedef struct {
     int current_index;
     int entry_count;
     lwlibav_extradata_t* entries;
     uint32_t delay_count;
     int (*get_buffer)(struct AVCodecContext*, AVFrame*, int);
+    /* Decoders already opened with the other extradata.
+     * Switching back to one of them requires only flushing instead of reopening. */
+    lwlibav_decoder_pool_entry_t pool[LWLIBAV_DECODER_POOL_SIZE];
+    uint32_t pool_clock;
 } lwlibav_extradata_handler_t;
 
 typedef struct {
@@ -105,45 +117,14 @@ typedef struct {
     AVBufferRef* hw_device_ctx;
 } lwlibav_decode_handler_t;
 
-static inline int lavf_open_file(AVFormatContext** format_ctx, const char* file_path, lw_log_handler_t* lhp)
-{
-    AVDictionary* prob_size = NULL;
-    av_dict_set(&prob_size, "probesize", "6000000", 0);
-    if (avformat_open_input(format_ctx, file_path, NULL, &prob_size)) {
-#ifdef _WIN32
-        wchar_t* wname;
-        if (lw_string_to_wchar(CP_ACP, file_path, &wname)) {
-            char* name;
-            if (lw_string_from_wchar(CP_UTF8, wname, &name)) {
-                lw_free(wname);
-                const int open = avformat_open_input(format_ctx, name, NULL, &prob_size);
-                lw_free(name);
-                if (open)
-                    goto fail_open;
-            } else {
-                lw_free(wname);
-                goto fail_open;
-            }
-        } else
-#endif // _WIN32
-            goto fail_open;
-    }
-    if (avformat_find_stream_info(*format_ctx, NULL) < 0) {
-        lw_log_show(lhp, LW_LOG_FATAL, "Failed to avformat_find_stream_info.");
-        return -1;
-    }
-    av_dict_free(&prob_size);
-    return 0;
-
-fail_open:
-    lw_log_show(lhp, LW_LOG_FATAL, "Failed to avformat_open_input.");
-    return -1;
-}
+/* Open the file for demuxing.
+ * Demuxers of the same file, e.g. for video and audio, read it through a cache shared between them if possible.
+ * access is LW_FILE_ACCESS_SEQUENTIAL for a pass through the whole file such as indexing,
+ * or LW_FILE_ACCESS_RANDOM for decoding with seeks, and tunes the cache and the hints to the OS.
+ * Return 0 if successful. Otherwise, return -1, and then *format_ctx must be closed by lavf_close_file() if not NULL. */
+int lavf_open_file(AVFormatContext** format_ctx, const char* file_path, int access, lw_log_handler_t* lhp);
 
-static inline void lavf_close_file(AVFormatContext** format_ctx)
-{
-    avformat_close_input(format_ctx);
-}
+void lavf_close_file(AVFormatContext** format_ctx);
 
 static inline int read_av_frame(AVFormatContext* format_ctx, AVPacket* pkt)
 {
@@ -164,6 +145,8 @@ int lwlibav_get_av_frame(AVFormatContext* format_ctx, int stream_index, uint32_t
 
 void lwlibav_update_configuration(lwlibav_decode_handler_t* dhp, uint32_t frame_number, int extradata_index, int64_t rap_pos);
 
+void lwlibav_free_decoder_pool(lwlibav_extradata_handler_t* exhp);
+
 void set_video_basic_settings(lwlibav_decode_handler_t* dhp, const AVCodec* codec, uint32_t frame_number);
 
 void set_audio_basic_settings(lwlibav_decode_handler_t* dhp, const AVCodec* codec, uint32_t frame_number);
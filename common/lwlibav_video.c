@@ -21,6 +21,7 @@
 /* This file is available under an ISC license. */
 
 #include "float.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -63,6 +64,119 @@ lwlibav_video_output_handler_t* lwlibav_video_alloc_output_handler(void)
     return (lwlibav_video_output_handler_t*)lw_malloc_zero(sizeof(lwlibav_video_output_handler_t));
 }
 
+static void free_frame_table_column(lw_frame_table_column_t* column)
+{
+    lw_freep(&column->base);
+    lw_freep(&column->delta);
+    lw_freep(&column->full);
+}
+
+static void free_frame_table(lw_frame_table_t* table)
+{
+    free_frame_table_column(&table->pts);
+    free_frame_table_column(&table->dts);
+    free_frame_table_column(&table->file_offset);
+    lw_freep(&table->sample_number);
+    lw_freep(&table->extradata_index);
+    lw_freep(&table->extradata_index_full);
+    lw_freep(&table->bits);
+}
+
+/* Store one 64-bit member of video_frame_info_t as deltas from per-block bases.
+ * Fall back to raw values if some value cannot be expressed by a 32-bit delta.
+ * The 0th entry is a dummy and not copied. */
+static int build_frame_table_column(lw_frame_table_column_t* column, const video_frame_info_t* info, uint32_t count, size_t member_offset)
+{
+#define GET_MEMBER(i) (*(const int64_t*)((const uint8_t*)&info[i] + member_offset))
+    uint32_t block_count = (count >> LW_FRAME_TABLE_BLOCK_SHIFT) + 1;
+    column->base = (int64_t*)lw_malloc_zero(block_count * sizeof(int64_t));
+    column->delta = (int32_t*)lw_malloc_zero((count + 1) * sizeof(int32_t));
+    if (!column->base || !column->delta)
+        goto fail;
+    column->delta[0] = LW_FRAME_TABLE_NO_VALUE;
+    for (uint32_t block = 0; block < block_count; block++) {
+        uint32_t start = MAX(block << LW_FRAME_TABLE_BLOCK_SHIFT, 1);
+        uint32_t end = MIN(((block + 1) << LW_FRAME_TABLE_BLOCK_SHIFT) - 1, count);
+        int64_t base = 0;
+        for (uint32_t i = start; i <= end; i++)
+            if (GET_MEMBER(i) != AV_NOPTS_VALUE) {
+                base = GET_MEMBER(i);
+                break;
+            }
+        column->base[block] = base;
+        for (uint32_t i = start; i <= end; i++) {
+            int64_t value = GET_MEMBER(i);
+            if (value == AV_NOPTS_VALUE) {
+                column->delta[i] = LW_FRAME_TABLE_NO_VALUE;
+                continue;
+            }
+            int64_t delta = (int64_t)((uint64_t)value - (uint64_t)base);
+            if (delta <= LW_FRAME_TABLE_NO_VALUE || delta > INT32_MAX)
+                goto full;
+            column->delta[i] = (int32_t)delta;
+        }
+    }
+    return 0;
+full:
+    lw_freep(&column->base);
+    lw_freep(&column->delta);
+    column->full = (int64_t*)lw_malloc_zero((count + 1) * sizeof(int64_t));
+    if (!column->full)
+        goto fail;
+    column->full[0] = AV_NOPTS_VALUE;
+    for (uint32_t i = 1; i <= count; i++)
+        column->full[i] = GET_MEMBER(i);
+    return 0;
+fail:
+    free_frame_table_column(column);
+    return -1;
+#undef GET_MEMBER
+}
+
+/* Convert frame_list into the compact frame table and free frame_list.
+ * The frame table keeps only what is required after constructing the index.
+ * Return 0 if successful. Otherwise, return -1. */
+int lwlibav_video_build_frame_table(lwlibav_video_decode_handler_t* vdhp)
+{
+    lw_frame_table_t* table = &vdhp->frame_table;
+    video_frame_info_t* info = vdhp->frame_list;
+    uint32_t count = vdhp->frame_count;
+    free_frame_table(table);
+    if (!info)
+        return 0;
+    if (build_frame_table_column(&table->pts, info, count, offsetof(video_frame_info_t, pts)) < 0
+        || build_frame_table_column(&table->dts, info, count, offsetof(video_frame_info_t, dts)) < 0
+        || build_frame_table_column(&table->file_offset, info, count, offsetof(video_frame_info_t, file_offset)) < 0)
+        goto fail;
+    int wide_extradata_index = 0;
+    for (uint32_t i = 1; i <= count && !wide_extradata_index; i++)
+        wide_extradata_index = info[i].extradata_index < 0 || info[i].extradata_index > UINT16_MAX;
+    table->sample_number = (uint32_t*)lw_malloc_zero((count + 1) * sizeof(uint32_t));
+    if (wide_extradata_index)
+        table->extradata_index_full = (int32_t*)lw_malloc_zero((count + 1) * sizeof(int32_t));
+    else
+        table->extradata_index = (uint16_t*)lw_malloc_zero((count + 1) * sizeof(uint16_t));
+    table->bits = (uint16_t*)lw_malloc_zero((count + 1) * sizeof(uint16_t));
+    if (!table->sample_number || (!table->extradata_index && !table->extradata_index_full) || !table->bits)
+        goto fail;
+    for (uint32_t i = 1; i <= count; i++) {
+        table->sample_number[i] = info[i].sample_number;
+        if (wide_extradata_index)
+            table->extradata_index_full[i] = info[i].extradata_index;
+        else
+            table->extradata_index[i] = (uint16_t)info[i].extradata_index;
+        table->bits[i] = (uint16_t)((info[i].flags & LW_FRAME_TABLE_FLAGS_MASK)
+            | ((info[i].field_info << LW_FRAME_TABLE_FIELD_INFO_SHIFT) & LW_FRAME_TABLE_FIELD_INFO_MASK)
+            | (info[i].is_superframe ? LW_FRAME_TABLE_SUPERFRAME : 0) | (info[i].repeat_pict ? LW_FRAME_TABLE_REPEAT : 0));
+    }
+    lw_freep(&vdhp->frame_list);
+    return 0;
+fail:
+    free_frame_table(table);
+    lw_log_show(&vdhp->lh, LW_LOG_ERROR, "Failed to allocate the frame table.");
+    return -1;
+}
+
 void lwlibav_video_free_decode_handler(lwlibav_video_decode_handler_t* vdhp)
 {
     if (!vdhp)
@@ -74,10 +188,13 @@ void lwlibav_video_free_decode_handler(lwlibav_video_decode_handler_t* vdhp)
                 av_free(exhp->entries[i].extradata);
         lw_free(exhp->entries);
     }
+    lwlibav_free_decoder_pool(exhp);
     av_packet_unref(&vdhp->packet);
     lw_free(vdhp->frame_list);
+    free_frame_table(&vdhp->frame_table);
     lw_free(vdhp->order_converter);
     lw_free(vdhp->keyframe_list);
+    lw_free(vdhp->keyframe_position_list);
     av_free(vdhp->index_entries);
     av_frame_free(&vdhp->frame_buffer);
     av_frame_free(&vdhp->first_valid_frame);
@@ -86,6 +203,10 @@ void lwlibav_video_free_decode_handler(lwlibav_video_decode_handler_t* vdhp)
     avcodec_free_context(&vdhp->ctx);
     if (vdhp->format)
         lavf_close_file(&vdhp->format);
+    av_packet_unref(&vdhp->warm.packet);
+    avcodec_free_context(&vdhp->warm.ctx);
+    if (vdhp->warm.format)
+        lavf_close_file(&vdhp->warm.format);
     lw_free(vdhp);
 }
 
@@ -141,6 +262,11 @@ void lwlibav_video_set_decoder_options(lwlibav_video_decode_handler_t* vdhp, con
     vdhp->ff_options = ff_options;
 }
 
+void lwlibav_video_set_warm_decoder(lwlibav_video_decode_handler_t* vdhp, int warm_decoder)
+{
+    vdhp->warm_decoder = warm_decoder;
+}
+
 void lwlibav_video_set_log_handler(lwlibav_video_decode_handler_t* vdhp, lw_log_handler_t* lh)
 {
     vdhp->lh = *lh;
@@ -189,6 +315,19 @@ AVFrame* lwlibav_video_get_frame_buffer(lwlibav_video_decode_handler_t* vdhp)
     return vdhp ? vdhp->frame_buffer : NULL;
 }
 
+AVRational lwlibav_video_get_time_base(lwlibav_video_decode_handler_t* vdhp)
+{
+    AVRational unknown = { 0, 1 };
+    return vdhp ? vdhp->time_base : unknown;
+}
+
+const lwlibav_extradata_t* lwlibav_video_get_extradata(lwlibav_video_decode_handler_t* vdhp, int extradata_index)
+{
+    if (!vdhp || extradata_index < 0 || extradata_index >= vdhp->exh.entry_count)
+        return NULL;
+    return &vdhp->exh.entries[extradata_index];
+}
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -196,24 +335,66 @@ void lwlibav_video_force_seek(lwlibav_video_decode_handler_t* vdhp)
 {
     /* Force seek before the next reading. */
     vdhp->last_frame_number = vdhp->frame_count + 1;
+    /* Never resume the parked decoder either. */
+    vdhp->warm.last_frame_number = vdhp->frame_count + 1;
+    vdhp->warm.last_rap_number = 0;
+}
+
+/* Open the second decoder used for scrubbing.
+ * This is not mandatory, so the caller just disables it on failure. */
+static int open_warm_decoder(const char* file_path, lwlibav_video_decode_handler_t* vdhp, int threads)
+{
+    lwlibav_video_decoder_state_t* warm = &vdhp->warm;
+    if (lavf_open_file(&warm->format, file_path, LW_FILE_ACCESS_RANDOM, &vdhp->lh) < 0
+        || find_and_open_decoder(&warm->ctx, warm->format->streams[vdhp->stream_index]->codecpar, vdhp->preferred_decoder_names,
+               vdhp->prefer_hw_decoder, threads, -1.0, vdhp->ff_options, vdhp->hw_device_ctx)
+            < 0) {
+        avcodec_free_context(&warm->ctx);
+        if (warm->format)
+            lavf_close_file(&warm->format);
+        return -1;
+    }
+    warm->current_index = vdhp->exh.current_index;
+    warm->last_frame_number = vdhp->frame_count + 1;
+    warm->last_rap_number = 0;
+    return 0;
+}
+
+static void free_desired_track(lwlibav_video_decode_handler_t* vdhp)
+{
+    av_freep(&vdhp->index_entries);
+    lw_freep(&vdhp->frame_list);
+    free_frame_table(&vdhp->frame_table);
+    lw_freep(&vdhp->order_converter);
+    lw_freep(&vdhp->keyframe_list);
+    if (vdhp->format)
+        lavf_close_file(&vdhp->format);
 }
 
 int lwlibav_video_get_desired_track(const char* file_path, lwlibav_video_decode_handler_t* vdhp, int threads)
 {
     AVCodecContext* ctx = NULL;
-    if (vdhp->stream_index < 0 || vdhp->frame_count == 0 || lavf_open_file(&vdhp->format, file_path, &vdhp->lh) < 0
+    if (vdhp->stream_index < 0 || vdhp->frame_count == 0 || lavf_open_file(&vdhp->format, file_path, LW_FILE_ACCESS_RANDOM, &vdhp->lh) < 0
         || find_and_open_decoder(&ctx, vdhp->format->streams[vdhp->stream_index]->codecpar, vdhp->preferred_decoder_names,
                vdhp->prefer_hw_decoder, threads, -1.0, vdhp->ff_options, vdhp->hw_device_ctx)
             < 0) {
-        av_freep(&vdhp->index_entries);
-        lw_freep(&vdhp->frame_list);
-        lw_freep(&vdhp->order_converter);
-        lw_freep(&vdhp->keyframe_list);
-        if (vdhp->format)
-            lavf_close_file(&vdhp->format);
+        free_desired_track(vdhp);
         return -1;
     }
     vdhp->ctx = ctx;
+    if (vdhp->warm_decoder && vdhp->frame_count > 1 && open_warm_decoder(file_path, vdhp, threads) < 0) {
+        lw_log_show(&vdhp->lh, LW_LOG_WARNING, "Failed to open the second decoder. Scrubbing will be done by a single decoder.");
+        vdhp->warm_decoder = 0;
+    }
+    return 0;
+}
+
+int lwlibav_video_get_desired_track_packets(const char* file_path, lwlibav_video_decode_handler_t* vdhp)
+{
+    if (vdhp->stream_index < 0 || vdhp->frame_count == 0 || lavf_open_file(&vdhp->format, file_path, LW_FILE_ACCESS_RANDOM, &vdhp->lh) < 0) {
+        free_desired_track(vdhp);
+        return -1;
+    }
     return 0;
 }
 
@@ -277,6 +458,12 @@ void lwlibav_video_set_initial_input_format(lwlibav_video_decode_handler_t* vdhp
     vdhp->ctx->height = vdhp->initial_height;
     vdhp->ctx->pix_fmt = vdhp->initial_pix_fmt;
     vdhp->ctx->colorspace = vdhp->initial_colorspace;
+    if (vdhp->warm.ctx) {
+        vdhp->warm.ctx->width = vdhp->initial_width;
+        vdhp->warm.ctx->height = vdhp->initial_height;
+        vdhp->warm.ctx->pix_fmt = vdhp->initial_pix_fmt;
+        vdhp->warm.ctx->colorspace = vdhp->initial_colorspace;
+    }
 }
 
 /* Set the indentifier in output order to identify output picture.
@@ -311,11 +498,13 @@ static uint32_t correct_current_frame_number(lwlibav_video_decode_handler_t* vdh
 {
 /* Match packet position if available and enabled. */
 #define MATCH_POS(j) \
-    ((vdhp->lw_seek_flags & SEEK_POS_CORRECTION) && pkt->pos != -1 && info[j].file_offset != -1 && info[j].file_offset == pkt->pos)
+    ((vdhp->lw_seek_flags & SEEK_POS_CORRECTION) && pkt->pos != -1 && lw_frame_table_file_offset(info, j) != -1 \
+        && lw_frame_table_file_offset(info, j) == pkt->pos)
 /* Match packet DTS if both packet DTS and stored DTS are valid and equal. */
-#define MATCH_DTS(j) (pkt->dts != AV_NOPTS_VALUE && info[j].dts != AV_NOPTS_VALUE && info[j].dts == pkt->dts)
+#define MATCH_DTS(j) \
+    (pkt->dts != AV_NOPTS_VALUE && lw_frame_table_dts(info, j) != AV_NOPTS_VALUE && lw_frame_table_dts(info, j) == pkt->dts)
     order_converter_t* oc = vdhp->order_converter;
-    video_frame_info_t* info = vdhp->frame_list;
+    const lw_frame_table_t* info = &vdhp->frame_table;
     uint32_t p = oc ? oc[i].decoding_to_presentation : i;
     /* Check if the current frame 'i' is a definite match based on position or valid DTS. */
     if (MATCH_POS(p) || MATCH_DTS(p))
@@ -324,16 +513,16 @@ static uint32_t correct_current_frame_number(lwlibav_video_decode_handler_t* vdh
     int search_forward;
     int can_determine_direction = 0;
     /* Try using position first if available and DTS is unreliable */
-    if ((vdhp->lw_seek_flags & SEEK_POS_CORRECTION) && pkt->pos != -1 && info[p].file_offset != -1
-        && (pkt->dts == AV_NOPTS_VALUE || info[p].dts == AV_NOPTS_VALUE)) {
+    if ((vdhp->lw_seek_flags & SEEK_POS_CORRECTION) && pkt->pos != -1 && lw_frame_table_file_offset(info, p) != -1
+        && (pkt->dts == AV_NOPTS_VALUE || lw_frame_table_dts(info, p) == AV_NOPTS_VALUE)) {
         /* Use position comparison to determine direction */
-        search_forward = (pkt->pos > info[p].file_offset);
+        search_forward = (pkt->pos > lw_frame_table_file_offset(info, p));
         can_determine_direction = 1;
     }
     /* Otherwise, try using valid DTS */
-    else if (pkt->dts != AV_NOPTS_VALUE && info[p].dts != AV_NOPTS_VALUE) {
+    else if (pkt->dts != AV_NOPTS_VALUE && lw_frame_table_dts(info, p) != AV_NOPTS_VALUE) {
         /* Use valid DTS comparison to determine direction */
-        search_forward = (pkt->dts > info[p].dts);
+        search_forward = (pkt->dts > lw_frame_table_dts(info, p));
         can_determine_direction = 1;
     }
     if (!can_determine_direction) {
@@ -474,9 +663,9 @@ got_frame:
 static void find_random_accessible_point(
     lwlibav_video_decode_handler_t* vdhp, uint32_t presentation_picture_number, uint32_t decoding_picture_number, uint32_t* rap_number)
 {
-    int is_leading = !!(vdhp->frame_list[presentation_picture_number].flags & LW_VFRAME_FLAG_LEADING);
+    int is_leading = !!(lw_frame_table_flags(&vdhp->frame_table, presentation_picture_number) & LW_VFRAME_FLAG_LEADING);
     if (decoding_picture_number == 0)
-        decoding_picture_number = vdhp->frame_list[presentation_picture_number].sample_number;
+        decoding_picture_number = lw_frame_table_sample_number(&vdhp->frame_table, presentation_picture_number);
     *rap_number = decoding_picture_number;
     while (*rap_number) {
         if (vdhp->keyframe_list[*rap_number]) {
@@ -494,15 +683,15 @@ static void find_random_accessible_point(
 static int64_t get_random_accessible_point_position(lwlibav_video_decode_handler_t* vdhp, uint32_t rap_number)
 {
     uint32_t presentation_rap_number = vdhp->order_converter ? vdhp->order_converter[rap_number].decoding_to_presentation : rap_number;
-    return (vdhp->lw_seek_flags & SEEK_POS_BASED) ? vdhp->frame_list[presentation_rap_number].file_offset
-        : (vdhp->lw_seek_flags & SEEK_PTS_BASED)  ? vdhp->frame_list[presentation_rap_number].pts
-        : (vdhp->lw_seek_flags & SEEK_DTS_BASED)  ? vdhp->frame_list[presentation_rap_number].dts
-                                                  : vdhp->frame_list[presentation_rap_number].sample_number;
+    return (vdhp->lw_seek_flags & SEEK_POS_BASED) ? lw_frame_table_file_offset(&vdhp->frame_table, presentation_rap_number)
+        : (vdhp->lw_seek_flags & SEEK_PTS_BASED)  ? lw_frame_table_pts(&vdhp->frame_table, presentation_rap_number)
+        : (vdhp->lw_seek_flags & SEEK_DTS_BASED)  ? lw_frame_table_dts(&vdhp->frame_table, presentation_rap_number)
+                                                  : lw_frame_table_sample_number(&vdhp->frame_table, presentation_rap_number);
 }
 
 static inline uint32_t is_half_frame(lwlibav_video_decode_handler_t* vdhp, uint32_t output_picture_number)
 {
-    return (output_picture_number <= vdhp->frame_count && vdhp->frame_list[output_picture_number].repeat_pict == 0);
+    return (output_picture_number <= vdhp->frame_count && !lw_frame_table_is_repeated(&vdhp->frame_table, output_picture_number));
 }
 
 static void correct_output_delay(lwlibav_video_decode_handler_t* vdhp, uint32_t* goal_fed_picture_number, uint32_t reliable_picture_number,
@@ -560,7 +749,7 @@ static uint32_t seek_video(lwlibav_video_decode_handler_t* vdhp, AVFrame* frame,
 {
     /* Prepare to decode from random accessible picture. */
     lwlibav_extradata_handler_t* exhp = &vdhp->exh;
-    int extradata_index = vdhp->frame_list[rap_number].extradata_index;
+    int extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, rap_number);
     if (extradata_index != exhp->current_index)
         /* Update the decoder configuration. */
         lwlibav_update_configuration((lwlibav_decode_handler_t*)vdhp, rap_number, extradata_index, rap_pos);
@@ -617,7 +806,8 @@ static uint32_t seek_video(lwlibav_video_decode_handler_t* vdhp, AVFrame* frame,
             output_ready = 1;
         }
         /* Handle decoder delay derived from PAFF field coded pictures. */
-        else if (current <= vdhp->frame_count && current >= rap_number + decoder_delay && vdhp->frame_list[current].repeat_pict == 0) {
+        else if (current <= vdhp->frame_count && current >= rap_number + decoder_delay
+            && !lw_frame_table_is_repeated(&vdhp->frame_table, current)) {
             /* No output frame since the second field coded picture of the next frame is not decoded yet. */
             if (decoder_delay - thread_delay < 2 * vdhp->ctx->has_b_frames + 1UL) {
                 uint32_t new_decoder_delay = thread_delay + 2 * vdhp->ctx->has_b_frames + 1UL;
@@ -639,7 +829,7 @@ static uint32_t seek_video(lwlibav_video_decode_handler_t* vdhp, AVFrame* frame,
             lw_log_show(&vdhp->lh, LW_LOG_ERROR, "Failed to decode a video frame.");
             return 0;
         }
-        if (vdhp->frame_list[current].is_superframe)
+        if (lw_frame_table_is_superframe(&vdhp->frame_table, current))
             ++decoder_delay;
     }
     exhp->delay_count = MIN(decoder_delay, current - rap_number);
@@ -662,12 +852,12 @@ static inline int copy_last_req_frame(lwlibav_video_decode_handler_t* vdhp, AVFr
 static inline int field_number_of_picture_in_frame(lwlibav_video_decode_handler_t* vdhp, AVFrame* frame, uint32_t output_picture_number)
 {
     if (!!(frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST))
-        return vdhp->frame_list[output_picture_number].field_info == LW_FIELD_INFO_TOP   ? 1
-            : vdhp->frame_list[output_picture_number].field_info == LW_FIELD_INFO_BOTTOM ? 2
+        return lw_frame_table_field_info(&vdhp->frame_table, output_picture_number) == LW_FIELD_INFO_TOP   ? 1
+            : lw_frame_table_field_info(&vdhp->frame_table, output_picture_number) == LW_FIELD_INFO_BOTTOM ? 2
                                                                                          : 0;
     else
-        return vdhp->frame_list[output_picture_number].field_info == LW_FIELD_INFO_TOP   ? 2
-            : vdhp->frame_list[output_picture_number].field_info == LW_FIELD_INFO_BOTTOM ? 1
+        return lw_frame_table_field_info(&vdhp->frame_table, output_picture_number) == LW_FIELD_INFO_TOP   ? 2
+            : lw_frame_table_field_info(&vdhp->frame_table, output_picture_number) == LW_FIELD_INFO_BOTTOM ? 1
                                                                                          : 0;
 }
 
@@ -678,7 +868,7 @@ static int is_picture_stored_in_frame(lwlibav_video_decode_handler_t* vdhp, AVFr
     int64_t output_id = get_output_order_id(frame);
     if (output_id != AV_NOPTS_VALUE) {
         uint32_t reliable_picture_number = (uint32_t)output_id;
-        uint32_t target_decoding_id = vdhp->frame_list[picture_number].sample_number;
+        uint32_t target_decoding_id = lw_frame_table_sample_number(&vdhp->frame_table, picture_number);
         if (picture_number == reliable_picture_number && (int64_t)target_decoding_id == frame->pkt_dts)
             return 1;
         else if (is_half_frame(vdhp, reliable_picture_number) && (int64_t)target_decoding_id == frame->pkt_dts) {
@@ -816,7 +1006,7 @@ static int get_frame(lwlibav_video_decode_handler_t* vdhp, AVFrame* frame, /* re
                 picture_number = estimated_picture_number;
                 vdhp->last_half_frame = last_half_frame;
             }
-            current += (vdhp->frame_list[picture_number].flags & LW_VFRAME_FLAG_COUNTERPART_MISSING) ? 2 : 1;
+            current += (lw_frame_table_flags(&vdhp->frame_table, picture_number) & LW_VFRAME_FLAG_COUNTERPART_MISSING) ? 2 : 1;
         }
     return got_picture ? REQUESTED_FRAME_IS_ALREADY_ON_OUTPUT_FRAME_BUFFER : -1;
 return_last_frame:
@@ -827,6 +1017,47 @@ return_last_frame:
 #undef REQUESTED_FRAME_IS_ALREADY_ON_OUTPUT_FRAME_BUFFER
 }
 
+/* Park the active decoder and activate the other one.
+ * Each decoder keeps its own demuxer so that the parked one stays at the position where it left off. */
+static void swap_decoder_state(lwlibav_video_decode_handler_t* vdhp)
+{
+    lwlibav_video_decoder_state_t* warm = &vdhp->warm;
+    /* Inherit the application specific settings such as direct rendering. */
+    warm->ctx->get_buffer2 = vdhp->ctx->get_buffer2;
+    warm->ctx->opaque = vdhp->ctx->opaque;
+    lwlibav_video_decoder_state_t active;
+    active.format = vdhp->format;
+    active.ctx = vdhp->ctx;
+    active.packet = vdhp->packet;
+    active.current_index = vdhp->exh.current_index;
+    active.delay_count = vdhp->exh.delay_count;
+    active.last_half_frame = vdhp->last_half_frame;
+    active.last_frame_number = vdhp->last_frame_number;
+    active.last_rap_number = vdhp->last_rap_number;
+    active.last_fed_picture_number = vdhp->last_fed_picture_number;
+    active.reuse_pkt = vdhp->reuse_pkt;
+    vdhp->format = warm->format;
+    vdhp->ctx = warm->ctx;
+    vdhp->packet = warm->packet;
+    vdhp->exh.current_index = warm->current_index;
+    vdhp->exh.delay_count = warm->delay_count;
+    vdhp->last_half_frame = warm->last_half_frame;
+    vdhp->last_frame_number = warm->last_frame_number;
+    vdhp->last_rap_number = warm->last_rap_number;
+    vdhp->last_fed_picture_number = warm->last_fed_picture_number;
+    vdhp->reuse_pkt = warm->reuse_pkt;
+    *warm = active;
+}
+
+/* Answer whether the parked decoder can output the requested picture without seeking.
+ * The frame buffer holds the output of the active decoder, so only strictly forward decoding
+ * of frame coded pictures is resumed. */
+static inline int is_warm_decoder_resumable(lwlibav_video_decode_handler_t* vdhp, uint32_t picture_number, uint32_t rap_number)
+{
+    lwlibav_video_decoder_state_t* warm = &vdhp->warm;
+    return warm->ctx && rap_number == warm->last_rap_number && picture_number > warm->last_frame_number && !warm->last_half_frame;
+}
+
 static inline uint32_t get_last_half_offset(lwlibav_video_decode_handler_t* vdhp)
 {
     if (!vdhp->last_half_frame)
@@ -846,7 +1077,7 @@ static int get_requested_picture(lwlibav_video_decode_handler_t* vdhp, AVFrame*
         /* The last frame is the requested frame. */
         if (copy_last_req_frame(vdhp, frame) < 0)
             goto video_fail;
-        extradata_index = vdhp->frame_list[picture_number].extradata_index;
+        extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, picture_number);
         goto return_frame;
     }
     if (picture_number < vdhp->first_valid_frame_number || vdhp->frame_count == 1) {
@@ -857,7 +1088,7 @@ static int get_requested_picture(lwlibav_video_decode_handler_t* vdhp, AVFrame*
         /* Force seeking at the next access for valid video frame. */
         vdhp->last_frame_number = vdhp->frame_count + 1;
         /* Return the first valid video frame. */
-        extradata_index = vdhp->frame_list[vdhp->first_valid_frame_number].extradata_index;
+        extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, vdhp->first_valid_frame_number);
         goto return_frame;
     }
     uint32_t start_number; /* number of picture, for normal decoding, where decoding starts excluding decoding delay */
@@ -872,7 +1103,14 @@ static int get_requested_picture(lwlibav_video_decode_handler_t* vdhp, AVFrame*
         find_random_accessible_point(vdhp, picture_number, 0, &rap_number);
         if (rap_number == vdhp->last_rap_number && picture_number > last_frame_number)
             start_number = vdhp->last_fed_picture_number + 1;
-        else {
+        else if (is_warm_decoder_resumable(vdhp, picture_number, rap_number)) {
+            /* The parked decoder is on the way to the requested picture. */
+            swap_decoder_state(vdhp);
+            start_number = vdhp->last_fed_picture_number + 1;
+        } else {
+            /* Keep the active decoder warm at the current position and seek by the other one. */
+            if (vdhp->warm.ctx)
+                swap_decoder_state(vdhp);
             /* Require starting to decode from random accessible picture. */
             rap_pos = get_random_accessible_point_position(vdhp, rap_number);
             vdhp->last_rap_number = rap_number;
@@ -899,7 +1137,7 @@ static int get_requested_picture(lwlibav_video_decode_handler_t* vdhp, AVFrame*
         start_number = seek_video(vdhp, frame, picture_number, rap_number, rap_pos, seek_mode != SEEK_MODE_NORMAL);
     }
     vdhp->last_frame_number = picture_number;
-    extradata_index = vdhp->frame_list[picture_number].extradata_index;
+    extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, picture_number);
 return_frame:;
     vdhp->last_req_frame = frame;
     /* Don't exceed the maximum presentation size specified for each sequence. */
@@ -909,7 +1147,7 @@ return_frame:;
     if (vdhp->ctx->height > entry->height)
         vdhp->ctx->height = entry->height;
     /* Set the actual PTS here. */
-    frame->pts = vdhp->frame_list[picture_number].pts;
+    frame->pts = lw_frame_table_pts(&vdhp->frame_table, picture_number);
     return 0;
 video_fail:
     /* fatal error of decoding */
@@ -1063,11 +1301,22 @@ static int lwlibav_repeat_control(lwlibav_video_decode_handler_t* vdhp, lwlibav_
 
 static int64_t lwlibav_get_ts(lwlibav_video_decode_handler_t* vdhp, uint32_t frame_number)
 {
-    return (vdhp->lw_seek_flags & (SEEK_PTS_GENERATED | SEEK_PTS_BASED)) ? vdhp->frame_list[frame_number].pts
-        : (vdhp->lw_seek_flags & SEEK_DTS_BASED)                         ? vdhp->frame_list[frame_number].dts
+    return (vdhp->lw_seek_flags & (SEEK_PTS_GENERATED | SEEK_PTS_BASED)) ? lw_frame_table_pts(&vdhp->frame_table, frame_number)
+        : (vdhp->lw_seek_flags & SEEK_DTS_BASED)                         ? lw_frame_table_dts(&vdhp->frame_table, frame_number)
                                                                          : AV_NOPTS_VALUE;
 }
 
+static int get_presentation_time(void* opaque, uint32_t frame_number, double* time)
+{
+    lwlibav_video_decode_handler_t* vdhp = (lwlibav_video_decode_handler_t*)opaque;
+    int64_t ts = lwlibav_get_ts(vdhp, frame_number);
+    if (ts == AV_NOPTS_VALUE)
+        return 1;
+    AVRational time_base = vdhp->format->streams[vdhp->stream_index]->time_base;
+    *time = ((double)(ts - vdhp->min_ts) * time_base.num) / time_base.den;
+    return 0;
+}
+
 static uint32_t lwlibav_vfr2cfr(lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp, uint32_t frame_number)
 {
     if (vdhp->lw_seek_flags & SEEK_PTS_GENERATED) {
@@ -1077,6 +1326,12 @@ static uint32_t lwlibav_vfr2cfr(lwlibav_video_decode_handler_t* vdhp, lwlibav_vi
         vdhp->last_ts_frame_number = source_frame_number; // Update the cache hint
         return source_frame_number;
     }
+    if (!vohp->cfr_map && !vohp->cfr_map_unavailable)
+        lw_setup_cfr_map(vohp, vdhp->frame_count, get_presentation_time, vdhp);
+    if (vohp->cfr_map && frame_number <= vohp->frame_count) {
+        vdhp->last_ts_frame_number = vohp->cfr_map[frame_number];
+        return vdhp->last_ts_frame_number;
+    }
     /* Convert VFR to CFR. */
     double target_ts = (double)((uint64_t)(frame_number - 1) * vohp->cfr_den) / vohp->cfr_num;
     double current_ts = DBL_MAX;
@@ -1167,6 +1422,8 @@ static int get_video_frame(lwlibav_video_decode_handler_t* vdhp, lwlibav_video_o
  * Return a negative value otherwise. */
 int lwlibav_video_get_frame(lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp, uint32_t frame_number)
 {
+    /* Decoding moves the demuxer. */
+    vdhp->last_copied_sample_number = 0;
     if (vohp->vfr2cfr) {
         frame_number = lwlibav_vfr2cfr(vdhp, vohp, frame_number);
         if (frame_number == 0)
@@ -1187,10 +1444,19 @@ int lwlibav_video_is_keyframe(lwlibav_video_decode_handler_t* vdhp, lwlibav_vide
     if (vohp->repeat_control) {
         lw_video_frame_order_t* curr = &vohp->frame_order_list[frame_number];
         lw_video_frame_order_t* prev = &vohp->frame_order_list[frame_number - 1];
-        return ((vdhp->frame_list[curr->top].flags & LW_VFRAME_FLAG_KEY) && curr->top != prev->top && curr->top != prev->bottom)
-            || ((vdhp->frame_list[curr->bottom].flags & LW_VFRAME_FLAG_KEY) && curr->bottom != prev->top && curr->bottom != prev->bottom);
+        const lw_frame_table_t* table = &vdhp->frame_table;
+        return ((lw_frame_table_flags(table, curr->top) & LW_VFRAME_FLAG_KEY) && curr->top != prev->top && curr->top != prev->bottom)
+            || ((lw_frame_table_flags(table, curr->bottom) & LW_VFRAME_FLAG_KEY) && curr->bottom != prev->top
+                && curr->bottom != prev->bottom);
     }
-    return !!(vdhp->frame_list[frame_number].flags & LW_VFRAME_FLAG_KEY);
+    return !!(lw_frame_table_flags(&vdhp->frame_table, frame_number) & LW_VFRAME_FLAG_KEY);
+}
+
+static inline void setup_av_seek_flags(lwlibav_video_decode_handler_t* vdhp)
+{
+    vdhp->av_seek_flags = (vdhp->lw_seek_flags & SEEK_POS_BASED) ? AVSEEK_FLAG_BYTE : vdhp->lw_seek_flags == 0 ? AVSEEK_FLAG_FRAME : 0;
+    if (vdhp->frame_count != 1)
+        vdhp->av_seek_flags |= AVSEEK_FLAG_BACKWARD;
 }
 
 int lwlibav_video_find_first_valid_frame(lwlibav_video_decode_handler_t* vdhp)
@@ -1203,9 +1469,8 @@ int lwlibav_video_find_first_valid_frame(lwlibav_video_decode_handler_t* vdhp)
     handle_decoder_pix_fmt(codecpar, codec, (enum AVPixelFormat)codecpar->format);
     vdhp->ctx->pix_fmt = (enum AVPixelFormat)codecpar->format; /* Correct decoder pixel format. */
     vdhp->last_ts_frame_number = vdhp->frame_count;
-    vdhp->av_seek_flags = (vdhp->lw_seek_flags & SEEK_POS_BASED) ? AVSEEK_FLAG_BYTE : vdhp->lw_seek_flags == 0 ? AVSEEK_FLAG_FRAME : 0;
+    setup_av_seek_flags(vdhp);
     if (vdhp->frame_count != 1) {
-        vdhp->av_seek_flags |= AVSEEK_FLAG_BACKWARD;
         uint32_t rap_number;
         find_random_accessible_point(vdhp, 1, 0, &rap_number);
         int64_t rap_pos = get_random_accessible_point_position(vdhp, rap_number);
@@ -1226,7 +1491,7 @@ int lwlibav_video_find_first_valid_frame(lwlibav_video_decode_handler_t* vdhp)
             return -1;
         }
         /* Handle decoder delay derived from PAFF field coded pictures. */
-        if (i <= vdhp->frame_count && i > decoder_delay && !got_picture && vdhp->frame_list[i].repeat_pict == 0) {
+        if (i <= vdhp->frame_count && i > decoder_delay && !got_picture && !lw_frame_table_is_repeated(&vdhp->frame_table, i)) {
             /* No output picture since the second field coded picture of the next frame is not decoded yet. */
             if (decoder_delay - thread_delay < 2 * vdhp->ctx->has_b_frames + 1UL)
                 decoder_delay = thread_delay + 2 * vdhp->ctx->has_b_frames + 1UL;
@@ -1244,7 +1509,7 @@ int lwlibav_video_find_first_valid_frame(lwlibav_video_decode_handler_t* vdhp)
                     if (!vdhp->first_valid_frame)
                         return -1;
                     av_frame_unref(vdhp->frame_buffer);
-                    vdhp->first_valid_frame->pts = vdhp->frame_list[vdhp->first_valid_frame_number].pts;
+                    vdhp->first_valid_frame->pts = lw_frame_table_pts(&vdhp->frame_table, vdhp->first_valid_frame_number);
                 }
                 break;
             } else if (pkt->data)
@@ -1259,16 +1524,191 @@ int lwlibav_video_find_first_valid_frame(lwlibav_video_decode_handler_t* vdhp)
     return 0;
 }
 
+/* Get the range of packets in decoding order required to decode the given frames in presentation order.
+ * The range starts at the random accessible picture, so some packets in the range might be presented outside the given frames.
+ * Note that the frame numbers here are not affected by the repeat control and the VFR to CFR conversion.
+ * Return 0 if successful. Otherwise, return -1. */
+int lwlibav_video_get_packet_range(lwlibav_video_decode_handler_t* vdhp, uint32_t first_frame_number, uint32_t last_frame_number,
+    uint32_t* first_sample_number, uint32_t* last_sample_number)
+{
+    if (first_frame_number == 0 || first_frame_number > last_frame_number || last_frame_number > vdhp->frame_count)
+        return -1;
+    uint32_t rap_number;
+    find_random_accessible_point(vdhp, first_frame_number, 0, &rap_number);
+    uint32_t last = rap_number;
+    for (uint32_t i = first_frame_number; i <= last_frame_number; i++)
+        last = MAX(last, lw_frame_table_sample_number(&vdhp->frame_table, i));
+    *first_sample_number = rap_number;
+    *last_sample_number = last;
+    return 0;
+}
+
+/* Read the packet of the given number in decoding order without decoding.
+ * The timestamps of the packet are replaced with the indexed ones in the time base of the stream.
+ * Sequential reading continues from the last position, otherwise seek to the random accessible picture.
+ * The next frame request forces seeking since this moves the demuxer.
+ * Return 0 if successful. Otherwise, return -1. */
+int lwlibav_video_get_packet(lwlibav_video_decode_handler_t* vdhp, uint32_t sample_number, AVPacket* pkt, int* extradata_index)
+{
+    if (sample_number == 0 || sample_number > vdhp->frame_count || !vdhp->format)
+        return -1;
+    lwlibav_video_force_seek(vdhp);
+    uint32_t current = vdhp->last_copied_sample_number;
+    vdhp->last_copied_sample_number = 0;
+    if (current == 0 || sample_number <= current || sample_number > current + vdhp->forward_seek_threshold) {
+        /* Seek to the random accessible picture. */
+        uint32_t presentation_number = vdhp->order_converter ? vdhp->order_converter[sample_number].decoding_to_presentation : sample_number;
+        uint32_t rap_number;
+        find_random_accessible_point(vdhp, presentation_number, sample_number, &rap_number);
+        int64_t rap_pos = get_random_accessible_point_position(vdhp, rap_number);
+        setup_av_seek_flags(vdhp);
+        if (lavf_seek_frame(vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags) < 0)
+            lavf_seek_frame(vdhp->format, vdhp->stream_index, rap_pos, vdhp->av_seek_flags | AVSEEK_FLAG_ANY);
+        if (lwlibav_get_av_frame(vdhp->format, vdhp->stream_index, rap_number, pkt))
+            return -1;
+        current = rap_number;
+        if (vdhp->lw_seek_flags & (SEEK_DTS_BASED | SEEK_PTS_BASED)) {
+            /* Correct the current packet number since libavformat might have sought wrong position. */
+            vdhp->last_rap_number = rap_number;
+            current = correct_current_frame_number(vdhp, pkt, rap_number, sample_number);
+            if (current == 0 || current > sample_number)
+                return -1;
+        }
+    } else {
+        if (lwlibav_get_av_frame(vdhp->format, vdhp->stream_index, current + 1, pkt))
+            return -1;
+        ++current;
+    }
+    while (current < sample_number) {
+        if (lwlibav_get_av_frame(vdhp->format, vdhp->stream_index, current + 1, pkt))
+            return -1;
+        ++current;
+    }
+    vdhp->last_copied_sample_number = current;
+    uint32_t presentation_number = vdhp->order_converter ? vdhp->order_converter[current].decoding_to_presentation : current;
+    pkt->pts = lw_frame_table_pts(&vdhp->frame_table, presentation_number);
+    pkt->dts = lw_frame_table_dts(&vdhp->frame_table, presentation_number);
+    if (vdhp->keyframe_list[current])
+        pkt->flags |= AV_PKT_FLAG_KEY;
+    else
+        pkt->flags &= ~AV_PKT_FLAG_KEY;
+    if (extradata_index)
+        *extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, presentation_number);
+    return 0;
+}
+
+static int build_keyframe_position_list(lwlibav_video_decode_handler_t* vdhp)
+{
+    if (vdhp->keyframe_position_list)
+        return 0;
+#define IS_OUTPUT_KEYFRAME(flags) \
+    (((flags) & (LW_VFRAME_FLAG_KEY | LW_VFRAME_FLAG_INVISIBLE | LW_VFRAME_FLAG_CORRUPT)) == LW_VFRAME_FLAG_KEY)
+    uint32_t count = 0;
+    for (uint32_t i = 1; i <= vdhp->frame_count; i++)
+        if (IS_OUTPUT_KEYFRAME(lw_frame_table_flags(&vdhp->frame_table, i)))
+            ++count;
+    if (count == 0)
+        return -1;
+    vdhp->keyframe_position_list = (uint32_t*)lw_malloc_zero(count * sizeof(uint32_t));
+    if (!vdhp->keyframe_position_list) {
+        lw_log_show(&vdhp->lh, LW_LOG_ERROR, "Failed to allocate the keyframe list.");
+        return -1;
+    }
+    count = 0;
+    for (uint32_t i = 1; i <= vdhp->frame_count; i++)
+        if (IS_OUTPUT_KEYFRAME(lw_frame_table_flags(&vdhp->frame_table, i)))
+            vdhp->keyframe_position_list[count++] = i;
+    vdhp->keyframe_position_count = count;
+    return 0;
+#undef IS_OUTPUT_KEYFRAME
+}
+
+/* Return the number of keyframes available for keyframe-only decoding. */
+uint32_t lwlibav_video_get_keyframe_count(lwlibav_video_decode_handler_t* vdhp)
+{
+    return build_keyframe_position_list(vdhp) < 0 ? 0 : vdhp->keyframe_position_count;
+}
+
+/* Return the frame number in presentation order of the keyframe.
+ * Return 0 if the keyframe is not found. */
+uint32_t lwlibav_video_get_keyframe_position(lwlibav_video_decode_handler_t* vdhp, uint32_t keyframe_number)
+{
+    if (build_keyframe_position_list(vdhp) < 0 || keyframe_number == 0 || keyframe_number > vdhp->keyframe_position_count)
+        return 0;
+    return vdhp->keyframe_position_list[keyframe_number - 1];
+}
+
+/* Decode only the requested keyframe (1-origin in the keyframe list).
+ * The decoder discards non-key pictures and skips the loop filter, and seeks directly to the keyframe
+ * since no preceding pictures are required.
+ * Return 0 if successful. Otherwise, return a negative value. */
+int lwlibav_video_get_keyframe(lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp, uint32_t keyframe_number)
+{
+    uint32_t picture_number = lwlibav_video_get_keyframe_position(vdhp, keyframe_number);
+    if (picture_number == 0 || vdhp->error)
+        return -1;
+    uint32_t sample_number = lw_frame_table_sample_number(&vdhp->frame_table, picture_number);
+    int extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, picture_number);
+    /* The normal decoding shall start from seeking after this. */
+    lwlibav_video_force_seek(vdhp);
+    vdhp->reuse_pkt = 0;
+    if (extradata_index != vdhp->exh.current_index)
+        lwlibav_update_configuration(
+            (lwlibav_decode_handler_t*)vdhp, sample_number, extradata_index, get_random_accessible_point_position(vdhp, sample_number));
+    else
+        lwlibav_flush_buffers((lwlibav_decode_handler_t*)vdhp);
+    if (vdhp->error)
+        return -1;
+    AVCodecContext* ctx = vdhp->ctx;
+    ctx->skip_frame = AVDISCARD_NONKEY;
+    ctx->skip_loop_filter = AVDISCARD_ALL;
+    AVPacket* pkt = &vdhp->packet;
+    AVFrame* mov_frame = vdhp->movable_frame_buffer;
+    int got_picture = 0;
+    int ret = 0;
+    /* Feed the keyframe, and the second field if the keyframe is field coded. */
+    uint32_t last_sample_number = MIN(sample_number + (is_half_frame(vdhp, picture_number) ? 1 : 0), vdhp->frame_count);
+    vdhp->last_copied_sample_number = 0;
+    for (uint32_t i = sample_number; i <= last_sample_number && !got_picture && ret == 0; i++) {
+        if (lwlibav_video_get_packet(vdhp, i, pkt, NULL) < 0) {
+            ret = -1;
+            break;
+        }
+        av_frame_unref(mov_frame);
+        ret = decode_video_packet(ctx, mov_frame, &got_picture, pkt);
+    }
+    vdhp->last_copied_sample_number = 0;
+    /* Drain the decoder to get the picture. */
+    for (uint32_t i = 0; i <= get_decoder_delay(ctx) && !got_picture && ret == 0; i++) {
+        AVPacket null_pkt = { 0 };
+        av_frame_unref(mov_frame);
+        ret = decode_video_packet(ctx, mov_frame, &got_picture, &null_pkt);
+    }
+    ctx->skip_frame = AVDISCARD_DEFAULT;
+    ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+    if (ret < 0 || !got_picture) {
+        lw_log_show(&vdhp->lh, LW_LOG_ERROR, "Failed to decode the keyframe %" PRIu32 ".", picture_number);
+        return -1;
+    }
+    av_frame_unref(vdhp->frame_buffer);
+    if (transfer_frame_data(vdhp->frame_buffer, mov_frame)) {
+        lw_log_show(&vdhp->lh, LW_LOG_ERROR, "Failed to transfer a video frame.");
+        return -1;
+    }
+    vdhp->frame_buffer->pts = lw_frame_table_pts(&vdhp->frame_table, picture_number);
+    return update_scaler_configuration_if_needed(&vohp->scaler, &vdhp->lh, vdhp->frame_buffer) < 0 ? -1 : 0;
+}
+
 enum lw_field_info lwlibav_video_get_field_info(lwlibav_video_decode_handler_t* vdhp, uint32_t frame_number)
 {
-    return frame_number <= vdhp->frame_count ? vdhp->frame_list[frame_number].field_info : LW_FIELD_INFO_UNKNOWN;
+    return frame_number <= vdhp->frame_count ? lw_frame_table_field_info(&vdhp->frame_table, frame_number) : LW_FIELD_INFO_UNKNOWN;
 }
 
 void set_video_basic_settings(lwlibav_decode_handler_t* dhp, const AVCodec* codec, uint32_t frame_number)
 {
     lwlibav_video_decode_handler_t* vdhp = (lwlibav_video_decode_handler_t*)dhp;
     AVCodecParameters* codecpar = vdhp->format->streams[vdhp->stream_index]->codecpar;
-    lwlibav_extradata_t* entry = &vdhp->exh.entries[vdhp->frame_list[frame_number].extradata_index];
+    lwlibav_extradata_t* entry = &vdhp->exh.entries[lw_frame_table_extradata_index(&vdhp->frame_table, frame_number)];
     codecpar->width = entry->width;
     codecpar->height = entry->height;
     codecpar->bits_per_coded_sample = entry->bits_per_sample;
@@ -1293,7 +1733,7 @@ int try_decode_video_frame(lwlibav_decode_handler_t* dhp, uint32_t frame_number,
             break;
         /* Get a frame. */
         AVPacket pkt = { 0 };
-        int extradata_index = vdhp->frame_list[frame_number].extradata_index;
+        int extradata_index = lw_frame_table_extradata_index(&vdhp->frame_table, frame_number);
         if (extradata_index != vdhp->exh.current_index)
             break;
         int ret = lwlibav_get_av_frame(format_ctx, stream_index, frame_number, &pkt);
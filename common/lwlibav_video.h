@@ -58,6 +58,8 @@ void lwlibav_video_free_decode_handler_ptr(lwlibav_video_decode_handler_t** vdhp
 
 void lwlibav_video_free_output_handler_ptr(lwlibav_video_output_handler_t** vohpp);
 
+int lwlibav_video_build_frame_table(lwlibav_video_decode_handler_t* vdhp);
+
 /*****************************************************************************
  * Setters
  *****************************************************************************/
@@ -71,6 +73,8 @@ void lwlibav_video_set_prefer_hw_decoder(lwlibav_video_decode_handler_t* vdhp, i
 
 void lwlibav_video_set_decoder_options(lwlibav_video_decode_handler_t* vdhp, const char* ff_options);
 
+void lwlibav_video_set_warm_decoder(lwlibav_video_decode_handler_t* vdhp, int warm_decoder);
+
 void lwlibav_video_set_log_handler(lwlibav_video_decode_handler_t* vdhp, lw_log_handler_t* lh);
 
 void lwlibav_video_set_get_buffer_func(lwlibav_video_decode_handler_t* vdhp);
@@ -92,6 +96,10 @@ int lwlibav_video_get_max_height(lwlibav_video_decode_handler_t* vdhp);
 
 AVFrame* lwlibav_video_get_frame_buffer(lwlibav_video_decode_handler_t* vdhp);
 
+AVRational lwlibav_video_get_time_base(lwlibav_video_decode_handler_t* vdhp);
+
+const lwlibav_extradata_t* lwlibav_video_get_extradata(lwlibav_video_decode_handler_t* vdhp, int extradata_index);
+
 /*****************************************************************************
  * Others
  *****************************************************************************/
@@ -99,6 +107,10 @@ void lwlibav_video_force_seek(lwlibav_video_decode_handler_t* vdhp);
 
 int lwlibav_video_get_desired_track(const char* file_path, lwlibav_video_decode_handler_t* vdhp, int threads);
 
+/* Same as lwlibav_video_get_desired_track() but without opening any decoder,
+ * for reading packets by lwlibav_video_get_packet() only. */
+int lwlibav_video_get_desired_track_packets(const char* file_path, lwlibav_video_decode_handler_t* vdhp);
+
 void lwlibav_video_setup_timestamp_info(lwlibav_file_handler_t* lwhp, lwlibav_video_decode_handler_t* vdhp,
     lwlibav_video_output_handler_t* vohp, int64_t* framerate_num, int64_t* framerate_den, int apply_repeat_flag);
 
@@ -110,6 +122,17 @@ int lwlibav_video_is_keyframe(lwlibav_video_decode_handler_t* vdhp, lwlibav_vide
 
 int lwlibav_video_find_first_valid_frame(lwlibav_video_decode_handler_t* vdhp);
 
+int lwlibav_video_get_packet_range(lwlibav_video_decode_handler_t* vdhp, uint32_t first_frame_number, uint32_t last_frame_number,
+    uint32_t* first_sample_number, uint32_t* last_sample_number);
+
+int lwlibav_video_get_packet(lwlibav_video_decode_handler_t* vdhp, uint32_t sample_number, AVPacket* pkt, int* extradata_index);
+
+uint32_t lwlibav_video_get_keyframe_count(lwlibav_video_decode_handler_t* vdhp);
+
+uint32_t lwlibav_video_get_keyframe_position(lwlibav_video_decode_handler_t* vdhp, uint32_t keyframe_number);
+
+int lwlibav_video_get_keyframe(lwlibav_video_decode_handler_t* vdhp, lwlibav_video_output_handler_t* vohp, uint32_t keyframe_number);
+
 enum lw_field_info lwlibav_video_get_field_info(lwlibav_video_decode_handler_t* vdhp, uint32_t frame_number);
 
 #ifdef __cplusplus
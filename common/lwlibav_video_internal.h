@@ -49,10 +49,106 @@ typedef struct {
     uint8_t is_superframe;
 } video_frame_info_t;
 
+/* Frames are grouped into blocks of (1 << LW_FRAME_TABLE_BLOCK_SHIFT) entries.
+ * 64-bit values are stored as 32-bit deltas from the base value of their block. */
+#define LW_FRAME_TABLE_BLOCK_SHIFT 6
+#define LW_FRAME_TABLE_NO_VALUE INT32_MIN /* delta representing AV_NOPTS_VALUE */
+
+#define LW_FRAME_TABLE_FLAGS_MASK 0x1f /* LW_VFRAME_FLAG_*s */
+#define LW_FRAME_TABLE_FIELD_INFO_SHIFT 5
+#define LW_FRAME_TABLE_FIELD_INFO_MASK (0x3 << LW_FRAME_TABLE_FIELD_INFO_SHIFT)
+#define LW_FRAME_TABLE_SUPERFRAME 0x80
+#define LW_FRAME_TABLE_REPEAT 0x100 /* repeat_pict is non-zero */
+
+typedef struct {
+    int64_t* base; /* base value of each block */
+    int32_t* delta; /* difference from the base value of the block */
+    int64_t* full; /* raw values used instead of base and delta when some value is too far from its base */
+} lw_frame_table_column_t;
+
+/* Compact frame table stored in presentation order.
+ * This is built from frame_list after the index is constructed, and the 0th entry is a dummy as well as frame_list. */
+typedef struct {
+    lw_frame_table_column_t pts;
+    lw_frame_table_column_t dts;
+    lw_frame_table_column_t file_offset;
+    uint32_t* sample_number;
+    uint16_t* extradata_index;
+    int32_t* extradata_index_full; /* used instead of extradata_index when some index does not fit in 16 bits */
+    uint16_t* bits; /* flags, field_info, is_superframe and repeat_pict packed by LW_FRAME_TABLE_* */
+} lw_frame_table_t;
+
+static inline int64_t lw_frame_table_column_get(const lw_frame_table_column_t* column, uint32_t n)
+{
+    if (column->full)
+        return column->full[n];
+    int32_t delta = column->delta[n];
+    return delta == LW_FRAME_TABLE_NO_VALUE ? AV_NOPTS_VALUE : column->base[n >> LW_FRAME_TABLE_BLOCK_SHIFT] + delta;
+}
+
+static inline int64_t lw_frame_table_pts(const lw_frame_table_t* table, uint32_t n)
+{
+    return lw_frame_table_column_get(&table->pts, n);
+}
+
+static inline int64_t lw_frame_table_dts(const lw_frame_table_t* table, uint32_t n)
+{
+    return lw_frame_table_column_get(&table->dts, n);
+}
+
+static inline int64_t lw_frame_table_file_offset(const lw_frame_table_t* table, uint32_t n)
+{
+    return lw_frame_table_column_get(&table->file_offset, n);
+}
+
+static inline uint32_t lw_frame_table_sample_number(const lw_frame_table_t* table, uint32_t n)
+{
+    return table->sample_number[n];
+}
+
+static inline int lw_frame_table_extradata_index(const lw_frame_table_t* table, uint32_t n)
+{
+    return table->extradata_index_full ? table->extradata_index_full[n] : table->extradata_index[n];
+}
+
+static inline int lw_frame_table_flags(const lw_frame_table_t* table, uint32_t n)
+{
+    return table->bits[n] & LW_FRAME_TABLE_FLAGS_MASK;
+}
+
+static inline lw_field_info_t lw_frame_table_field_info(const lw_frame_table_t* table, uint32_t n)
+{
+    return (lw_field_info_t)((table->bits[n] & LW_FRAME_TABLE_FIELD_INFO_MASK) >> LW_FRAME_TABLE_FIELD_INFO_SHIFT);
+}
+
+static inline int lw_frame_table_is_superframe(const lw_frame_table_t* table, uint32_t n)
+{
+    return !!(table->bits[n] & LW_FRAME_TABLE_SUPERFRAME);
+}
+
+static inline int lw_frame_table_is_repeated(const lw_frame_table_t* table, uint32_t n)
+{
+    return !!(table->bits[n] & LW_FRAME_TABLE_REPEAT);
+}
+
 typedef struct {
     uint32_t decoding_to_presentation;
 } order_converter_t;
 
+/* Positional state of a decoder which can be parked and resumed later. */
+typedef struct {
+    AVFormatContext* format;
+    AVCodecContext* ctx;
+    AVPacket packet;
+    int current_index; /* index of extradata the decoder is configured with */
+    uint32_t delay_count;
+    uint32_t last_half_frame;
+    uint32_t last_frame_number;
+    uint32_t last_rap_number;
+    uint32_t last_fed_picture_number;
+    int reuse_pkt;
+} lwlibav_video_decoder_state_t;
+
 struct lwlibav_video_decode_handler_tag {
     /* common */
     AVFormatContext* format;
@@ -72,10 +168,12 @@ struct lwlibav_video_decode_handler_tag {
     AVRational time_base;
     uint32_t frame_count;
     AVFrame* frame_buffer;
-    video_frame_info_t* frame_list; /* stored in presentation order */
+    video_frame_info_t* frame_list; /* stored in presentation order
+                                     * This is used only while constructing the index and freed after frame_table is built. */
     const char* ff_options;
     double drc; /* dummy */
     AVBufferRef* hw_device_ctx;
+    lw_frame_table_t frame_table;
     /* */
     uint32_t forward_seek_threshold;
     int seek_mode;
@@ -88,6 +186,8 @@ struct lwlibav_video_decode_handler_tag {
     AVPacket packet;
     order_converter_t* order_converter; /* maps of decoding to presentation stored in decoding order */
     uint8_t* keyframe_list; /* keyframe list stored in decoding order */
+    uint32_t* keyframe_position_list; /* presentation order numbers of keyframes, built on demand for keyframe-only decoding */
+    uint32_t keyframe_position_count;
     uint32_t last_half_frame; /* The last frame consists of complementary field coded picture pair
                                * if set to non-zero, otherwise single frame coded picture. */
     uint32_t last_frame_number; /* the number of the last requested frame */
@@ -109,6 +209,10 @@ struct lwlibav_video_decode_handler_tag {
     AVRational actual_time_base;
     int strict_cfr;
     int reuse_pkt;
+    uint32_t last_copied_sample_number; /* the number of the last packet read without decoding
+                                         * 0 if the demuxer is not positioned for sequential reading */
+    int warm_decoder; /* Keep the second decoder positioned in the previously decoded GOP if set to non-zero. */
+    lwlibav_video_decoder_state_t warm; /* the parked decoder */
 };
 
 #endif // !LWLIBAV_VIDEO_INTERNAL_H
@@ -64,6 +64,32 @@ FILE* lw_win32_fopen(const char* name, const char* mode)
     return fp;
 }
 
+/* Unlike rename() of the CRT, an existing destination is replaced. */
+int lw_win32_rename(const char* oldname, const char* newname)
+{
+    wchar_t *wold = 0, *wnew = 0;
+    int ret = -1;
+    if (lw_string_to_wchar(CP_UTF8, oldname, &wold) && lw_string_to_wchar(CP_UTF8, newname, &wnew))
+        ret = MoveFileExW(wold, wnew, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+    else
+        ret = MoveFileExA(oldname, newname, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+    lw_freep(&wold);
+    lw_freep(&wnew);
+    return ret;
+}
+
+int lw_win32_remove(const char* name)
+{
+    wchar_t* wname = 0;
+    int ret;
+    if (lw_string_to_wchar(CP_UTF8, name, &wname))
+        ret = _wremove(wname);
+    else
+        ret = remove(name);
+    lw_freep(&wname);
+    return ret;
+}
+
 char* lw_realpath(const char* path, char* resolved)
 {
     wchar_t *wpath = 0, *wresolved = 0;
@@ -83,4 +109,618 @@ char* lw_realpath(const char* path, char* resolved)
     return ret;
 }
 
+#define LW_FILE_LOCK_MAX_RETRIES 500 /* 5 seconds */
+
+struct lw_file_lock_tag {
+    HANDLE handle;
+};
+
+/* Locks on Windows belong to the handle, so the threads of this process also exclude each other.
+ * The file is deleted once the last handle to it is closed. Until then it cannot be opened again, which is retried for a while,
+ * since the waiters still holding it usually release it soon after the index they waited for is written. */
+lw_file_lock_t* lw_lock_file(const char* path)
+{
+    wchar_t* wpath = 0;
+    HANDLE handle;
+    int wide = lw_string_to_wchar(CP_UTF8, path, &wpath);
+    for (int retry = 0;; retry++) {
+        if (wide)
+            handle = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        else
+            handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (handle != INVALID_HANDLE_VALUE || GetLastError() != ERROR_ACCESS_DENIED || retry == LW_FILE_LOCK_MAX_RETRIES)
+            break;
+        Sleep(10);
+    }
+    lw_freep(&wpath);
+    if (handle == INVALID_HANDLE_VALUE)
+        return NULL;
+    OVERLAPPED overlapped = { 0 };
+    lw_file_lock_t* lock = (lw_file_lock_t*)lw_malloc_zero(sizeof(lw_file_lock_t));
+    if (!lock || !LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+        lw_free(lock);
+        CloseHandle(handle);
+        return NULL;
+    }
+    lock->handle = handle;
+    return lock;
+}
+
+void lw_unlock_file(lw_file_lock_t* lock)
+{
+    if (!lock)
+        return;
+    OVERLAPPED overlapped = { 0 };
+    UnlockFileEx(lock->handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+    CloseHandle(lock->handle);
+    lw_free(lock);
+}
+
+/* Slim reader/writer locks need no cleanup and can be initialized statically. */
+struct lw_mutex_tag {
+    SRWLOCK lock;
+};
+
+static SRWLOCK global_mutex = SRWLOCK_INIT;
+
+lw_mutex_t* lw_create_mutex(void)
+{
+    lw_mutex_t* mutex = (lw_mutex_t*)lw_malloc_zero(sizeof(lw_mutex_t));
+    if (mutex)
+        InitializeSRWLock(&mutex->lock);
+    return mutex;
+}
+
+void lw_destroy_mutex(lw_mutex_t* mutex)
+{
+    lw_free(mutex);
+}
+
+void lw_lock_mutex(lw_mutex_t* mutex)
+{
+    AcquireSRWLockExclusive(&mutex->lock);
+}
+
+void lw_unlock_mutex(lw_mutex_t* mutex)
+{
+    ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+void lw_lock_global_mutex(void)
+{
+    AcquireSRWLockExclusive(&global_mutex);
+}
+
+void lw_unlock_global_mutex(void)
+{
+    ReleaseSRWLockExclusive(&global_mutex);
+}
+
+struct lw_cond_tag {
+    CONDITION_VARIABLE cond;
+};
+
+lw_cond_t* lw_create_cond(void)
+{
+    lw_cond_t* cond = (lw_cond_t*)lw_malloc_zero(sizeof(lw_cond_t));
+    if (cond)
+        InitializeConditionVariable(&cond->cond);
+    return cond;
+}
+
+void lw_destroy_cond(lw_cond_t* cond)
+{
+    lw_free(cond);
+}
+
+void lw_wait_cond(lw_cond_t* cond, lw_mutex_t* mutex)
+{
+    SleepConditionVariableSRW(&cond->cond, &mutex->lock, INFINITE, 0);
+}
+
+void lw_broadcast_cond(lw_cond_t* cond)
+{
+    WakeAllConditionVariable(&cond->cond);
+}
+
+struct lw_thread_tag {
+    HANDLE handle;
+    void (*func)(void* arg);
+    void* arg;
+};
+
+static DWORD WINAPI thread_entry(LPVOID arg)
+{
+    lw_thread_t* thread = (lw_thread_t*)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+lw_thread_t* lw_create_thread(void (*func)(void* arg), void* arg)
+{
+    lw_thread_t* thread = (lw_thread_t*)lw_malloc_zero(sizeof(lw_thread_t));
+    if (!thread)
+        return NULL;
+    thread->func = func;
+    thread->arg = arg;
+    if (!(thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL))) {
+        lw_free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void lw_join_thread(lw_thread_t* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    lw_free(thread);
+}
+
+struct lw_read_file_tag {
+    HANDLE handle;
+};
+
+lw_read_file_t* lw_open_read_file(const char* path)
+{
+    wchar_t* wpath = 0;
+    HANDLE handle;
+    if (lw_string_to_wchar(CP_UTF8, path, &wpath))
+        handle = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+    else
+        handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+    lw_freep(&wpath);
+    if (handle == INVALID_HANDLE_VALUE)
+        return NULL;
+    lw_read_file_t* file = (lw_read_file_t*)lw_malloc_zero(sizeof(lw_read_file_t));
+    if (!file) {
+        CloseHandle(handle);
+        return NULL;
+    }
+    file->handle = handle;
+    return file;
+}
+
+void lw_close_read_file(lw_read_file_t* file)
+{
+    if (!file)
+        return;
+    CloseHandle(file->handle);
+    lw_free(file);
+}
+
+int64_t lw_get_read_file_size(lw_read_file_t* file)
+{
+    LARGE_INTEGER size;
+    return GetFileSizeEx(file->handle, &size) ? size.QuadPart : -1;
+}
+
+int lw_read_file_at(lw_read_file_t* file, void* buf, int size, int64_t offset)
+{
+    int done = 0;
+    while (done < size) {
+        /* The offset given by OVERLAPPED is used even for a synchronous handle. */
+        OVERLAPPED overlapped = { 0 };
+        overlapped.Offset = (DWORD)(offset + done);
+        overlapped.OffsetHigh = (DWORD)((offset + done) >> 32);
+        DWORD read_size = 0;
+        if (!ReadFile(file->handle, (uint8_t*)buf + done, (DWORD)(size - done), &read_size, &overlapped))
+            return GetLastError() == ERROR_HANDLE_EOF ? done : -1;
+        if (read_size == 0)
+            break;
+        done += read_size;
+    }
+    return done;
+}
+
+/* Hints are given only on opening a file on Windows. */
+void lw_advise_read_file(lw_read_file_t* file, int access)
+{
+    (void)file;
+    (void)access;
+}
+
+int lw_read_file_batch(lw_read_file_t* file, lw_read_request_t* requests, int count)
+{
+    for (int i = 0; i < count; i++)
+        requests[i].result = lw_read_file_at(file, requests[i].buf, requests[i].size, requests[i].offset);
+    return 0;
+}
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#define LW_READ_FILE_QUEUE_DEPTH 8
+#define LW_READ_FILE_WAIT_RETRIES 16 /* for waiting for the reads still in flight after an unexpected failure */
+#endif
+
+#include "osdep.h"
+#include "utils.h"
+
+struct lw_file_lock_tag {
+    lw_file_lock_t* next;
+    char* path;
+    int fd;
+};
+
+/* Record locks belong to the process, so the threads of this process take turns by the path before taking one. */
+static pthread_mutex_t file_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t file_lock_released = PTHREAD_COND_INITIALIZER;
+static lw_file_lock_t* file_locks = NULL; /* held or being taken by this process */
+
+static int is_file_locked(const char* path)
+{
+    for (lw_file_lock_t* lock = file_locks; lock; lock = lock->next)
+        if (!strcmp(lock->path, path))
+            return 1;
+    return 0;
+}
+
+static void release_file_lock(lw_file_lock_t* lock)
+{
+    pthread_mutex_lock(&file_locks_mutex);
+    lw_file_lock_t** p = &file_locks;
+    while (*p && *p != lock)
+        p = &(*p)->next;
+    if (*p)
+        *p = lock->next;
+    pthread_cond_broadcast(&file_lock_released);
+    pthread_mutex_unlock(&file_locks_mutex);
+    lw_free(lock->path);
+    lw_free(lock);
+}
+
+/* POSIX record locks are used rather than flock() since they also work on NFS.
+ * The holder removes the file on unlocking, so a lock taken on a file already removed is taken again on the new one. */
+lw_file_lock_t* lw_lock_file(const char* path)
+{
+    lw_file_lock_t* lock = (lw_file_lock_t*)lw_malloc_zero(sizeof(lw_file_lock_t));
+    if (!lock)
+        return NULL;
+    lock->path = (char*)lw_malloc_zero(strlen(path) + 1);
+    if (!lock->path) {
+        lw_free(lock);
+        return NULL;
+    }
+    strcpy(lock->path, path);
+    pthread_mutex_lock(&file_locks_mutex);
+    while (is_file_locked(path))
+        pthread_cond_wait(&file_lock_released, &file_locks_mutex);
+    lock->next = file_locks;
+    file_locks = lock;
+    pthread_mutex_unlock(&file_locks_mutex);
+    for (;;) {
+        int fd = open(path, O_RDWR | O_CREAT, 0666);
+        if (fd < 0)
+            break;
+        struct flock fl = { 0 };
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        int ret;
+        while ((ret = fcntl(fd, F_SETLKW, &fl)) == -1 && errno == EINTR)
+            ;
+        struct stat locked;
+        struct stat current;
+        if (ret == 0 && fstat(fd, &locked) == 0 && stat(path, &current) == 0 && locked.st_dev == current.st_dev
+            && locked.st_ino == current.st_ino) {
+            lock->fd = fd;
+            return lock;
+        }
+        close(fd);
+        if (ret != 0)
+            break;
+    }
+    release_file_lock(lock);
+    return NULL;
+}
+
+void lw_unlock_file(lw_file_lock_t* lock)
+{
+    if (!lock)
+        return;
+    /* Remove the file while it is still locked. Closing the descriptor releases the lock. */
+    unlink(lock->path);
+    close(lock->fd);
+    release_file_lock(lock);
+}
+
+struct lw_mutex_tag {
+    pthread_mutex_t lock;
+};
+
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+lw_mutex_t* lw_create_mutex(void)
+{
+    lw_mutex_t* mutex = (lw_mutex_t*)lw_malloc_zero(sizeof(lw_mutex_t));
+    if (mutex && pthread_mutex_init(&mutex->lock, NULL)) {
+        lw_free(mutex);
+        return NULL;
+    }
+    return mutex;
+}
+
+void lw_destroy_mutex(lw_mutex_t* mutex)
+{
+    if (!mutex)
+        return;
+    pthread_mutex_destroy(&mutex->lock);
+    lw_free(mutex);
+}
+
+void lw_lock_mutex(lw_mutex_t* mutex)
+{
+    pthread_mutex_lock(&mutex->lock);
+}
+
+void lw_unlock_mutex(lw_mutex_t* mutex)
+{
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+void lw_lock_global_mutex(void)
+{
+    pthread_mutex_lock(&global_mutex);
+}
+
+void lw_unlock_global_mutex(void)
+{
+    pthread_mutex_unlock(&global_mutex);
+}
+
+struct lw_cond_tag {
+    pthread_cond_t cond;
+};
+
+lw_cond_t* lw_create_cond(void)
+{
+    lw_cond_t* cond = (lw_cond_t*)lw_malloc_zero(sizeof(lw_cond_t));
+    if (cond && pthread_cond_init(&cond->cond, NULL)) {
+        lw_free(cond);
+        return NULL;
+    }
+    return cond;
+}
+
+void lw_destroy_cond(lw_cond_t* cond)
+{
+    if (!cond)
+        return;
+    pthread_cond_destroy(&cond->cond);
+    lw_free(cond);
+}
+
+void lw_wait_cond(lw_cond_t* cond, lw_mutex_t* mutex)
+{
+    pthread_cond_wait(&cond->cond, &mutex->lock);
+}
+
+void lw_broadcast_cond(lw_cond_t* cond)
+{
+    pthread_cond_broadcast(&cond->cond);
+}
+
+struct lw_thread_tag {
+    pthread_t thread;
+    void (*func)(void* arg);
+    void* arg;
+};
+
+static void* thread_entry(void* arg)
+{
+    lw_thread_t* thread = (lw_thread_t*)arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+lw_thread_t* lw_create_thread(void (*func)(void* arg), void* arg)
+{
+    lw_thread_t* thread = (lw_thread_t*)lw_malloc_zero(sizeof(lw_thread_t));
+    if (!thread)
+        return NULL;
+    thread->func = func;
+    thread->arg = arg;
+    if (pthread_create(&thread->thread, NULL, thread_entry, thread)) {
+        lw_free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void lw_join_thread(lw_thread_t* thread)
+{
+    pthread_join(thread->thread, NULL);
+    lw_free(thread);
+}
+
+struct lw_read_file_tag {
+    int fd;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    int ring_tried;
+    int ring_initialized; /* to be exited on closing even if it became unusable */
+    int ring_usable;
+#endif
+};
+
+lw_read_file_t* lw_open_read_file(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    lw_read_file_t* file = (lw_read_file_t*)lw_malloc_zero(sizeof(lw_read_file_t));
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    file->fd = fd;
+    return file;
+}
+
+void lw_close_read_file(lw_read_file_t* file)
+{
+    if (!file)
+        return;
+#ifdef HAVE_LIBURING
+    if (file->ring_initialized)
+        io_uring_queue_exit(&file->ring);
+#endif
+    close(file->fd);
+    lw_free(file);
+}
+
+int64_t lw_get_read_file_size(lw_read_file_t* file)
+{
+    struct stat st;
+    return fstat(file->fd, &st) == 0 && S_ISREG(st.st_mode) ? (int64_t)st.st_size : -1;
+}
+
+int lw_read_file_at(lw_read_file_t* file, void* buf, int size, int64_t offset)
+{
+    int done = 0;
+    while (done < size) {
+        ssize_t ret = pread(file->fd, (uint8_t*)buf + done, size - done, (off_t)(offset + done));
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        done += (int)ret;
+    }
+    return done;
+}
+
+void lw_advise_read_file(lw_read_file_t* file, int access)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(file->fd, 0, 0, access == LW_FILE_ACCESS_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+#else
+    (void)file;
+    (void)access;
+#endif
+}
+
+#define LW_READ_NOT_DONE INT_MIN
+
+#ifdef HAVE_LIBURING
+/* Ask for the cancellation of the reads still in flight.
+ * Return the number of the reads that were left in the submission queue and have now been submitted with it. */
+static int cancel_reads_uring(lw_read_file_t* file, lw_read_request_t* requests, const int* in_flight, int count)
+{
+    int left = (int)io_uring_sq_ready(&file->ring);
+    for (int i = 0; i < count; i++) {
+        struct io_uring_sqe* sqe;
+        if (!in_flight[i] || !(sqe = io_uring_get_sqe(&file->ring)))
+            continue;
+        io_uring_prep_cancel(sqe, &requests[i], 0);
+        io_uring_sqe_set_data(sqe, NULL);
+    }
+    int submitted = io_uring_submit(&file->ring);
+    return MIN(MAX(submitted, 0), left);
+}
+
+/* Submit the reads to io_uring and wait for all of them.
+ * Reads failed or not submitted are left as not done, and they are done again into the same buffers.
+ * If waiting keeps failing, the reads still in flight are abandoned with their result set to -1 and -1 is returned.
+ * The ring is then left as it is, since exiting it could not stop them either. */
+static int read_file_batch_uring(lw_read_file_t* file, lw_read_request_t* requests, int count)
+{
+    /* io_uring may be missing from the kernel or denied by a sandbox. */
+    if (!file->ring_tried) {
+        file->ring_tried = 1;
+        file->ring_initialized = io_uring_queue_init(LW_READ_FILE_QUEUE_DEPTH, &file->ring, 0) == 0;
+        file->ring_usable = file->ring_initialized;
+    }
+    for (int done = 0; file->ring_usable && done < count;) {
+        int n = MIN(count - done, LW_READ_FILE_QUEUE_DEPTH);
+        int in_flight[LW_READ_FILE_QUEUE_DEPTH] = { 0 };
+        for (int i = 0; i < n; i++) {
+            lw_read_request_t* request = &requests[done + i];
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&file->ring);
+            io_uring_prep_read(sqe, file->fd, request->buf, (unsigned)request->size, (uint64_t)request->offset);
+            io_uring_sqe_set_data(sqe, request);
+        }
+        int submitted = io_uring_submit(&file->ring);
+        if (submitted < 0)
+            submitted = 0;
+        int waiting = submitted;
+        for (int i = 0; i < submitted; i++)
+            in_flight[i] = 1;
+        if (submitted != n)
+            /* Do not use the ring any more, since reads not submitted may remain in it. */
+            file->ring_usable = 0;
+        int failures = 0;
+        while (waiting > 0) {
+            struct io_uring_cqe* cqe;
+            int err = io_uring_wait_cqe(&file->ring, &cqe);
+            if (err == -EINTR || err == -EAGAIN)
+                continue;
+            if (err < 0) {
+                /* Not expected while reads are in flight. The rest is read one by one after they are gone. */
+                file->ring_usable = 0;
+                if (failures == 0)
+                    /* The submission queue is in order, so the reads left in it are submitted from the first one. */
+                    for (int left = cancel_reads_uring(file, requests + done, in_flight, n); left > 0; left--) {
+                        in_flight[submitted++] = 1;
+                        ++waiting;
+                    }
+                else if (failures == LW_READ_FILE_WAIT_RETRIES) {
+                    /* Give up rather than spin forever. The ring and the buffers of the reads are never released. */
+                    file->ring_initialized = 0;
+                    for (int i = 0; i < n; i++)
+                        if (in_flight[i])
+                            requests[done + i].result = -1;
+                    return -1;
+                }
+                ++failures;
+                continue;
+            }
+            lw_read_request_t* request = (lw_read_request_t*)io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&file->ring, cqe);
+            if (!request)
+                continue; /* a cancellation */
+            in_flight[request - &requests[done]] = 0;
+            --waiting;
+            if (res == 0 || res == request->size)
+                request->result = res;
+            else if (res > 0) {
+                /* A short read is not always the end of the file. */
+                int rest = lw_read_file_at(file, (uint8_t*)request->buf + res, request->size - res, request->offset + res);
+                request->result = rest < 0 ? rest : res + rest;
+            }
+        }
+        done += n;
+    }
+    return 0;
+}
+#endif
+
+int lw_read_file_batch(lw_read_file_t* file, lw_read_request_t* requests, int count)
+{
+    int ret = 0;
+    for (int i = 0; i < count; i++)
+        requests[i].result = LW_READ_NOT_DONE;
+#ifdef HAVE_LIBURING
+    ret = read_file_batch_uring(file, requests, count);
+#endif
+    for (int i = 0; i < count; i++)
+        if (requests[i].result == LW_READ_NOT_DONE)
+            requests[i].result = lw_read_file_at(file, requests[i].buf, requests[i].size, requests[i].offset);
+    return ret;
+}
+
 #endif
@@ -23,16 +23,88 @@
 #ifndef OSDEP_H
 #define OSDEP_H
 
+#include <stdint.h>
+
 #ifdef _WIN32
 #include <stdio.h>
 FILE* lw_win32_fopen(const char* name, const char* mode);
 #define lw_fopen lw_win32_fopen
 char* lw_realpath(const char* path, char* resolved);
+int lw_win32_rename(const char* oldname, const char* newname);
+#define lw_rename lw_win32_rename
+int lw_win32_remove(const char* name);
+#define lw_remove lw_win32_remove
+#define lw_fseek _fseeki64
+#define lw_ftell _ftelli64
+#include <process.h>
+#define lw_getpid _getpid
 #else
 #define lw_fopen fopen
 #define lw_realpath realpath
+#define lw_rename rename
+#define lw_remove remove
+#define lw_fseek fseeko
+#define lw_ftell ftello
+#include <unistd.h>
+#define lw_getpid getpid
 #endif
 
+/* Exclusive advisory lock on a file, which is created if missing and removed on unlocking.
+ * Threads of the same process exclude each other as well as other processes.
+ * lw_lock_file() blocks until the lock is acquired and returns NULL on failure. */
+typedef struct lw_file_lock_tag lw_file_lock_t;
+lw_file_lock_t* lw_lock_file(const char* path);
+void lw_unlock_file(lw_file_lock_t* lock);
+
+/* Mutual exclusion between the threads of this process
+ * lw_create_mutex() returns NULL on failure. The global mutex needs no creation and guards process wide lists. */
+typedef struct lw_mutex_tag lw_mutex_t;
+lw_mutex_t* lw_create_mutex(void);
+void lw_destroy_mutex(lw_mutex_t* mutex);
+void lw_lock_mutex(lw_mutex_t* mutex);
+void lw_unlock_mutex(lw_mutex_t* mutex);
+void lw_lock_global_mutex(void);
+void lw_unlock_global_mutex(void);
+
+/* Condition variables waited with a locked lw_mutex_t */
+typedef struct lw_cond_tag lw_cond_t;
+lw_cond_t* lw_create_cond(void);
+void lw_destroy_cond(lw_cond_t* cond);
+void lw_wait_cond(lw_cond_t* cond, lw_mutex_t* mutex);
+void lw_broadcast_cond(lw_cond_t* cond);
+
+/* lw_create_thread() returns NULL on failure. */
+typedef struct lw_thread_tag lw_thread_t;
+lw_thread_t* lw_create_thread(void (*func)(void* arg), void* arg);
+void lw_join_thread(lw_thread_t* thread);
+
+/* A file read at given offsets, so that several threads can read it at once
+ * lw_read_file_at() returns the number of bytes read, which is less than size only at the end of the file,
+ * or a negative value on error. */
+#define LW_FILE_ACCESS_RANDOM 0
+#define LW_FILE_ACCESS_SEQUENTIAL 1
+typedef struct lw_read_file_tag lw_read_file_t;
+lw_read_file_t* lw_open_read_file(const char* path);
+void lw_close_read_file(lw_read_file_t* file);
+int64_t lw_get_read_file_size(lw_read_file_t* file);
+int lw_read_file_at(lw_read_file_t* file, void* buf, int size, int64_t offset);
+/* Tell the system how the file will be read. This is only a hint and may be ignored. */
+void lw_advise_read_file(lw_read_file_t* file, int access);
+
+/* Several reads of a file issued at once
+ * With io_uring on Linux, they are in flight together. Otherwise, or if io_uring is unavailable at runtime, they are done one by one.
+ * result is set as the return value of lw_read_file_at().
+ * lw_read_file_batch() must not be called by two threads at once for the same file.
+ * It returns -1 if some reads could be neither completed nor cancelled, otherwise 0.
+ * Then their result is -1, and their buffers may still be written, so they must never be freed or used again. */
+typedef struct {
+    void* buf;
+    int size;
+    int64_t offset;
+    int result;
+} lw_read_request_t;
+int lw_read_file_batch(lw_read_file_t* file, lw_read_request_t* requests, int count);
+
 #ifdef _WIN32
 #include <wchar.h>
 int lw_string_to_wchar(int cp, const char* from, wchar_t** to);
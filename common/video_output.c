@@ -142,6 +142,7 @@ void lw_cleanup_video_output_handler(lw_video_output_handler_t* vohp)
         vohp->free_private_handler(vohp->private_handler);
     vohp->private_handler = NULL;
     lw_freep(&vohp->frame_order_list);
+    lw_freep(&vohp->cfr_map);
     for (int i = 0; i < REPEAT_CONTROL_CACHE_NUM; i++)
         av_frame_free(&vohp->frame_cache_buffers[i]);
     if (vohp->scaler.sws_ctx) {
@@ -150,6 +151,67 @@ void lw_cleanup_video_output_handler(lw_video_output_handler_t* vohp)
     }
 }
 
+int lw_setup_cfr_map(
+    lw_video_output_handler_t* vohp, uint32_t source_count, int (*get_time)(void* opaque, uint32_t source_number, double* time), void* opaque)
+{
+    vohp->cfr_map_unavailable = 1;
+    uint32_t* map = (uint32_t*)lw_malloc_zero((vohp->frame_count + 1) * sizeof(uint32_t));
+    if (!map)
+        return -1;
+    /* The times only go forward, so every output frame is mapped by one sweep over the source frames. */
+    uint32_t number = 0;
+    double time = 0;
+    uint32_t prev_number = 0;
+    double prev_time = 0;
+    int timed = 0; /* Set once any source frame has a usable time. */
+    for (uint32_t frame_number = 1; frame_number <= vohp->frame_count; frame_number++) {
+        double target_time = (double)((uint64_t)(frame_number - 1) * vohp->cfr_den) / vohp->cfr_num;
+        double next_target_time = (double)((uint64_t)frame_number * vohp->cfr_den) / vohp->cfr_num;
+        /* Find the first source frame presented at or after the target. */
+        while (number <= source_count && (number == 0 || time < target_time)) {
+            if (number) {
+                prev_number = number;
+                prev_time = time;
+            }
+            int ret = 1;
+            double next_time = 0;
+            while (ret > 0 && ++number <= source_count)
+                if ((ret = get_time(opaque, number, &next_time)) < 0)
+                    goto fail;
+            if (ret == 0) {
+                if (prev_number && next_time <= prev_time)
+                    goto fail;
+                time = next_time;
+                timed = 1;
+            }
+        }
+        if (!timed)
+            /* Without any time there is nothing to map, so let the caller fall back. */
+            goto fail;
+        if (number > source_count)
+            map[frame_number] = source_count;
+        else if (time == target_time)
+            map[frame_number] = number;
+        else if (prev_number == 0)
+            map[frame_number] = 1;
+        else if (time > next_target_time)
+            /* Between the current target and the next target, there are no source frames. Therefore, output the previous one. */
+            map[frame_number] = prev_number;
+        else if (time > (next_target_time + target_time) / 2)
+            /* The source frame is far from the current target and should be a candidate for the next target. */
+            map[frame_number] = prev_number;
+        else
+            /* Choose the nearest one. */
+            map[frame_number] = time - target_time >= target_time - prev_time ? prev_number : number;
+    }
+    vohp->cfr_map = map;
+    vohp->cfr_map_unavailable = 0;
+    return 0;
+fail:
+    lw_free(map);
+    return -1;
+}
+
 int transfer_frame_data(AVFrame* dst, AVFrame* src)
 {
     if (src->hw_frames_ctx) {
@@ -67,6 +67,8 @@ typedef struct {
     int vfr2cfr;
     uint32_t cfr_num;
     uint32_t cfr_den;
+    uint32_t* cfr_map; /* the source frame number for each output frame, built at the first conversion */
+    int cfr_map_unavailable;
     /* Repeat control */
     int repeat_control;
     int repeat_requested;
@@ -97,6 +99,14 @@ int update_scaler_configuration_if_needed(lw_video_scaler_handler_t* vshp, lw_lo
 
 void lw_cleanup_video_output_handler(lw_video_output_handler_t* vohp);
 
+/* Build the VFR->CFR map from the presentation times in seconds of the source frames, which are numbered from 1 in composition order.
+ * get_time() returns 0 if successful, 1 if the source frame has no time, and a negative value otherwise.
+ * Return 0 if successful.
+ * Return a negative value if failed, if no source frame has a time or if the times are not strictly increasing,
+ * and then the map is not used. */
+int lw_setup_cfr_map(
+    lw_video_output_handler_t* vohp, uint32_t source_count, int (*get_time)(void* opaque, uint32_t source_number, double* time), void* opaque);
+
 int transfer_frame_data(AVFrame* dst, AVFrame* src);
 
 #ifdef __cplusplus